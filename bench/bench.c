@@ -0,0 +1,533 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <common/exitcodes.h>
+#include <common/guard.h>
+#include <lexer/lexer.h>
+#include <lexer/source.h>
+#include <libmkc/mkc.h>
+#include <main/arguments.h>
+#include <main/dump_lunits.h>
+
+#include "bench.h"
+#include "corpus.h"
+
+#define BENCH_DEFAULT_REPEAT 3
+/* Identifiers long enough to make lexme_append dominate lexing */
+#define BENCH_LONG_IDENT_LENGTH 4096
+
+/*
+  Result of a single benchmark
+  tokens is 0 when benchmark doesn't produce tokens
+*/
+struct bench_result
+{
+    double seconds;
+    size_t bytes;
+    size_t tokens;
+};
+
+struct bench_case
+{
+    char *name;
+    void (*run)(struct corpus_params *params, struct bench_result *result);
+};
+
+static struct arguments *register_options(void);
+static size_t get_size_option(struct arguments *args, char *name,
+    size_t fallback);
+static void bench_lunit_get(struct corpus_params *params,
+    struct bench_result *result);
+static void bench_source_next(struct corpus_params *params,
+    struct bench_result *result);
+static void bench_lexme_append(struct corpus_params *params,
+    struct bench_result *result);
+static void bench_dump_lunits(struct corpus_params *params,
+    struct bench_result *result);
+static void bench_dump_summary(struct corpus_params *params,
+    struct bench_result *result);
+static void bench_libmkc_next(struct corpus_params *params,
+    struct bench_result *result);
+static void run_dump(struct corpus_params *params,
+    struct bench_result *result, char **options, size_t option_count);
+static size_t lex_corpus(char *text, size_t length);
+static void generate(struct corpus_params *params);
+static bool run_case(struct bench_case *bench, struct corpus_params *params,
+    size_t repeat, char *baseline);
+static bool read_baseline(char *baseline, char *name, double *minimum);
+
+static struct bench_case cases[] =
+{
+    { "lunit_get", bench_lunit_get },
+    { "source_next", bench_source_next },
+    { "lexme_append", bench_lexme_append },
+    { "dump_lunits", bench_dump_lunits },
+    { "dump_summary", bench_dump_summary },
+    { "libmkc_next", bench_libmkc_next }
+};
+
+#define CASE_COUNT (sizeof(cases) / sizeof(cases[0]))
+
+
+int main(int argc, char **argv)
+{
+    struct arguments *args;
+    struct corpus_params params;
+    struct switch_info *info;
+    char *baseline;
+    size_t repeat;
+    double max_exponent;
+    bool passed;
+
+    args = register_options();
+    arg_parse(args, argc - 1, &argv[1]);
+
+    corpus_default_params(&params);
+    params.size = get_size_option(args, "size", params.size);
+    params.ident_length = get_size_option(args, "ident-length",
+        params.ident_length);
+    params.keyword_percent = get_size_option(args, "keywords",
+        params.keyword_percent);
+    params.max_indent = get_size_option(args, "indent", params.max_indent);
+    params.seed = get_size_option(args, "seed", params.seed);
+    repeat = get_size_option(args, "repeat", BENCH_DEFAULT_REPEAT);
+
+    info = arg_find_long(args, "max-exponent");
+    max_exponent = info->occurrences == 0
+        ? SCALE_DEFAULT_MAX_EXPONENT
+        : strtod(info->parameters.data[info->occurrences - 1], NULL);
+
+    info = arg_find_long(args, "baseline");
+    baseline = info->occurrences == 0 ? NULL : info->parameters.data[0];
+
+    if (args->parameters.count == 2
+        && strcmp(args->parameters.data[0], "scale") == 0)
+    {
+        passed = scale_run(args->parameters.data[1], max_exponent);
+        arg_destroy_struct(args);
+        return passed ? 0 : 1;
+    }
+
+    if (args->parameters.count != 1)
+    {
+        fputs("Usage: mkc_bench [options] generate|all|<benchmark>\n"
+            "       benchmarks: lunit_get source_next lexme_append "
+            "dump_lunits dump_summary libmkc_next\n"
+            "       mkc_bench [--max-exponent X] scale all|<case>\n",
+            stderr);
+        exit(EXITCODE_INVOCATION_ERROR);
+    }
+
+    if (strcmp(args->parameters.data[0], "generate") == 0)
+    {
+        generate(&params);
+        arg_destroy_struct(args);
+        return 0;
+    }
+
+    printf("%-14s %12s %12s %14s\n", "benchmark", "bytes", "MB/s", "tokens/s");
+
+    passed = true;
+
+    for (size_t i = 0; i != CASE_COUNT; ++i)
+    {
+        if (strcmp(args->parameters.data[0], "all") != 0
+            && strcmp(args->parameters.data[0], cases[i].name) != 0)
+            continue;
+
+        if (run_case(&cases[i], &params, repeat, baseline) == false)
+            passed = false;
+    }
+
+    arg_destroy_struct(args);
+
+    return passed ? 0 : 1;
+}
+
+static struct arguments *register_options(void)
+{
+    struct arguments *args;
+    char *names[] = {
+        "size", "ident-length", "keywords", "indent",
+        "seed", "repeat", "baseline", "max-exponent"
+    };
+
+    args = arg_create_struct();
+
+    for (size_t i = 0; i != sizeof(names) / sizeof(names[0]); ++i)
+    {
+        struct switch_info *info;
+
+        info = arg_create_switch_info(args, true);
+        arg_add_long(info, names[i]);
+        arg_register(args, info);
+    }
+
+    return args;
+}
+
+static size_t get_size_option(struct arguments *args, char *name,
+    size_t fallback)
+{
+    struct switch_info *info;
+    char *end;
+    unsigned long long value;
+
+    info = arg_find_long(args, name);
+
+    if (info->occurrences == 0)
+        return fallback;
+
+    /* Last occurrence wins */
+    errno = 0;
+    value = strtoull(info->parameters.data[info->occurrences - 1], &end, 0);
+
+    if (errno != 0 || *end != '\0')
+    {
+        fprintf(stderr, "Option %s expects a number\n", name);
+        exit(EXITCODE_INVOCATION_ERROR);
+    }
+
+    return value;
+}
+
+/* Lex whole corpus, return number of tokens */
+static size_t lex_corpus(char *text, size_t length)
+{
+    struct sources *sources;
+    FILE *fd;
+    size_t tokens;
+
+    fd = bench_open_memory(text, length);
+
+    sources = source_create_struct();
+    source_push(sources, fd);
+
+    tokens = 0;
+
+    while (true)
+    {
+        struct lunit *lunit;
+        bool finish;
+
+        lunit = lunit_get(sources);
+        finish = lunit->token == TOK_EOF;
+        lunit_destroy(lunit);
+
+        tokens += 1;
+
+        if (finish) break;
+    }
+
+    source_pop(sources);
+    source_destroy_struct(sources);
+    fclose(fd);
+
+    return tokens;
+}
+
+static void bench_lunit_get(struct corpus_params *params,
+    struct bench_result *result)
+{
+    char *text;
+    size_t length;
+    double start;
+
+    text = corpus_generate(params, &length);
+
+    start = bench_now();
+    result->tokens = lex_corpus(text, length);
+    result->seconds = bench_now() - start;
+    result->bytes = length;
+
+    free(text);
+}
+
+static void bench_source_next(struct corpus_params *params,
+    struct bench_result *result)
+{
+    struct sources *sources;
+    char *text;
+    size_t length;
+    FILE *fd;
+    double start;
+
+    text = corpus_generate(params, &length);
+    fd = bench_open_memory(text, length);
+
+    start = bench_now();
+
+    sources = source_create_struct();
+    source_push(sources, fd);
+
+    while (source_get(sources) != '\0')
+        source_next(sources);
+
+    source_pop(sources);
+    source_destroy_struct(sources);
+
+    result->seconds = bench_now() - start;
+    result->bytes = length;
+    result->tokens = 0;
+
+    fclose(fd);
+    free(text);
+}
+
+static void bench_lexme_append(struct corpus_params *params,
+    struct bench_result *result)
+{
+    struct corpus_params long_idents;
+
+    /*
+      lexme_append is static, exercise it through the lexer
+      with a corpus made of long identifiers only
+    */
+    long_idents = *params;
+    long_idents.ident_length = BENCH_LONG_IDENT_LENGTH;
+    long_idents.keyword_percent = 0;
+    long_idents.max_indent = 0;
+
+    bench_lunit_get(&long_idents, result);
+}
+
+static void bench_dump_lunits(struct corpus_params *params,
+    struct bench_result *result)
+{
+    char *options[] = { "-o", "/dev/null" };
+
+    run_dump(params, result, options, sizeof(options) / sizeof(options[0]));
+}
+
+static void bench_dump_summary(struct corpus_params *params,
+    struct bench_result *result)
+{
+    char *options[] = { "--summary", "-o", "/dev/null" };
+
+    run_dump(params, result, options, sizeof(options) / sizeof(options[0]));
+}
+
+/* Same work as lunit_get but through the public library interface */
+static void bench_libmkc_next(struct corpus_params *params,
+    struct bench_result *result)
+{
+    struct mkc_lexer *lexer;
+    struct mkc_token token;
+    char *text;
+    size_t length;
+    double start;
+
+    text = corpus_generate(params, &length);
+
+    start = bench_now();
+
+    if (mkc_lexer_open_memory(text, length, &lexer) != MKC_OK)
+    {
+        fprintf(stderr, "%s\n", mkc_error());
+        exit(EXITCODE_INTERNAL_ERROR);
+    }
+
+    result->tokens = 0;
+
+    do
+    {
+        if (mkc_lexer_next(lexer, &token) != MKC_OK)
+        {
+            fprintf(stderr, "%s\n", mkc_error());
+            exit(EXITCODE_INTERNAL_ERROR);
+        }
+
+        result->tokens += 1;
+    }
+    while (token.kind != MKC_TOKEN_EOF);
+
+    mkc_lexer_close(lexer);
+
+    result->seconds = bench_now() - start;
+    result->bytes = length;
+
+    free(text);
+}
+
+/* Run 'mkc dump lunits <corpus file> options...' in this process */
+static void run_dump(struct corpus_params *params,
+    struct bench_result *result, char **options, size_t option_count)
+{
+    char path[] = "/tmp/mkc_bench_XXXXXX";
+    char *argv[8] = { "mkc", "dump", "lunits", path };
+    char *text;
+    size_t length;
+    size_t tokens;
+    FILE *fd;
+    int file;
+    double start;
+
+    for (size_t i = 0; i != option_count; ++i)
+        argv[4 + i] = options[i];
+
+    text = corpus_generate(params, &length);
+
+    /* Token count comes from a separate run, dump_lunits doesn't report it */
+    tokens = lex_corpus(text, length);
+
+    file = mkstemp(path);
+
+    if (file == -1)
+    {
+        fprintf(stderr, "mkstemp failed: %s\n", strerror(errno));
+        exit(EXITCODE_INTERNAL_ERROR);
+    }
+
+    fd = fdopen(file, "w");
+
+    if (fd == NULL || fwrite(text, length, 1, fd) != 1 || fclose(fd) != 0)
+    {
+        fprintf(stderr, "Failed to write corpus: %s\n", strerror(errno));
+        exit(EXITCODE_INTERNAL_ERROR);
+    }
+
+    start = bench_now();
+    dump_lunits(4 + option_count, argv);
+    result->seconds = bench_now() - start;
+    result->bytes = length;
+    result->tokens = tokens;
+
+    unlink(path);
+    free(text);
+}
+
+static void generate(struct corpus_params *params)
+{
+    char *text;
+    size_t length;
+
+    text = corpus_generate(params, &length);
+
+    if (fwrite(text, length, 1, stdout) != 1)
+    {
+        fprintf(stderr, "Failed to write corpus: %s\n", strerror(errno));
+        exit(EXITCODE_INTERNAL_ERROR);
+    }
+
+    free(text);
+}
+
+/* Run benchmark repeat times, keep the best run, compare it to baseline */
+static bool run_case(struct bench_case *bench, struct corpus_params *params,
+    size_t repeat, char *baseline)
+{
+    struct bench_result best;
+    double mbps;
+    double minimum;
+
+    best.seconds = 0;
+
+    for (size_t i = 0; i != (repeat == 0 ? 1 : repeat); ++i)
+    {
+        struct bench_result result;
+
+        bench->run(params, &result);
+
+        if (i == 0 || result.seconds < best.seconds)
+            best = result;
+    }
+
+    /* Don't divide by zero on tiny corpora */
+    if (best.seconds <= 0)
+        best.seconds = 1e-9;
+
+    mbps = best.bytes / best.seconds / 1e6;
+
+    if (best.tokens == 0)
+        printf("%-14s %12zu %12.2f %14s\n", bench->name, best.bytes, mbps, "-");
+    else
+        printf("%-14s %12zu %12.2f %14.0f\n", bench->name, best.bytes, mbps,
+            best.tokens / best.seconds);
+
+    if (baseline == NULL || read_baseline(baseline, bench->name, &minimum)
+        == false)
+        return true;
+
+    if (mbps < minimum)
+    {
+        printf("%-14s FAILED: %.2f MB/s is below baseline of %.2f MB/s\n",
+            bench->name, mbps, minimum);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+  Baseline file consists of lines "<benchmark> <minimal MB/s>"
+  Lines starting with '#' are comments
+  Returns false if there is no baseline for a given benchmark
+*/
+static bool read_baseline(char *baseline, char *name, double *minimum)
+{
+    FILE *fd;
+    char line[256];
+    bool found;
+
+    fd = fopen(baseline, "r");
+
+    if (fd == NULL)
+    {
+        fprintf(stderr, "Failed to open baseline '%s': %s\n",
+            baseline, strerror(errno));
+        exit(EXITCODE_INVOCATION_ERROR);
+    }
+
+    found = false;
+
+    while (found == false && fgets(line, sizeof(line), fd) != NULL)
+    {
+        char entry[128];
+        double value;
+
+        if (line[0] == '#')
+            continue;
+
+        if (sscanf(line, "%127s %lf", entry, &value) != 2)
+            continue;
+
+        if (strcmp(entry, name) == 0)
+        {
+            *minimum = value;
+            found = true;
+        }
+    }
+
+    fclose(fd);
+
+    return found;
+}
+
+double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+FILE *bench_open_memory(char *text, size_t length)
+{
+    FILE *fd;
+
+    fd = fmemopen(text, length, "r");
+
+    if (fd == NULL)
+    {
+        fprintf(stderr, "fmemopen failed: %s\n", strerror(errno));
+        exit(EXITCODE_INTERNAL_ERROR);
+    }
+
+    return fd;
+}
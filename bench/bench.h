@@ -0,0 +1,18 @@
+#ifndef _BENCH_BENCH_H_
+#define _BENCH_BENCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+  Time grows as size^exponent, anything noticeably above 1
+  means that a path is super-linear
+*/
+#define SCALE_DEFAULT_MAX_EXPONENT 1.3
+
+double bench_now(void);
+FILE *bench_open_memory(char *text, size_t length);
+bool scale_run(char *name, double max_exponent);
+
+#endif
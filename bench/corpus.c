@@ -0,0 +1,153 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <common/guard.h>
+
+#include "corpus.h"
+
+#define WORDS_PER_LINE_MAX 8
+
+static uint64_t next_random(uint64_t *state);
+static size_t generate_line(struct corpus_params *params, uint64_t *state,
+    char *out);
+static size_t generate_identifier(struct corpus_params *params,
+    uint64_t *state, char *out);
+
+static const char *keywords[] = { "procedure", "return" };
+
+/* Characters allowed in identifiers, see test_char_ident_* in lexer.c */
+static const char initial_chars[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ-";
+static const char following_chars[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ-0123456789";
+
+
+void corpus_default_params(struct corpus_params *params)
+{
+    params->size = 4 * 1024 * 1024;
+    params->ident_length = 8;
+    params->keyword_percent = 20;
+    params->max_indent = 3;
+    params->seed = 0x6d6b63;
+}
+
+char *corpus_generate(struct corpus_params *params, size_t *length)
+{
+    char *text;
+    char *line;
+    size_t line_max;
+    size_t used;
+    uint64_t state;
+
+    /*
+      Longest line possible: indentation, words with separators and EOL
+      Identifiers are at most twice as long as requested
+    */
+    line_max = params->max_indent
+        + WORDS_PER_LINE_MAX * (2 * params->ident_length + 16) + 1;
+
+    /* Generated text can overshoot requested size by one line */
+    text = malloc(params->size + line_max);
+
+    GUARD(text)
+
+    /* xorshift doesn't work with zero state */
+    state = params->seed != 0 ? params->seed : 1;
+    used = 0;
+
+    while (used < params->size)
+    {
+        line = &text[used];
+        used += generate_line(params, &state, line);
+    }
+
+    *length = used;
+
+    return text;
+}
+
+/* xorshift64* - fast and deterministic, that's all we need here */
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t x;
+
+    x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+static size_t generate_line(struct corpus_params *params, uint64_t *state,
+    char *out)
+{
+    size_t used;
+    size_t indent;
+    size_t words;
+
+    used = 0;
+
+    indent = next_random(state) % (params->max_indent + 1);
+    memset(out, '\t', indent);
+    used += indent;
+
+    words = 1 + next_random(state) % WORDS_PER_LINE_MAX;
+
+    for (size_t i = 0; i != words; ++i)
+    {
+        if (i != 0)
+        {
+            out[used] = ' ';
+            used += 1;
+        }
+
+        if (next_random(state) % 100 < params->keyword_percent)
+        {
+            const char *keyword;
+            size_t keyword_length;
+
+            keyword = keywords[next_random(state) % 2];
+            keyword_length = strlen(keyword);
+            memcpy(&out[used], keyword, keyword_length);
+            used += keyword_length;
+        }
+        else
+        {
+            used += generate_identifier(params, state, &out[used]);
+        }
+    }
+
+    out[used] = '\n';
+    used += 1;
+
+    return used;
+}
+
+static size_t generate_identifier(struct corpus_params *params,
+    uint64_t *state, char *out)
+{
+    size_t length;
+
+    /* Length is uniformly distributed between 1 and 2 * ident_length - 1 */
+    if (params->ident_length <= 1)
+        length = 1;
+    else
+        length = 1 + next_random(state) % (2 * params->ident_length - 1);
+
+    out[0] = initial_chars[next_random(state) % (sizeof(initial_chars) - 1)];
+
+    for (size_t i = 1; i != length; ++i)
+    {
+        size_t pick;
+
+        pick = next_random(state) % (sizeof(following_chars) - 1);
+        out[i] = following_chars[pick];
+    }
+
+    return length;
+}
@@ -0,0 +1,26 @@
+#ifndef _BENCH_CORPUS_H_
+#define _BENCH_CORPUS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  Shape of a generated Kres corpus
+  Same parameters (seed included) always produce the same corpus
+  keyword_percent is a chance (0-100) that a word will be a keyword
+  ident_length is an average length of an identifier
+  max_indent is the deepest indentation (in tabs) a line can have
+*/
+struct corpus_params
+{
+    size_t size;
+    size_t ident_length;
+    unsigned int keyword_percent;
+    unsigned int max_indent;
+    uint64_t seed;
+};
+
+void corpus_default_params(struct corpus_params *params);
+char *corpus_generate(struct corpus_params *params, size_t *length);
+
+#endif
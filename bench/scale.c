@@ -0,0 +1,342 @@
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <common/exitcodes.h>
+#include <common/guard.h>
+#include <common/lstring.h>
+#include <lexer/lexer.h>
+#include <lexer/source.h>
+
+#include "bench.h"
+
+/* Every case runs with size, 2 * size, ... up to SCALE_STEPS sizes */
+#define SCALE_STEPS 4
+
+/*
+  A case builds its input for a given size and measures only the work
+  It runs in a child process so that peak RSS belongs to one size only
+*/
+struct scale_case
+{
+    char *name;
+    size_t base_size;
+    double (*run)(size_t size);
+};
+
+struct scale_sample
+{
+    size_t size;
+    double seconds;
+    long peak_rss_kb;
+};
+
+static double scale_huge_identifier(size_t size);
+static double scale_long_line(size_t size);
+static double scale_unknown_bytes(size_t size);
+static double scale_deep_stack(size_t size);
+static double scale_lstring_append_char(size_t size);
+static double lex_text(char *text, size_t length);
+static bool run_case(struct scale_case *scale, double max_exponent);
+static void sample(struct scale_case *scale, size_t size,
+    struct scale_sample *out);
+static double fit_exponent(struct scale_sample *samples, size_t count);
+
+static struct scale_case cases[] =
+{
+    { "huge_identifier", 2 * 1024 * 1024, scale_huge_identifier },
+    { "long_line", 2 * 1024 * 1024, scale_long_line },
+    { "unknown_bytes", 512 * 1024, scale_unknown_bytes },
+    { "deep_stack", 64 * 1024, scale_deep_stack },
+    { "lstring_append_char", 4 * 1024 * 1024, scale_lstring_append_char }
+};
+
+#define CASE_COUNT (sizeof(cases) / sizeof(cases[0]))
+
+
+bool scale_run(char *name, double max_exponent)
+{
+    bool passed;
+    bool found;
+
+    passed = true;
+    found = false;
+
+    for (size_t i = 0; i != CASE_COUNT; ++i)
+    {
+        if (strcmp(name, "all") != 0 && strcmp(name, cases[i].name) != 0)
+            continue;
+
+        found = true;
+
+        if (run_case(&cases[i], max_exponent) == false)
+            passed = false;
+    }
+
+    if (found == false)
+    {
+        fprintf(stderr, "Unknown scaling case %s\n", name);
+        exit(EXITCODE_INVOCATION_ERROR);
+    }
+
+    return passed;
+}
+
+/* One identifier, size bytes long */
+static double scale_huge_identifier(size_t size)
+{
+    char *text;
+
+    text = malloc(size);
+
+    GUARD(text)
+
+    memset(text, 'a', size);
+
+    return lex_text(text, size);
+}
+
+/* One line of short identifiers, size bytes long */
+static double scale_long_line(size_t size)
+{
+    char *text;
+
+    text = malloc(size);
+
+    GUARD(text)
+
+    for (size_t i = 0; i != size; ++i)
+        text[i] = i % 3 == 2 ? ' ' : 'a';
+
+    return lex_text(text, size);
+}
+
+/* size bytes lexer doesn't recognize, each one is a TOK_UNKNOWN */
+static double scale_unknown_bytes(size_t size)
+{
+    char *text;
+
+    text = malloc(size);
+
+    GUARD(text)
+
+    memset(text, '#', size);
+
+    return lex_text(text, size);
+}
+
+/*
+  Push size sources on top of each other, then pop all of them
+  All of them share one empty stream, we measure the stack not stdio
+*/
+static double scale_deep_stack(size_t size)
+{
+    static char text[] = "a";
+    struct sources *sources;
+    FILE *fd;
+    double start;
+    double seconds;
+
+    fd = bench_open_memory(text, 0);
+
+    sources = source_create_struct();
+
+    start = bench_now();
+
+    for (size_t i = 0; i != size; ++i)
+        source_push(sources, fd);
+
+    for (size_t i = 0; i != size; ++i)
+        source_pop(sources);
+
+    seconds = bench_now() - start;
+
+    source_destroy_struct(sources);
+    fclose(fd);
+
+    return seconds;
+}
+
+/* Build a string of size characters one character at a time */
+static double scale_lstring_append_char(size_t size)
+{
+    struct lstring *lstring;
+    double start;
+    double seconds;
+
+    lstring = lstring_create();
+
+    start = bench_now();
+
+    for (size_t i = 0; i != size; ++i)
+        lstring_append_char(lstring, 'a');
+
+    seconds = bench_now() - start;
+
+    lstring_destroy(lstring);
+
+    return seconds;
+}
+
+/* Lex text until EOF, takes ownership of text */
+static double lex_text(char *text, size_t length)
+{
+    struct sources *sources;
+    FILE *fd;
+    double start;
+    double seconds;
+
+    fd = bench_open_memory(text, length);
+
+    start = bench_now();
+
+    sources = source_create_struct();
+    source_push(sources, fd);
+
+    while (true)
+    {
+        struct lunit *lunit;
+        bool finish;
+
+        lunit = lunit_get(sources);
+        finish = lunit->token == TOK_EOF;
+        lunit_destroy(lunit);
+
+        if (finish) break;
+    }
+
+    source_pop(sources);
+    source_destroy_struct(sources);
+
+    seconds = bench_now() - start;
+
+    fclose(fd);
+    free(text);
+
+    return seconds;
+}
+
+static bool run_case(struct scale_case *scale, double max_exponent)
+{
+    struct scale_sample samples[SCALE_STEPS];
+    double exponent;
+    size_t size;
+
+    printf("%s\n", scale->name);
+    printf("%14s %12s %14s %14s\n", "size", "seconds", "ns/unit", "peak KB");
+
+    size = scale->base_size;
+
+    for (size_t i = 0; i != SCALE_STEPS; ++i)
+    {
+        sample(scale, size, &samples[i]);
+
+        printf("%14zu %12.4f %14.2f %14ld\n", samples[i].size,
+            samples[i].seconds, samples[i].seconds * 1e9 / samples[i].size,
+            samples[i].peak_rss_kb);
+
+        size *= 2;
+    }
+
+    exponent = fit_exponent(samples, SCALE_STEPS);
+
+    if (exponent > max_exponent)
+    {
+        printf("exponent %.2f SUPER-LINEAR (limit %.2f)\n\n",
+            exponent, max_exponent);
+        return false;
+    }
+
+    printf("exponent %.2f ok\n\n", exponent);
+
+    return true;
+}
+
+static void sample(struct scale_case *scale, size_t size,
+    struct scale_sample *out)
+{
+    struct rusage usage;
+    double seconds;
+    int pipe_fds[2];
+    int status;
+    pid_t pid;
+
+    if (pipe(pipe_fds) == -1)
+    {
+        fprintf(stderr, "pipe failed: %s\n", strerror(errno));
+        exit(EXITCODE_INTERNAL_ERROR);
+    }
+
+    /* Flush so that the child doesn't print our buffered output again */
+    fflush(stdout);
+
+    pid = fork();
+
+    if (pid == -1)
+    {
+        fprintf(stderr, "fork failed: %s\n", strerror(errno));
+        exit(EXITCODE_INTERNAL_ERROR);
+    }
+
+    if (pid == 0)
+    {
+        close(pipe_fds[0]);
+        seconds = scale->run(size);
+
+        if (write(pipe_fds[1], &seconds, sizeof(seconds)) != sizeof(seconds))
+            _exit(EXITCODE_INTERNAL_ERROR);
+
+        _exit(0);
+    }
+
+    close(pipe_fds[1]);
+
+    if (read(pipe_fds[0], &seconds, sizeof(seconds)) != sizeof(seconds))
+        seconds = -1;
+
+    close(pipe_fds[0]);
+
+    if (wait4(pid, &status, 0, &usage) == -1
+        || WIFEXITED(status) == false || WEXITSTATUS(status) != 0
+        || seconds < 0)
+    {
+        fprintf(stderr, "Case %s failed at size %zu\n", scale->name, size);
+        exit(EXITCODE_EXTERNAL_ERROR);
+    }
+
+    out->size = size;
+    out->seconds = seconds;
+    /* On Linux ru_maxrss is in kilobytes */
+    out->peak_rss_kb = usage.ru_maxrss;
+}
+
+/* Least squares slope of log(seconds) against log(size) */
+static double fit_exponent(struct scale_sample *samples, size_t count)
+{
+    double sum_x, sum_y, sum_xx, sum_xy;
+
+    sum_x = sum_y = sum_xx = sum_xy = 0;
+
+    for (size_t i = 0; i != count; ++i)
+    {
+        double x, y;
+
+        x = log((double) samples[i].size);
+        /* Clock resolution, don't take a logarithm of zero */
+        y = log(samples[i].seconds > 1e-9 ? samples[i].seconds : 1e-9);
+
+        sum_x += x;
+        sum_y += y;
+        sum_xx += x * x;
+        sum_xy += x * y;
+    }
+
+    return (count * sum_xy - sum_x * sum_y) / (count * sum_xx - sum_x * sum_x);
+}
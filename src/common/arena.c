@@ -0,0 +1,302 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "memory.h"
+
+#include "arena.h"
+
+/* Size of a huge page on x86-64 and most of aarch64 systems */
+#define ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/*
+  Chunks form a singly linked list, newest one first
+  data is aligned so that every allocation that doesn't ask for
+  a stricter alignment can start right at the beginning of it
+*/
+struct arena_chunk
+{
+    struct arena_chunk *previous;
+    size_t size;
+    size_t used;
+    bool mapped;
+    _Alignas(max_align_t) unsigned char data[];
+};
+
+static struct arena_chunk *chunk_create(struct arena *arena, size_t size);
+static struct arena_chunk *chunk_map_huge(size_t size);
+static void chunk_destroy(struct arena *arena, struct arena_chunk *chunk);
+
+
+struct arena *arena_create(enum mem_subsystem subsystem, size_t chunk_size,
+    unsigned int flags)
+{
+    struct arena *arena;
+
+    arena = mem_alloc(subsystem, sizeof(struct arena));
+
+    /* First chunk is allocated on first use, empty arenas cost nothing */
+    arena->current = NULL;
+    arena->spare = NULL;
+    arena->chunk_size = chunk_size != 0 ? chunk_size : ARENA_DEFAULT_CHUNK_SIZE;
+    arena->flags = flags;
+    arena->subsystem = subsystem;
+
+    return arena;
+}
+
+void arena_destroy(struct arena *arena)
+{
+    struct arena_chunk *chunk;
+
+    chunk = arena->current;
+
+    while (chunk != NULL)
+    {
+        struct arena_chunk *previous;
+
+        previous = chunk->previous;
+        chunk_destroy(arena, chunk);
+        chunk = previous;
+    }
+
+    if (arena->spare != NULL)
+        chunk_destroy(arena, arena->spare);
+
+    mem_free(arena->subsystem, arena);
+}
+
+/* Memory suitably aligned for any type, like malloc */
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    return arena_alloc_aligned(arena, size, _Alignof(max_align_t));
+}
+
+/* alignment must be a power of two */
+void *arena_alloc_aligned(struct arena *arena, size_t size, size_t alignment)
+{
+    struct arena_chunk *chunk;
+    uintptr_t address;
+    size_t padding;
+
+    chunk = arena->current;
+
+    if (chunk != NULL)
+    {
+        /* Distance between first free byte and first aligned free byte */
+        address = (uintptr_t) &chunk->data[chunk->used];
+        padding = (alignment - (address & (alignment - 1))) & (alignment - 1);
+
+        if (chunk->size - chunk->used >= padding
+            && chunk->size - chunk->used - padding >= size)
+        {
+            chunk->used += padding + size;
+            return &chunk->data[chunk->used - size];
+        }
+    }
+
+    /*
+      Current chunk is full, start a new one
+      It must fit the allocation even in the worst case of alignment
+      Space left in the old chunk is wasted, chunks are large
+      compared to typical allocations so that's fine
+    */
+    chunk = chunk_create(arena, size + alignment);
+    chunk->previous = arena->current;
+    arena->current = chunk;
+
+    address = (uintptr_t) chunk->data;
+    padding = (alignment - (address & (alignment - 1))) & (alignment - 1);
+    chunk->used = padding + size;
+
+    return &chunk->data[padding];
+}
+
+/*
+  Resize block returned by arena, contents are preserved
+  If it is the most recent allocation it grows in place,
+  otherwise it is copied and the old block is simply abandoned
+*/
+void *arena_grow(struct arena *arena, void *ptr, size_t old_size,
+    size_t new_size)
+{
+    struct arena_chunk *chunk;
+    void *new_ptr;
+
+    /* Shrinking never needs to move anything */
+    if (new_size <= old_size)
+        return ptr;
+
+    chunk = arena->current;
+
+    if (ptr != NULL && chunk != NULL
+        && (unsigned char *) ptr + old_size == &chunk->data[chunk->used]
+        && chunk->size - chunk->used >= new_size - old_size)
+    {
+        chunk->used += new_size - old_size;
+        return ptr;
+    }
+
+    new_ptr = arena_alloc(arena, new_size);
+
+    if (ptr != NULL)
+        memcpy(new_ptr, ptr, old_size);
+
+    return new_ptr;
+}
+
+/* Copy bytes into arena, byte aligned, used for strings */
+void *arena_copy(struct arena *arena, const void *src, size_t size)
+{
+    void *dest;
+
+    dest = arena_alloc_aligned(arena, size, 1);
+    memcpy(dest, src, size);
+
+    return dest;
+}
+
+struct arena_mark arena_mark(struct arena *arena)
+{
+    struct arena_mark mark;
+
+    mark.chunk = arena->current;
+    mark.used = arena->current != NULL ? arena->current->used : 0;
+
+    return mark;
+}
+
+/*
+  Free everything allocated since mark was taken
+  Cost depends on number of chunks, not on number of allocations
+*/
+void arena_release(struct arena *arena, struct arena_mark mark)
+{
+    while (arena->current != mark.chunk)
+    {
+        struct arena_chunk *chunk;
+
+        chunk = arena->current;
+        arena->current = chunk->previous;
+
+        /* Keep one chunk, next allocation is likely to need it */
+        if (arena->spare == NULL)
+            arena->spare = chunk;
+        else
+            chunk_destroy(arena, chunk);
+    }
+
+    if (arena->current != NULL)
+        arena->current->used = mark.used;
+}
+
+/* Free everything but keep one chunk for reuse */
+void arena_reset(struct arena *arena)
+{
+    struct arena_mark empty;
+
+    empty.chunk = NULL;
+    empty.used = 0;
+
+    arena_release(arena, empty);
+}
+
+static struct arena_chunk *chunk_create(struct arena *arena, size_t size)
+{
+    struct arena_chunk *chunk;
+
+    if (size < arena->chunk_size)
+        size = arena->chunk_size;
+
+    if (arena->spare != NULL && arena->spare->size >= size)
+    {
+        chunk = arena->spare;
+        arena->spare = NULL;
+        chunk->used = 0;
+
+        return chunk;
+    }
+
+    chunk = NULL;
+
+    if (arena->flags & ARENA_HUGE_PAGES)
+        chunk = chunk_map_huge(size);
+
+    if (chunk != NULL)
+    {
+        mem_account_alloc(arena->subsystem,
+            sizeof(struct arena_chunk) + chunk->size);
+    }
+    else
+    {
+        chunk = mem_alloc(arena->subsystem, sizeof(struct arena_chunk) + size);
+
+        chunk->size = size;
+        chunk->mapped = false;
+    }
+
+    chunk->previous = NULL;
+    chunk->used = 0;
+
+    return chunk;
+}
+
+/*
+  Try explicit huge pages first, they need to be reserved by administrator
+  Otherwise ask for transparent huge pages, kernel may or may not comply
+  Returns NULL if even plain mmap fails, caller falls back to malloc
+*/
+static struct arena_chunk *chunk_map_huge(size_t size)
+{
+    struct arena_chunk *chunk;
+    size_t total;
+
+    total = sizeof(struct arena_chunk) + size;
+    /* Round up to a multiple of the huge page size */
+    total = (total + ARENA_HUGE_PAGE_SIZE - 1) & ~(size_t)
+        (ARENA_HUGE_PAGE_SIZE - 1);
+
+    chunk = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    chunk = mmap(NULL, total, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+    if (chunk == MAP_FAILED)
+    {
+        chunk = mmap(NULL, total, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (chunk == MAP_FAILED)
+            return NULL;
+
+#ifdef MADV_HUGEPAGE
+        /* Only a hint, failure doesn't matter */
+        madvise(chunk, total, MADV_HUGEPAGE);
+#endif
+    }
+
+    chunk->size = total - sizeof(struct arena_chunk);
+    chunk->mapped = true;
+
+    return chunk;
+}
+
+static void chunk_destroy(struct arena *arena, struct arena_chunk *chunk)
+{
+    if (chunk->mapped)
+    {
+        mem_account_free(arena->subsystem,
+            sizeof(struct arena_chunk) + chunk->size);
+        munmap(chunk, sizeof(struct arena_chunk) + chunk->size);
+    }
+    else
+    {
+        mem_free(arena->subsystem, chunk);
+    }
+}
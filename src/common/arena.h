@@ -0,0 +1,54 @@
+#ifndef _COMMON_ARENA_H_
+#define _COMMON_ARENA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "memory.h"
+
+/* Default size of a chunk, allocations larger than that get their own */
+#define ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+
+/* Back chunks with huge pages if the system lets us, see arena_create */
+#define ARENA_HUGE_PAGES 1
+
+struct arena_chunk;
+
+/*
+  Arena (region) allocator
+  Memory is handed out by bumping a pointer inside of a chunk
+  Individual allocations are never freed, the whole arena
+  or everything allocated after a mark is released at once
+  Running out of memory is a fatal error, just like with GUARD
+  Chunks are accounted to subsystem, see common/memory.h
+*/
+struct arena
+{
+    struct arena_chunk *current;
+    /* Released chunk kept around so that mark/release loops don't malloc */
+    struct arena_chunk *spare;
+    size_t chunk_size;
+    unsigned int flags;
+    enum mem_subsystem subsystem;
+};
+
+/* Position in an arena, see arena_mark and arena_release */
+struct arena_mark
+{
+    struct arena_chunk *chunk;
+    size_t used;
+};
+
+struct arena *arena_create(enum mem_subsystem subsystem, size_t chunk_size,
+    unsigned int flags);
+void arena_destroy(struct arena *arena);
+void *arena_alloc(struct arena *arena, size_t size);
+void *arena_alloc_aligned(struct arena *arena, size_t size, size_t alignment);
+void *arena_grow(struct arena *arena, void *ptr, size_t old_size,
+    size_t new_size);
+void *arena_copy(struct arena *arena, const void *src, size_t size);
+struct arena_mark arena_mark(struct arena *arena);
+void arena_release(struct arena *arena, struct arena_mark mark);
+void arena_reset(struct arena *arena);
+
+#endif
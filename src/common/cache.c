@@ -0,0 +1,370 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "vector.h"
+
+#include "cache.h"
+
+/* Leftovers of writers that died before renaming are removed after this */
+#define CACHE_STALE_SECONDS 3600
+
+/* Temporary files start with a dot, entries never do */
+#define CACHE_TEMPORARY_PREFIX ".tmp."
+
+/* dir, slash, 2 hex digits, slash, 62 hex digits and terminator */
+#define CACHE_PATH_EXTRA (1 + 2 + 1 + 2 * SHA256_DIGEST_SIZE - 2 + 1)
+
+/* Entry seen while trimming, path is allocated */
+struct cache_file
+{
+    char *path;
+    size_t size;
+    struct timespec mtime;
+};
+
+VECTOR(vector_cache_file, struct cache_file)
+
+static char *entry_path(struct cache *cache, const struct cache_key *key,
+    char *temporary);
+static bool make_directory(const char *path);
+static bool write_all(int fd, const char *data, size_t size);
+static void scan_directory(const char *path, bool top,
+    struct vector_cache_file *files, size_t *total);
+static int compare_mtime(const void *a, const void *b);
+
+
+/*
+  Returns NULL with a warning if dir can't be created,
+  callers treat that as if there was no cache at all
+*/
+struct cache *cache_open(const char *dir, size_t max_bytes)
+{
+    struct cache *cache;
+    size_t length;
+
+    if (make_directory(dir) == false)
+    {
+        fprintf(stderr, "Cache disabled, failed to create '%s': %s\n",
+            dir, strerror(errno));
+        return NULL;
+    }
+
+    length = strlen(dir);
+
+    cache = mem_alloc(MEM_OTHER, sizeof(struct cache));
+    cache->dir = mem_alloc(MEM_OTHER, length + 1);
+    memcpy(cache->dir, dir, length + 1);
+    cache->max_bytes = max_bytes;
+    atomic_init(&cache->stored, false);
+
+    return cache;
+}
+
+/* Entries are trimmed once per run, only if this run added any */
+void cache_close(struct cache *cache)
+{
+    if (atomic_load(&cache->stored))
+        cache_trim(cache);
+
+    mem_free(MEM_OTHER, cache->dir);
+    mem_free(MEM_OTHER, cache);
+}
+
+/*
+  On a hit blob maps the artifact and its use time is updated
+  so that eviction keeps it, release blob with cache_release
+*/
+bool cache_fetch(struct cache *cache, const struct cache_key *key,
+    struct cache_blob *blob)
+{
+    struct stat info;
+    char *path;
+    int fd;
+
+    path = entry_path(cache, key, NULL);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    mem_free(MEM_OTHER, path);
+
+    if (fd == -1)
+        return false;
+
+    if (fstat(fd, &info) == -1)
+    {
+        close(fd);
+        return false;
+    }
+
+    blob->size = info.st_size;
+    blob->map = NULL;
+    blob->data = "";
+
+    /* Zero length mappings aren't allowed, empty artifacts are valid */
+    if (blob->size != 0)
+    {
+        blob->map = mmap(NULL, blob->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (blob->map == MAP_FAILED)
+        {
+            close(fd);
+            return false;
+        }
+
+        blob->data = blob->map;
+    }
+
+    /* Read-only caches are fine, entries just age as if unused */
+    futimens(fd, NULL);
+    close(fd);
+
+    return true;
+}
+
+void cache_release(struct cache_blob *blob)
+{
+    if (blob->map != NULL)
+        munmap(blob->map, blob->size);
+}
+
+/*
+  Entry appears atomically, a reader never sees it half written
+  Two writers of the same key write the same bytes, last rename wins
+*/
+void cache_store(struct cache *cache, const struct cache_key *key,
+    const char *data, size_t size)
+{
+    char *path;
+    char *temporary;
+    char *slash;
+    int fd;
+
+    /* It would only push everything else out and be evicted itself */
+    if (size > cache->max_bytes)
+        return;
+
+    path = entry_path(cache, key, NULL);
+    temporary = entry_path(cache, key, CACHE_TEMPORARY_PREFIX "XXXXXX");
+
+    slash = strrchr(temporary, '/');
+    *slash = '\0';
+    make_directory(temporary);
+    *slash = '/';
+
+    fd = mkstemp(temporary);
+
+    if (fd != -1)
+    {
+        bool written;
+
+        written = fchmod(fd, 0644) == 0 && write_all(fd, data, size);
+        written = close(fd) == 0 && written;
+
+        if (written && rename(temporary, path) == 0)
+            atomic_store(&cache->stored, true);
+        else
+            unlink(temporary);
+    }
+
+    mem_free(MEM_OTHER, temporary);
+    mem_free(MEM_OTHER, path);
+}
+
+/*
+  Evict least recently used entries until the cache takes
+  CACHE_TRIM_PERCENT of max_bytes, trimming below the limit
+  lets a few runs go by before the next one has to evict anything
+  Other processes may trim at the same time, that's harmless
+*/
+void cache_trim(struct cache *cache)
+{
+    struct vector_cache_file files;
+    size_t total;
+    size_t target;
+
+    vector_cache_file_init(&files, MEM_OTHER);
+    total = 0;
+
+    scan_directory(cache->dir, true, &files, &total);
+
+    if (total > cache->max_bytes)
+    {
+        target = cache->max_bytes / 100 * CACHE_TRIM_PERCENT;
+
+        qsort(files.data, files.count, sizeof(struct cache_file),
+            compare_mtime);
+
+        for (size_t i = 0; i != files.count && total > target; ++i)
+        {
+            if (unlink(files.data[i].path) == 0 || errno == ENOENT)
+                total -= files.data[i].size;
+        }
+    }
+
+    for (size_t i = 0; i != files.count; ++i)
+        mem_free(MEM_OTHER, files.data[i].path);
+
+    vector_cache_file_fini(&files);
+}
+
+/*
+  dir/xx/yyyy... for the entry of key or dir/xx/temporary
+  for a temporary file next to it, same directory makes rename atomic
+*/
+static char *entry_path(struct cache *cache, const struct cache_key *key,
+    char *temporary)
+{
+    static const char hex[] = "0123456789abcdef";
+    char name[2 * SHA256_DIGEST_SIZE + 1];
+    char *path;
+    size_t size;
+
+    for (size_t i = 0; i != SHA256_DIGEST_SIZE; ++i)
+    {
+        name[2 * i] = hex[key->digest[i] >> 4];
+        name[2 * i + 1] = hex[key->digest[i] & 0xf];
+    }
+
+    name[2 * SHA256_DIGEST_SIZE] = '\0';
+
+    size = strlen(cache->dir) + CACHE_PATH_EXTRA;
+
+    if (temporary != NULL)
+        size += strlen(temporary);
+
+    path = mem_alloc(MEM_OTHER, size);
+
+    snprintf(path, size, "%s/%.2s/%s", cache->dir, name,
+        temporary != NULL ? temporary : &name[2]);
+
+    return path;
+}
+
+static bool make_directory(const char *path)
+{
+    return mkdir(path, 0777) == 0 || errno == EEXIST;
+}
+
+/* Disks fill up, a short write is a failure */
+static bool write_all(int fd, const char *data, size_t size)
+{
+    while (size != 0)
+    {
+        ssize_t written;
+
+        written = write(fd, data, size);
+
+        if (written == -1 && errno == EINTR)
+            continue;
+
+        if (written <= 0)
+            return false;
+
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+/*
+  Collect entries of every dir/xx, top is true for dir itself
+  Stale temporary files are removed right away, fresh ones belong
+  to somebody who is writing them
+*/
+static void scan_directory(const char *path, bool top,
+    struct vector_cache_file *files, size_t *total)
+{
+    DIR *dir;
+    struct dirent *item;
+    struct timespec now;
+    size_t length;
+
+    dir = opendir(path);
+
+    if (dir == NULL)
+        return;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    length = strlen(path);
+
+    while ((item = readdir(dir)) != NULL)
+    {
+        struct cache_file file;
+        struct stat info;
+        size_t size;
+
+        if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0)
+            continue;
+
+        size = length + 1 + strlen(item->d_name) + 1;
+        file.path = mem_alloc(MEM_OTHER, size);
+        snprintf(file.path, size, "%s/%s", path, item->d_name);
+
+        if (lstat(file.path, &info) == -1)
+        {
+            mem_free(MEM_OTHER, file.path);
+            continue;
+        }
+
+        /* Only dir itself has subdirectories, only they have entries */
+        if (top && S_ISDIR(info.st_mode) && strlen(item->d_name) == 2)
+        {
+            scan_directory(file.path, false, files, total);
+            mem_free(MEM_OTHER, file.path);
+            continue;
+        }
+
+        if (top || S_ISREG(info.st_mode) == false)
+        {
+            mem_free(MEM_OTHER, file.path);
+            continue;
+        }
+
+        if (strncmp(item->d_name, CACHE_TEMPORARY_PREFIX,
+            strlen(CACHE_TEMPORARY_PREFIX)) == 0)
+        {
+            if (now.tv_sec - info.st_mtim.tv_sec > CACHE_STALE_SECONDS)
+                unlink(file.path);
+
+            mem_free(MEM_OTHER, file.path);
+            continue;
+        }
+
+        file.size = info.st_size;
+        file.mtime = info.st_mtim;
+        *total += file.size;
+
+        vector_cache_file_push(files, file);
+    }
+
+    closedir(dir);
+}
+
+/* Oldest first */
+static int compare_mtime(const void *a, const void *b)
+{
+    const struct cache_file *left;
+    const struct cache_file *right;
+
+    left = a;
+    right = b;
+
+    if (left->mtime.tv_sec != right->mtime.tv_sec)
+        return left->mtime.tv_sec < right->mtime.tv_sec ? -1 : 1;
+
+    if (left->mtime.tv_nsec != right->mtime.tv_nsec)
+        return left->mtime.tv_nsec < right->mtime.tv_nsec ? -1 : 1;
+
+    return 0;
+}
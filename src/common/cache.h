@@ -0,0 +1,60 @@
+#ifndef _COMMON_CACHE_H_
+#define _COMMON_CACHE_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sha256.h"
+
+/* Used when the command line doesn't say, see cache_open */
+#define CACHE_DIR_ENV "MKC_CACHE_DIR"
+#define CACHE_SIZE_ENV "MKC_CACHE_SIZE"
+
+/* Size limit in megabytes */
+#define CACHE_DEFAULT_SIZE 1024
+
+/* Eviction stops once the cache is this many percent of the limit */
+#define CACHE_TRIM_PERCENT 90
+
+/* Digest of everything an artifact depends on */
+struct cache_key
+{
+    unsigned char digest[SHA256_DIGEST_SIZE];
+};
+
+/*
+  Content addressed on-disk cache of artifacts
+  An artifact lives in dir/xx/yyyy... named by the hex digest of its key
+  Entries are written to a temporary file and renamed into place, so
+  readers see either nothing or a complete artifact; modification time
+  is the last use, the oldest entries are evicted when the size goes
+  over max_bytes
+  Nothing here is fatal, failures to read or write make cache misses
+  Safe to use from many threads and processes at once
+*/
+struct cache
+{
+    char *dir;
+    size_t max_bytes;
+    atomic_bool stored;
+};
+
+/* Artifact of a hit, data is mapped until cache_release */
+struct cache_blob
+{
+    const char *data;
+    size_t size;
+    void *map;
+};
+
+struct cache *cache_open(const char *dir, size_t max_bytes);
+void cache_close(struct cache *cache);
+bool cache_fetch(struct cache *cache, const struct cache_key *key,
+    struct cache_blob *blob);
+void cache_release(struct cache_blob *blob);
+void cache_store(struct cache *cache, const struct cache_key *key,
+    const char *data, size_t size);
+void cache_trim(struct cache *cache);
+
+#endif
@@ -6,13 +6,14 @@
 #include <string.h>
 
 #include "exitcodes.h"
+#include "fatal.h"
 #include "messages.h"
 
 #define CHECK_IO_ERROR(condition)                                    \
     if (condition)                                                   \
     {                                                                \
-        fprintf(stderr, MESSAGE_IO_ERROR ": %s\n", strerror(errno)); \
-        exit(EXITCODE_INTERNAL_ERROR);                               \
+        fatal(EXITCODE_INTERNAL_ERROR, MESSAGE_IO_ERROR ": %s",      \
+            strerror(errno));                                        \
     }
 
 #endif
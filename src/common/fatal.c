@@ -0,0 +1,68 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fatal.h"
+
+/* Innermost frame of the calling thread, NULL means exit */
+static _Thread_local struct fatal_frame *top;
+
+/* Called after the message is printed, right before exit */
+static void (*exit_hook)(int exitcode);
+
+
+_Noreturn void fatal(int exitcode, const char *format, ...)
+{
+    struct fatal_frame *frame;
+    char message[FATAL_MESSAGE_SIZE];
+    va_list arguments;
+
+    /* No allocation here, we may be out of memory */
+    va_start(arguments, format);
+    vsnprintf(message, sizeof(message), format, arguments);
+    va_end(arguments);
+
+    frame = top;
+
+    if (frame == NULL)
+    {
+        fprintf(stderr, "%s\n", message);
+
+        if (exit_hook != NULL)
+            exit_hook(exitcode);
+
+        exit(exitcode);
+    }
+
+    top = frame->previous;
+
+    frame->exitcode = exitcode;
+    snprintf(frame->message, sizeof(frame->message), "%s", message);
+
+    longjmp(frame->env, 1);
+}
+
+void fatal_push(struct fatal_frame *frame)
+{
+    frame->previous = top;
+    frame->exitcode = 0;
+    frame->message[0] = '\0';
+    top = frame;
+}
+
+/* Frame must be the innermost one */
+void fatal_pop(struct fatal_frame *frame)
+{
+    top = frame->previous;
+}
+
+/*
+  Process wide, set it before starting threads
+  Lets a process that exits on behalf of someone else tell them why,
+  see mkc serve
+*/
+void fatal_set_exit_hook(void (*hook)(int exitcode))
+{
+    exit_hook = hook;
+}
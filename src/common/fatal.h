@@ -0,0 +1,48 @@
+#ifndef _COMMON_FATAL_H_
+#define _COMMON_FATAL_H_
+
+#include <setjmp.h>
+
+/* Longer messages are truncated */
+#define FATAL_MESSAGE_SIZE 256
+
+/*
+  Where fatal jumps to instead of exiting, see fatal_push
+  exitcode and message describe the error once setjmp returns again
+*/
+struct fatal_frame
+{
+    jmp_buf env;
+    struct fatal_frame *previous;
+    int exitcode;
+    char message[FATAL_MESSAGE_SIZE];
+};
+
+/*
+  Errors the program can't recover from: no memory, I/O errors,
+  inputs too large and broken invariants
+  By default fatal prints the message and exits with exitcode
+  Library entry points push a frame so that fatal unwinds back to them
+  with longjmp and they can return a status instead:
+
+    struct fatal_frame frame;
+
+    fatal_push(&frame);
+
+    if (setjmp(frame.env) != 0)
+        return FAILURE; (frame is popped already, see frame.message)
+
+    ...work that may call fatal...
+
+    fatal_pop(&frame);
+
+  Frames are per thread, memory allocated between push and the jump
+  isn't freed by the jump
+*/
+_Noreturn void fatal(int exitcode, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+void fatal_push(struct fatal_frame *frame);
+void fatal_pop(struct fatal_frame *frame);
+void fatal_set_exit_hook(void (*hook)(int exitcode));
+
+#endif
@@ -4,13 +4,13 @@
 #include <stddef.h>
 
 #include "exitcodes.h"
+#include "fatal.h"
 #include "messages.h"
 
-#define GUARD(ptr)                             \
-    if (ptr == NULL)                           \
-    {                                          \
-        fputs(MESSAGE_MEMORY_ERROR, stderr);   \
-        exit(EXITCODE_INTERNAL_ERROR);         \
+#define GUARD(ptr)                                          \
+    if (ptr == NULL)                                        \
+    {                                                       \
+        fatal(EXITCODE_INTERNAL_ERROR, MESSAGE_MEMORY_ERROR); \
     }
 
 #endif
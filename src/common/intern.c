@@ -0,0 +1,151 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "exitcodes.h"
+#include "fatal.h"
+#include "memory.h"
+
+#include "intern.h"
+
+/* Number of slots of an empty table, must be a power of two */
+#define INTERN_INITIAL_SLOTS 1024
+
+static void rehash(struct intern *intern, size_t slot_count);
+
+
+struct intern *intern_create(enum mem_subsystem subsystem)
+{
+    struct intern *intern;
+
+    intern = mem_alloc(subsystem, sizeof(struct intern));
+
+    vector_intern_entry_init(&intern->entries, subsystem);
+    vector_byte_init(&intern->pool, subsystem);
+    intern->subsystem = subsystem;
+    intern->slots = NULL;
+    intern->slot_count = 0;
+
+    rehash(intern, INTERN_INITIAL_SLOTS);
+
+    return intern;
+}
+
+void intern_destroy(struct intern *intern)
+{
+    vector_intern_entry_fini(&intern->entries);
+    vector_byte_fini(&intern->pool);
+    mem_free(intern->subsystem, intern->slots);
+    mem_free(intern->subsystem, intern);
+}
+
+/* Forget all strings but keep memory for reuse */
+void intern_clear(struct intern *intern)
+{
+    intern->entries.count = 0;
+    intern->pool.count = 0;
+    memset(intern->slots, 0, intern->slot_count * sizeof(uint32_t));
+}
+
+/* Returns id of the string, equal strings always get the same id */
+size_t intern_add(struct intern *intern, const char *text, size_t length)
+{
+    struct intern_entry entry;
+    uint64_t hash;
+    size_t mask;
+    size_t slot;
+
+    hash = intern_hash(text, length);
+    mask = intern->slot_count - 1;
+    slot = hash & mask;
+
+    /* Linear probing, table is never more than half full */
+    while (intern->slots[slot] != 0)
+    {
+        struct intern_entry *candidate;
+
+        candidate = &intern->entries.data[intern->slots[slot] - 1];
+
+        if (candidate->hash == hash && candidate->length == length
+            && memcmp(&intern->pool.data[candidate->offset], text, length)
+            == 0)
+            return intern->slots[slot] - 1;
+
+        slot = (slot + 1) & mask;
+    }
+
+    if (intern->entries.count == UINT32_MAX - 1)
+    {
+        fatal(EXITCODE_INTERNAL_ERROR, "Too many distinct strings");
+    }
+
+    entry.hash = hash;
+    entry.offset = intern->pool.count;
+    entry.length = length;
+
+    vector_byte_push_many(&intern->pool, text, length);
+    vector_intern_entry_push(&intern->entries, entry);
+    intern->slots[slot] = intern->entries.count;
+
+    if (intern->entries.count * 2 > intern->slot_count)
+        rehash(intern, intern->slot_count * 2);
+
+    return intern->entries.count - 1;
+}
+
+/* Text isn't null terminated, it stays valid until next intern_add */
+const char *intern_text(struct intern *intern, size_t id, size_t *length)
+{
+    struct intern_entry *entry;
+
+    entry = &intern->entries.data[id];
+    *length = entry->length;
+
+    return &intern->pool.data[entry->offset];
+}
+
+/* FNV-1a, simple and good enough for identifiers */
+uint64_t intern_hash(const char *text, size_t length)
+{
+    uint64_t hash;
+
+    hash = UINT64_C(0xcbf29ce484222325);
+
+    for (size_t i = 0; i != length; ++i)
+    {
+        hash ^= (unsigned char) text[i];
+        hash *= UINT64_C(0x100000001b3);
+    }
+
+    return hash;
+}
+
+static void rehash(struct intern *intern, size_t slot_count)
+{
+    size_t mask;
+
+    mem_free(intern->subsystem, intern->slots);
+
+    intern->slots = mem_alloc(intern->subsystem,
+        slot_count * sizeof(uint32_t));
+    memset(intern->slots, 0, slot_count * sizeof(uint32_t));
+    intern->slot_count = slot_count;
+
+    mask = slot_count - 1;
+
+    /* Hashes are stored, strings don't have to be rehashed */
+    for (size_t id = 0; id != intern->entries.count; ++id)
+    {
+        size_t slot;
+
+        slot = intern->entries.data[id].hash & mask;
+
+        while (intern->slots[slot] != 0)
+            slot = (slot + 1) & mask;
+
+        intern->slots[slot] = id + 1;
+    }
+}
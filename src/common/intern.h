@@ -0,0 +1,43 @@
+#ifndef _COMMON_INTERN_H_
+#define _COMMON_INTERN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory.h"
+#include "vector.h"
+
+struct intern_entry
+{
+    uint64_t hash;
+    size_t offset;
+    size_t length;
+};
+
+VECTOR(vector_intern_entry, struct intern_entry)
+VECTOR(vector_byte, char)
+
+/*
+  Intern (string deduplication) table
+  Every distinct string is stored once in a contiguous pool and gets an id
+  Ids are dense: 0, 1, 2... in order of first appearance
+  so callers can keep per-string data in arrays indexed by id
+  slots is an open addressing hash table of id + 1, 0 means empty
+*/
+struct intern
+{
+    struct vector_intern_entry entries;
+    struct vector_byte pool;
+    uint32_t *slots;
+    size_t slot_count;
+    enum mem_subsystem subsystem;
+};
+
+struct intern *intern_create(enum mem_subsystem subsystem);
+void intern_destroy(struct intern *intern);
+void intern_clear(struct intern *intern);
+size_t intern_add(struct intern *intern, const char *text, size_t length);
+const char *intern_text(struct intern *intern, size_t id, size_t *length);
+uint64_t intern_hash(const char *text, size_t length);
+
+#endif
@@ -0,0 +1,279 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "vector.h"
+
+#include "jobserver.h"
+
+VECTOR(vector_token, char)
+
+/*
+  read_fd is a file description of our own in non-blocking mode so that
+  trying to get a token never blocks and never changes the mode of
+  the descriptor make and other jobs share
+  A fifo is opened once for both reading and writing, write_fd is read_fd
+  tokens are bytes we hold, make may tell something by their values
+  so exactly the same bytes are written back
+*/
+struct jobserver
+{
+    bool active;
+    int read_fd;
+    int write_fd;
+    pthread_mutex_t lock;
+    struct vector_token tokens;
+    bool release_at_exit;
+};
+
+static bool parse_makeflags(const char *flags, char *fifo, size_t fifo_size,
+    int *read_fd, int *write_fd);
+static int reopen_nonblocking(int fd, int flags);
+static void release_all(void);
+
+static struct jobserver jobserver =
+{
+    .read_fd = -1,
+    .write_fd = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .tokens = { .subsystem = MEM_OTHER }
+};
+
+
+/*
+  Join the jobserver described by MAKEFLAGS, if any
+  --jobserver-auth=fifo:PATH (make 4.4), --jobserver-auth=R,W
+  and --jobserver-fds=R,W (older makes) are understood
+  Descriptors make didn't pass to us (recipe without +) are ignored
+  Call before starting threads
+*/
+void jobserver_init(void)
+{
+    char fifo[4096];
+    const char *flags;
+    int read_fd;
+    int write_fd;
+
+    flags = getenv("MAKEFLAGS");
+
+    if (flags == NULL
+        || parse_makeflags(flags, fifo, sizeof(fifo), &read_fd, &write_fd)
+            == false)
+        return;
+
+    if (fifo[0] != '\0')
+    {
+        read_fd = open(fifo, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        write_fd = read_fd;
+    }
+    else if (fcntl(read_fd, F_GETFD) == -1 || fcntl(write_fd, F_GETFD) == -1)
+    {
+        return;
+    }
+    else
+    {
+        read_fd = reopen_nonblocking(read_fd, O_RDONLY);
+        write_fd = fcntl(write_fd, F_DUPFD_CLOEXEC, 0);
+    }
+
+    if (read_fd == -1 || write_fd == -1)
+    {
+        fputs("Failed to join make jobserver, running serially\n", stderr);
+
+        /* Only the token we were started with, no others */
+        jobserver_attach(-1, -1);
+        return;
+    }
+
+    jobserver_attach(read_fd, write_fd);
+}
+
+bool jobserver_active(void)
+{
+    return jobserver.active;
+}
+
+/* Our descriptors, for handing the jobserver to someone else */
+bool jobserver_descriptors(int *read_fd, int *write_fd)
+{
+    if (jobserver.active == false || jobserver.read_fd == -1)
+        return false;
+
+    *read_fd = jobserver.read_fd;
+    *write_fd = jobserver.write_fd;
+
+    return true;
+}
+
+/*
+  Use descriptors received from someone else, we own them now
+  -1 means an active jobserver without spare tokens, we run serially
+*/
+void jobserver_attach(int read_fd, int write_fd)
+{
+    jobserver.active = true;
+    jobserver.read_fd = read_fd;
+    jobserver.write_fd = write_fd;
+
+    if (jobserver.release_at_exit == false)
+    {
+        jobserver.release_at_exit = true;
+        atexit(release_all);
+    }
+}
+
+/* Give back all tokens and close descriptors, no threads may use them */
+void jobserver_detach(void)
+{
+    release_all();
+
+    if (jobserver.read_fd != -1)
+        close(jobserver.read_fd);
+
+    if (jobserver.write_fd != -1 && jobserver.write_fd != jobserver.read_fd)
+        close(jobserver.write_fd);
+
+    jobserver.active = false;
+    jobserver.read_fd = -1;
+    jobserver.write_fd = -1;
+}
+
+/*
+  Get a token for one more job if one is free right now, never blocks
+  Pair every success with jobserver_release
+*/
+bool jobserver_try_acquire(void)
+{
+    ssize_t result;
+    char token;
+
+    if (jobserver.active == false)
+        return true;
+
+    if (jobserver.read_fd == -1)
+        return false;
+
+    do
+        result = read(jobserver.read_fd, &token, 1);
+    while (result == -1 && errno == EINTR);
+
+    /* EAGAIN, all tokens are taken; EOF, make is gone */
+    if (result != 1)
+        return false;
+
+    pthread_mutex_lock(&jobserver.lock);
+    vector_token_push(&jobserver.tokens, token);
+    pthread_mutex_unlock(&jobserver.lock);
+
+    return true;
+}
+
+/* Give back a token as soon as its job is done, others may be waiting */
+void jobserver_release(void)
+{
+    char token;
+    ssize_t result;
+
+    if (jobserver.active == false)
+        return;
+
+    pthread_mutex_lock(&jobserver.lock);
+
+    if (jobserver.tokens.count == 0)
+    {
+        pthread_mutex_unlock(&jobserver.lock);
+        return;
+    }
+
+    jobserver.tokens.count -= 1;
+    token = jobserver.tokens.data[jobserver.tokens.count];
+
+    pthread_mutex_unlock(&jobserver.lock);
+
+    do
+        result = write(jobserver.write_fd, &token, 1);
+    while (result == -1 && errno == EINTR);
+}
+
+/*
+  Last jobserver option of MAKEFLAGS, fifo is empty for descriptors
+  Options are words starting with --, anything else is ignored
+*/
+static bool parse_makeflags(const char *flags, char *fifo, size_t fifo_size,
+    int *read_fd, int *write_fd)
+{
+    static const char *options[] = { "--jobserver-auth=", "--jobserver-fds=" };
+    bool found;
+
+    found = false;
+
+    while (*flags != '\0')
+    {
+        size_t length;
+
+        length = strcspn(flags, " ");
+
+        for (size_t i = 0; i != sizeof(options) / sizeof(options[0]); ++i)
+        {
+            size_t prefix;
+            const char *value;
+
+            prefix = strlen(options[i]);
+
+            if (length <= prefix || strncmp(flags, options[i], prefix) != 0)
+                continue;
+
+            value = &flags[prefix];
+
+            if (strncmp(value, "fifo:", 5) == 0)
+            {
+                if (length - prefix - 5 >= fifo_size)
+                    continue;
+
+                memcpy(fifo, &value[5], length - prefix - 5);
+                fifo[length - prefix - 5] = '\0';
+                found = true;
+            }
+            else if (sscanf(value, "%d,%d", read_fd, write_fd) == 2
+                && *read_fd >= 0 && *write_fd >= 0)
+            {
+                fifo[0] = '\0';
+                found = true;
+            }
+        }
+
+        flags += length;
+
+        while (*flags == ' ')
+            flags += 1;
+    }
+
+    return found;
+}
+
+/*
+  New file description of the pipe behind fd, so that non-blocking mode
+  stays ours, through /proc because a dup would share the description
+*/
+static int reopen_nonblocking(int fd, int flags)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+
+    return open(path, flags | O_NONBLOCK | O_CLOEXEC);
+}
+
+/* Tokens of jobs that didn't finish, at exit or on detach */
+static void release_all(void)
+{
+    while (jobserver.active && jobserver.tokens.count != 0)
+        jobserver_release();
+}
@@ -0,0 +1,24 @@
+#ifndef _COMMON_JOBSERVER_H_
+#define _COMMON_JOBSERVER_H_
+
+#include <stdbool.h>
+
+/*
+  Client side of the GNU make jobserver
+  make hands out one token per job it may run, a process started by
+  make owns one implicitly and reads a byte from the jobserver for
+  every additional thread or child process it runs, then writes
+  the byte back when that job is done
+  Without a jobserver acquiring always succeeds, parallelism is then
+  limited by -j of the subcommand only
+  Tokens still held at exit are given back
+*/
+void jobserver_init(void);
+bool jobserver_active(void);
+bool jobserver_descriptors(int *read_fd, int *write_fd);
+void jobserver_attach(int read_fd, int write_fd);
+void jobserver_detach(void);
+bool jobserver_try_acquire(void);
+void jobserver_release(void);
+
+#endif
@@ -3,10 +3,10 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <convert/to_lstring.h>
+#include <convert/digits.h>
 
 #include "check_io.h"
-#include "guard.h"
+#include "memory.h"
 
 #include "lstring.h"
 
@@ -15,182 +15,178 @@ struct lstring *lstring_create(void)
 {
     struct lstring *lstring;
 
-    lstring = malloc(sizeof(struct lstring));
-
     /*
       While failure to append text to a lstring isn't a critical failure
       but failure to allocate memory is a fatal error
+      mem_alloc doesn't return if it fails
     */
-    GUARD(lstring)
+    lstring = mem_alloc(MEM_LSTRING, sizeof(struct lstring));
 
-    lstring->length = 0;
-    /* We must set it to NULL because we pass it to realloc */
-    lstring->text = NULL;
+    lstring_init(lstring);
 
     return lstring;
 }
 
 void lstring_destroy(struct lstring *lstring)
 {
-    /*
-      It is unusual to create lstring and then
-      just free it without appending anything
-      but it's better to be safe than sorry
-    */
-    if (lstring->text != NULL)
-        free(lstring->text);
-    free(lstring);
+    lstring_fini(lstring);
+    mem_free(MEM_LSTRING, lstring);
+}
+
+/* Initialize lstring that is a part of some other structure */
+void lstring_init(struct lstring *lstring)
+{
+    lstring->length = 0;
+    /* Start with inline storage, heap is used only for long strings */
+    lstring->text = lstring->inline_text;
+    lstring->capacity = LSTRING_INLINE_CAPACITY;
 }
 
-void lstring_append_char(struct lstring *lstring, char c)
+/* Counterpart of lstring_init, it doesn't free lstring itself */
+void lstring_fini(struct lstring *lstring)
+{
+    if (lstring->text != lstring->inline_text)
+        mem_free(MEM_LSTRING, lstring->text);
+}
+
+/* Make sure lstring can hold capacity bytes without reallocation */
+void lstring_reserve(struct lstring *lstring, size_t capacity)
 {
-    size_t new_size;
     char *new_text;
 
-    /*
-      We need to extend lstring->text by one byte
-      realloc when supplied with NULL as first
-      argument works just like malloc
-    */
-    new_size = lstring->length + 1;
-    new_text = realloc(lstring->text, new_size);
+    if (capacity <= lstring->capacity)
+        return;
 
-    GUARD(new_text)
+    if (lstring->text == lstring->inline_text)
+    {
+        /* Move out of inline storage */
+        new_text = mem_alloc(MEM_LSTRING, capacity);
+        memcpy(new_text, lstring->inline_text, lstring->length);
+    }
+    else
+    {
+        new_text = mem_realloc(MEM_LSTRING, lstring->text, capacity);
+    }
 
     lstring->text = new_text;
-    /*
-      Append string to lstring->text, space is allocated already
-      If we use length of an array as its subscript it's going to
-      point one byte after its end
-      This is where we want to insert this char
-    */
-    lstring->text[lstring->length] = c;
-    lstring->length += 1;
+    lstring->capacity = capacity;
 }
 
-void lstring_append_string(struct lstring *lstring, char *string)
+/*
+  Make lstring empty but keep its buffer
+  Appending to it afterwards won't allocate until old capacity is exceeded
+*/
+void lstring_clear(struct lstring *lstring)
 {
-    size_t string_length;
-    size_t new_size;
-    char *new_text;
+    lstring->length = 0;
+}
 
-    string_length = strlen(string);
+/*
+  Make space for additional bytes
+  Capacity is at least doubled so that n appends cost O(n) in total
+  instead of one reallocation per append
+*/
+void lstring_grow(struct lstring *lstring, size_t additional)
+{
+    size_t needed;
+    size_t capacity;
 
-    /*
-      Reallocate buffer to accomodate new string
-      When you invoke realloc with NULL as first
-      argument it works like malloc
-    */
-    new_size = lstring->length + string_length;
-    new_text = realloc(lstring->text, new_size);
+    needed = lstring->length + additional;
 
-    GUARD(new_text)
+    if (needed <= lstring->capacity)
+        return;
 
-    lstring->text = new_text;
+    capacity = lstring->capacity * 2;
+
+    if (capacity < needed)
+        capacity = needed;
+
+    lstring_reserve(lstring, capacity);
+}
+
+void lstring_append_buffer(struct lstring *lstring, const char *buffer,
+    size_t length)
+{
+    lstring_grow(lstring, length);
 
     /*
-      Append string to lstring->text, space is allocated already
+      Append buffer to lstring->text, space is allocated already
       If we use length of an array as its subscript it's going to
       point one byte after its end
-      This is where we want to append this string
-      & operator makes a pointer out of this position
-      We use strncpy because log->text isn't null terminated
+      This is where we want to append this buffer
+      We use memcpy because lstring->text isn't null terminated
     */
-    strncpy(&lstring->text[lstring->length], string, string_length);
-    lstring->length += string_length;
+    memcpy(&lstring->text[lstring->length], buffer, length);
+    lstring->length += length;
 }
 
-void lstring_append_lstring(struct lstring *dest, struct lstring *src)
+void lstring_append_string(struct lstring *lstring, char *string)
 {
-    size_t new_size;
-    char *new_text;
+    lstring_append_buffer(lstring, string, strlen(string));
+}
 
-    /*
-      Reallocate buffer to accomodate new string
-      When you invoke realloc with NULL as first
-      argument it works like malloc
-    */
-    new_size = dest->length + src->length;
-    new_text = realloc(dest->text, new_size);
+void lstring_append_lstring(struct lstring *dest, struct lstring *src)
+{
+    lstring_append_buffer(dest, src->text, src->length);
+}
 
-    GUARD(new_text)
+/* Digits are written directly into lstring->text, no temporary strings */
+void lstring_append_size(struct lstring *lstring, size_t size)
+{
+    size_t digits;
 
-    dest->text = new_text;
+    digits = size_digits(size);
+    lstring_grow(lstring, digits);
 
-    /*
-      Append string to dest->text, space is allocated already
-      If we use length of an array as its subscript it's going to
-      point one byte after its end
-      This is where we want to append this string
-      & operator makes a pointer out of this position
-      We use strncpy because dest->text isn't null terminated
-    */
-    strncpy(&dest->text[dest->length], src->text, src->length);
-    dest->length += src->length;
+    size_write_decimal(&lstring->text[lstring->length], size, digits);
+    lstring->length += digits;
 }
 
-void lstring_append_size(struct lstring *lstring, size_t size)
+/* Lowercase, without 0x prefix */
+void lstring_append_hex(struct lstring *lstring, size_t size)
 {
-    struct lstring *size_as_lstr;
-
-    size_as_lstr = size_to_lstring(size);
+    size_t digits;
 
-    lstring_append_lstring(lstring, size_as_lstr);
+    digits = size_hex_digits(size);
+    lstring_grow(lstring, digits);
 
-    lstring_destroy(size_as_lstr);
+    size_write_hex(&lstring->text[lstring->length], size, digits);
+    lstring->length += digits;
 }
 
+/* Reverse in place, swap characters from both ends moving inwards */
 void lstring_reverse(struct lstring *lstring)
 {
-    char *old_text;
-    char *reversed_text;
     size_t from, to;
 
-    old_text = lstring->text;
+    /* Nothing to do and length - 1 would underflow */
+    if (lstring->length == 0)
+        return;
 
-    reversed_text = malloc(lstring->length);
+    from = 0;
+    to = lstring->length - 1;
 
-    GUARD(reversed_text)
-
-    /*
-      Length of a given array used as its subscript points
-      one element after the last element of an array. Bad
-      We want to start at the last element
-    */
-    from = lstring->length - 1;
-
-    /* We want to start inserting chars at the very beginning */
-    to = 0;
-
-
-    while (true)
+    while (from < to)
     {
-        reversed_text[to] = old_text[from];
-
-        /*
-          This is the end condition, we just moved first char
-          Next one would be -1, there is no such thing
-        */
-        if (from == 0)
-            break;
-
-        /*
-          Move to next char in old_text
-          and to its destination in reversed_text
-        */
-        from -= 1;
-        to += 1;
-    }
+        char c;
 
-    free(old_text);
+        c = lstring->text[from];
+        lstring->text[from] = lstring->text[to];
+        lstring->text[to] = c;
 
-    lstring->text = reversed_text;
+        from += 1;
+        to -= 1;
+    }
 }
 
 void lstring_print(struct lstring *lstring, FILE *fd)
 {
     size_t elements_written;
 
+    /* fwrite with zero sized element returns 0, it isn't an error */
+    if (lstring->length == 0)
+        return;
+
     /* Write contents of the log all at once, not byte by byte */
 
     elements_written = fwrite(lstring->text, lstring->length, 1, fd);
@@ -1,21 +1,56 @@
 #ifndef _COMMON_LOGGER_H_
 #define _COMMON_LOGGER_H_
 
+#include <stddef.h>
 #include <stdio.h>
 
+/*
+  Strings up to this length are stored inside the structure itself
+  Most lexmes are short, this way they don't need a heap allocation
+*/
+#define LSTRING_INLINE_CAPACITY 24
+
+/*
+  text points either to inline_text or to a heap buffer
+  Because of that an initialized lstring mustn't be copied nor moved,
+  pass pointers around instead
+  capacity is number of bytes text can hold without reallocation
+*/
 struct lstring
 {
     char *text; /* not null terminated */
     size_t length;
+    size_t capacity;
+    char inline_text[LSTRING_INLINE_CAPACITY];
 };
 
 struct lstring *lstring_create(void);
 void lstring_destroy(struct lstring *lstring);
-void lstring_append_char(struct lstring *lstring, char c);
+void lstring_init(struct lstring *lstring);
+void lstring_fini(struct lstring *lstring);
+void lstring_reserve(struct lstring *lstring, size_t capacity);
+void lstring_clear(struct lstring *lstring);
+void lstring_grow(struct lstring *lstring, size_t additional);
+void lstring_append_buffer(struct lstring *lstring, const char *buffer,
+    size_t length);
 void lstring_append_string(struct lstring *lstring, char *str);
 void lstring_append_lstring(struct lstring *dest, struct lstring *src);
 void lstring_append_size(struct lstring *lstring, size_t size);
+void lstring_append_hex(struct lstring *lstring, size_t size);
 void lstring_reverse(struct lstring *lstring);
 void lstring_print(struct lstring *lstring, FILE *fd);
 
+/*
+  Lexer appends characters one by one, keep the common case
+  (there is space already) inlined into the caller
+*/
+static inline void lstring_append_char(struct lstring *lstring, char c)
+{
+    if (lstring->length == lstring->capacity)
+        lstring_grow(lstring, 1);
+
+    lstring->text[lstring->length] = c;
+    lstring->length += 1;
+}
+
 #endif
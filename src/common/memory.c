@@ -0,0 +1,173 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "guard.h"
+
+#include "memory.h"
+
+/*
+  Every block starts with a header that remembers its size
+  so that mem_free knows how many bytes become free
+  Union keeps memory after the header aligned like malloc's
+*/
+union mem_header
+{
+    size_t size;
+    max_align_t align;
+};
+
+struct mem_counters
+{
+    atomic_size_t calls;
+    atomic_size_t bytes;
+    atomic_size_t live;
+    atomic_size_t peak;
+};
+
+static void count_alloc(struct mem_counters *counters, size_t size);
+static void count_free(struct mem_counters *counters, size_t size);
+static void print_row(FILE *fd, const char *name,
+    struct mem_counters *counters);
+
+static struct mem_counters subsystems[MEM_SUBSYSTEM_COUNT];
+/* Peak of the sum isn't a sum of peaks, track total separately */
+static struct mem_counters total;
+static atomic_size_t tokens;
+
+static const char *subsystem_names[MEM_SUBSYSTEM_COUNT] =
+{
+    [MEM_SOURCE] = "source",
+    [MEM_LEXER] = "lexer",
+    [MEM_LSTRING] = "lstring",
+    [MEM_ARGUMENTS] = "arguments",
+    [MEM_OUTPUT] = "output",
+    [MEM_AST] = "ast",
+    [MEM_OTHER] = "other"
+};
+
+
+void *mem_alloc(enum mem_subsystem subsystem, size_t size)
+{
+    union mem_header *header;
+
+    header = malloc(sizeof(union mem_header) + size);
+
+    GUARD(header)
+
+    header->size = size;
+    mem_account_alloc(subsystem, size);
+
+    return header + 1;
+}
+
+/* Works like realloc, ptr may be NULL */
+void *mem_realloc(enum mem_subsystem subsystem, void *ptr, size_t size)
+{
+    union mem_header *header;
+    size_t old_size;
+
+    if (ptr == NULL)
+        return mem_alloc(subsystem, size);
+
+    header = (union mem_header *) ptr - 1;
+    old_size = header->size;
+
+    header = realloc(header, sizeof(union mem_header) + size);
+
+    GUARD(header)
+
+    header->size = size;
+    mem_account_free(subsystem, old_size);
+    mem_account_alloc(subsystem, size);
+
+    return header + 1;
+}
+
+/* Works like free, ptr may be NULL */
+void mem_free(enum mem_subsystem subsystem, void *ptr)
+{
+    union mem_header *header;
+
+    if (ptr == NULL)
+        return;
+
+    header = (union mem_header *) ptr - 1;
+    mem_account_free(subsystem, header->size);
+
+    free(header);
+}
+
+void mem_account_alloc(enum mem_subsystem subsystem, size_t size)
+{
+    count_alloc(&subsystems[subsystem], size);
+    count_alloc(&total, size);
+}
+
+void mem_account_free(enum mem_subsystem subsystem, size_t size)
+{
+    count_free(&subsystems[subsystem], size);
+    count_free(&total, size);
+}
+
+/* Drivers report how many tokens they lexed, see mem_stats_print */
+void mem_add_tokens(size_t count)
+{
+    atomic_fetch_add_explicit(&tokens, count, memory_order_relaxed);
+}
+
+void mem_stats_print(FILE *fd)
+{
+    size_t token_count;
+
+    fprintf(fd, "%-12s %12s %14s %14s %14s\n", "subsystem", "calls",
+        "bytes", "peak live", "live");
+
+    for (size_t i = 0; i != MEM_SUBSYSTEM_COUNT; ++i)
+        print_row(fd, subsystem_names[i], &subsystems[i]);
+
+    print_row(fd, "total", &total);
+
+    token_count = atomic_load(&tokens);
+
+    if (token_count == 0)
+        return;
+
+    fprintf(fd, "tokens %zu, bytes allocated per token %.2f, "
+        "peak live bytes per token %.2f\n", token_count,
+        (double) atomic_load(&total.bytes) / token_count,
+        (double) atomic_load(&total.peak) / token_count);
+}
+
+static void count_alloc(struct mem_counters *counters, size_t size)
+{
+    size_t live;
+    size_t peak;
+
+    atomic_fetch_add_explicit(&counters->calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters->bytes, size, memory_order_relaxed);
+    live = atomic_fetch_add_explicit(&counters->live, size,
+        memory_order_relaxed) + size;
+
+    /* Raise peak unless another thread raised it higher in the meantime */
+    peak = atomic_load_explicit(&counters->peak, memory_order_relaxed);
+
+    while (live > peak && !atomic_compare_exchange_weak_explicit(
+        &counters->peak, &peak, live,
+        memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+static void count_free(struct mem_counters *counters, size_t size)
+{
+    atomic_fetch_sub_explicit(&counters->live, size, memory_order_relaxed);
+}
+
+static void print_row(FILE *fd, const char *name,
+    struct mem_counters *counters)
+{
+    fprintf(fd, "%-12s %12zu %14zu %14zu %14zu\n", name,
+        atomic_load(&counters->calls), atomic_load(&counters->bytes),
+        atomic_load(&counters->peak), atomic_load(&counters->live));
+}
@@ -0,0 +1,39 @@
+#ifndef _COMMON_MEMORY_H_
+#define _COMMON_MEMORY_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+  Every allocation is attributed to one of these
+  Add new phases before MEM_OTHER
+*/
+enum mem_subsystem
+{
+    MEM_SOURCE,
+    MEM_LEXER,
+    MEM_LSTRING,
+    MEM_ARGUMENTS,
+    MEM_OUTPUT,
+    MEM_AST,
+    MEM_OTHER,
+    MEM_SUBSYSTEM_COUNT
+};
+
+/*
+  Thin layer over malloc/realloc/free that counts calls, bytes
+  and live memory of every subsystem
+  Running out of memory is a fatal error, just like with GUARD
+  Memory from mem_alloc must be freed with mem_free, never with free
+  mem_account_* are for memory that doesn't come from malloc (mmap)
+  Counters are atomic, these functions can be called from any thread
+*/
+void *mem_alloc(enum mem_subsystem subsystem, size_t size);
+void *mem_realloc(enum mem_subsystem subsystem, void *ptr, size_t size);
+void mem_free(enum mem_subsystem subsystem, void *ptr);
+void mem_account_alloc(enum mem_subsystem subsystem, size_t size);
+void mem_account_free(enum mem_subsystem subsystem, size_t size);
+void mem_add_tokens(size_t tokens);
+void mem_stats_print(FILE *fd);
+
+#endif
@@ -0,0 +1,195 @@
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "memory.h"
+
+#include "perfcount.h"
+
+struct perf_counter_info
+{
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+};
+
+/*
+  What read returns for a group with PERF_FORMAT_GROUP and both times
+  Times let us scale counts when the kernel multiplexes counters
+*/
+struct perf_read_format
+{
+    uint64_t count;
+    uint64_t time_enabled;
+    uint64_t time_running;
+    uint64_t values[PERF_COUNTERS];
+};
+
+/* Counters of one thread */
+struct perf_group
+{
+    int fds[PERF_COUNTERS];
+};
+
+static struct perf_group *open_group(enum perf_kind kind);
+static void close_group(void *data);
+
+static const struct perf_counter_info hardware[PERF_COUNTERS] =
+{
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES }
+};
+
+static const struct perf_counter_info software[PERF_COUNTERS] =
+{
+    { "task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    { "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    { "context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    { "cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS }
+};
+
+/* Written once by perf_enable before any other thread exists */
+static enum perf_kind kind;
+static pthread_key_t group_key;
+
+/* Group of this thread, NULL if it failed to open */
+static _Thread_local struct perf_group *group;
+static _Thread_local bool opened;
+
+
+enum perf_kind perf_enable(void)
+{
+    /* Probe on this thread, then keep the group for it */
+    group = open_group(PERF_HARDWARE);
+    kind = PERF_HARDWARE;
+
+    if (group == NULL)
+    {
+        group = open_group(PERF_SOFTWARE);
+        kind = PERF_SOFTWARE;
+    }
+
+    if (group == NULL)
+    {
+        kind = PERF_NONE;
+        return kind;
+    }
+
+    /* Groups of other threads are closed when these threads exit */
+    pthread_key_create(&group_key, close_group);
+    opened = true;
+
+    return kind;
+}
+
+enum perf_kind perf_kind(void)
+{
+    return kind;
+}
+
+/* Sample is all zeroes if counters aren't available */
+void perf_read(struct perf_sample *sample)
+{
+    struct perf_read_format data;
+
+    memset(sample, 0, sizeof(*sample));
+
+    if (kind == PERF_NONE)
+        return;
+
+    if (opened == false)
+    {
+        group = open_group(kind);
+        opened = true;
+        pthread_setspecific(group_key, group);
+    }
+
+    if (group == NULL)
+        return;
+
+    if (read(group->fds[0], &data, sizeof(data)) != sizeof(data)
+        || data.time_running == 0)
+        return;
+
+    for (size_t i = 0; i != PERF_COUNTERS; ++i)
+    {
+        /* Counter ran only part of the time, extrapolate */
+        if (data.time_running < data.time_enabled)
+            sample->values[i] = (double) data.values[i]
+                * data.time_enabled / data.time_running;
+        else
+            sample->values[i] = data.values[i];
+    }
+}
+
+const char *perf_counter_name(size_t counter)
+{
+    return kind == PERF_HARDWARE
+        ? hardware[counter].name : software[counter].name;
+}
+
+/* Open all counters of a kind as one group counting the calling thread */
+static struct perf_group *open_group(enum perf_kind group_kind)
+{
+    const struct perf_counter_info *counters;
+    int fds[PERF_COUNTERS];
+    struct perf_group *new_group;
+
+    counters = group_kind == PERF_HARDWARE ? hardware : software;
+
+    for (size_t i = 0; i != PERF_COUNTERS; ++i)
+    {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counters[i].type;
+        attr.config = counters[i].config;
+        attr.read_format = PERF_FORMAT_GROUP
+            | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        /* Works with the default perf_event_paranoid of 2 */
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        /* Only the leader is disabled, members follow it */
+        attr.disabled = i == 0;
+
+        fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1,
+            i == 0 ? -1 : fds[0], 0);
+
+        if (fds[i] == -1)
+        {
+            while (i != 0)
+                close(fds[--i]);
+
+            return NULL;
+        }
+    }
+
+    ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+    new_group = mem_alloc(MEM_OTHER, sizeof(struct perf_group));
+    memcpy(new_group->fds, fds, sizeof(fds));
+
+    return new_group;
+}
+
+/* Thread exits, close its group */
+static void close_group(void *data)
+{
+    struct perf_group *old_group;
+
+    old_group = data;
+
+    for (size_t i = 0; i != PERF_COUNTERS; ++i)
+        close(old_group->fds[i]);
+
+    mem_free(MEM_OTHER, old_group);
+}
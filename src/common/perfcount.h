@@ -0,0 +1,41 @@
+#ifndef _COMMON_PERFCOUNT_H_
+#define _COMMON_PERFCOUNT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Number of counters in a group */
+#define PERF_COUNTERS 4
+
+/*
+  Hardware counters if the CPU and kernel let us use them,
+  software events otherwise (containers, virtual machines)
+*/
+enum perf_kind
+{
+    PERF_NONE,
+    PERF_HARDWARE,
+    PERF_SOFTWARE
+};
+
+/* Values of all counters of the calling thread at one moment */
+struct perf_sample
+{
+    uint64_t values[PERF_COUNTERS];
+};
+
+/*
+  perf_event_open counter groups, enabled by --perf-counters
+  Every thread gets its own group on first perf_read, counting only
+  that thread in user space; it is closed when the thread exits
+  perf_enable probes which kind of counters works and must be called
+  before other threads are started
+  Phases read samples through timer spans, see common/timer.h
+*/
+enum perf_kind perf_enable(void);
+enum perf_kind perf_kind(void);
+void perf_read(struct perf_sample *sample);
+const char *perf_counter_name(size_t counter);
+
+#endif
@@ -0,0 +1,121 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ring.h"
+
+static void copy_in(struct ring *ring, uint64_t position, const void *data,
+    size_t size);
+static void copy_out(struct ring *ring, uint64_t position, void *buffer,
+    size_t size);
+
+
+/* Bytes to allocate for a ring holding capacity bytes */
+size_t ring_size(size_t capacity)
+{
+    return sizeof(struct ring) + capacity;
+}
+
+/* capacity must be a power of two, memory must be ring_size bytes */
+void ring_init(struct ring *ring, size_t capacity)
+{
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->capacity = capacity;
+}
+
+/*
+  Producer only, returns number of bytes written, less than size
+  if the ring is full
+  Release store of tail publishes them to the consumer
+*/
+size_t ring_write(struct ring *ring, const void *data, size_t size)
+{
+    uint64_t head;
+    uint64_t tail;
+    size_t space;
+
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    space = ring->capacity - (tail - head);
+
+    if (size > space)
+        size = space;
+
+    copy_in(ring, tail, data, size);
+    atomic_store_explicit(&ring->tail, tail + size, memory_order_release);
+
+    return size;
+}
+
+/*
+  Consumer only, returns number of bytes read, less than size
+  if there weren't enough
+  Release store of head hands their space back to the producer
+*/
+size_t ring_read(struct ring *ring, void *buffer, size_t size)
+{
+    uint64_t head;
+    uint64_t tail;
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (size > tail - head)
+        size = tail - head;
+
+    copy_out(ring, head, buffer, size);
+    atomic_store_explicit(&ring->head, head + size, memory_order_release);
+
+    return size;
+}
+
+/* Consumer only, bytes ring_read would return right now */
+size_t ring_readable(struct ring *ring)
+{
+    return atomic_load_explicit(&ring->tail, memory_order_acquire)
+        - atomic_load_explicit(&ring->head, memory_order_relaxed);
+}
+
+/* Producer only, bytes ring_write would take right now */
+size_t ring_writable(struct ring *ring)
+{
+    return ring->capacity
+        - (atomic_load_explicit(&ring->tail, memory_order_relaxed)
+        - atomic_load_explicit(&ring->head, memory_order_acquire));
+}
+
+/* Data may wrap around the end of the buffer, two copies at most */
+static void copy_in(struct ring *ring, uint64_t position, const void *data,
+    size_t size)
+{
+    size_t offset;
+    size_t first;
+
+    offset = position & (ring->capacity - 1);
+    first = ring->capacity - offset;
+
+    if (first > size)
+        first = size;
+
+    memcpy(&ring->data[offset], data, first);
+    memcpy(ring->data, (const unsigned char *) data + first, size - first);
+}
+
+static void copy_out(struct ring *ring, uint64_t position, void *buffer,
+    size_t size)
+{
+    size_t offset;
+    size_t first;
+
+    offset = position & (ring->capacity - 1);
+    first = ring->capacity - offset;
+
+    if (first > size)
+        first = size;
+
+    memcpy(buffer, &ring->data[offset], first);
+    memcpy((unsigned char *) buffer + first, ring->data, size - first);
+}
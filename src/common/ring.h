@@ -0,0 +1,35 @@
+#ifndef _COMMON_RING_H_
+#define _COMMON_RING_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Keeps head and tail off each other's cache line */
+#define RING_CACHE_LINE 64
+
+/*
+  Lock-free single producer, single consumer ring of bytes
+  head and tail count bytes read and written since ring_init, they
+  never wrap, capacity is a power of two so positions are masked
+  Everything lives in the structure, it can be placed in memory
+  shared by processes (see main/pool.c) as well as threads
+  (see parser/pipeline.c)
+  Neither side ever blocks, waiting is up to the caller
+*/
+struct ring
+{
+    _Alignas(RING_CACHE_LINE) _Atomic uint64_t head;
+    _Alignas(RING_CACHE_LINE) _Atomic uint64_t tail;
+    _Alignas(RING_CACHE_LINE) size_t capacity;
+    unsigned char data[];
+};
+
+size_t ring_size(size_t capacity);
+void ring_init(struct ring *ring, size_t capacity);
+size_t ring_write(struct ring *ring, const void *data, size_t size);
+size_t ring_read(struct ring *ring, void *buffer, size_t size);
+size_t ring_readable(struct ring *ring);
+size_t ring_writable(struct ring *ring);
+
+#endif
@@ -0,0 +1,626 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "exitcodes.h"
+#include "fatal.h"
+#include "memory.h"
+#include "timer.h"
+#include "trace.h"
+#include "vector.h"
+
+#include "scheduler.h"
+
+/* Keeps top and bottom of a deque off each other's cache line */
+#define SCHEDULER_CACHE_LINE 64
+
+VECTOR(vector_task, struct task *)
+
+/*
+  pending counts dependencies that haven't finished yet, the task is
+  ready when it drops to zero, dependencies is where it starts
+*/
+struct task
+{
+    void (*run)(void *data, size_t worker);
+    void *data;
+    uint64_t cost;
+    uint64_t rank;
+    size_t dependencies;
+    atomic_size_t pending;
+    struct vector_task successors;
+};
+
+/*
+  Chase-Lev deque, owner works at the bottom, thieves at the top
+  It never grows, every deque can hold every task of the scheduler
+  Slots are atomic so that a thief reading a slot the owner is
+  overwriting is a lost race, not a data race
+*/
+struct deque
+{
+    _Alignas(SCHEDULER_CACHE_LINE) _Atomic int64_t top;
+    _Alignas(SCHEDULER_CACHE_LINE) _Atomic int64_t bottom;
+    _Atomic(struct task *) *slots;
+    int64_t mask;
+};
+
+/* token tells whether it runs on something acquire gave us */
+struct worker
+{
+    struct deque deque;
+    pthread_t thread;
+    struct scheduler *scheduler;
+    size_t index;
+    bool token;
+    uint64_t seed;
+};
+
+/*
+  remaining counts tasks that haven't finished, workers exit at zero
+  Idle workers sleep on wake, epoch changes whenever tasks are pushed
+  so that a worker doesn't sleep through work pushed while it looked
+  started is protected by lock
+*/
+struct scheduler
+{
+    struct arena *arena;
+    struct vector_task tasks;
+    struct worker *workers;
+    size_t count;
+    size_t started;
+    bool (*acquire)(void);
+    void (*release)(void);
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    atomic_size_t remaining;
+    atomic_size_t epoch;
+    atomic_size_t sleepers;
+};
+
+static void compute_ranks(struct scheduler *scheduler);
+static void distribute(struct scheduler *scheduler);
+static void start_worker(struct scheduler *scheduler, bool token);
+static void grow(struct scheduler *scheduler);
+static void *worker_main(void *data);
+static struct task *steal_any(struct worker *self);
+static void finish(struct worker *self, struct task *task);
+static void idle(struct scheduler *scheduler, size_t seen);
+static void notify(struct scheduler *scheduler);
+static int compare_rank(const void *a, const void *b);
+static void deque_push(struct deque *deque, struct task *task);
+static struct task *deque_pop(struct deque *deque);
+static struct task *deque_steal(struct deque *deque);
+
+
+struct scheduler *scheduler_create(size_t workers, bool (*acquire)(void),
+    void (*release)(void))
+{
+    struct scheduler *scheduler;
+
+    scheduler = mem_alloc(MEM_OTHER, sizeof(struct scheduler));
+
+    scheduler->arena = arena_create(MEM_OTHER, 0, 0);
+    vector_task_init(&scheduler->tasks, MEM_OTHER);
+    /* Deques start on cache lines, more than mem_alloc guarantees */
+    scheduler->workers = arena_alloc_aligned(scheduler->arena,
+        workers * sizeof(struct worker), _Alignof(struct worker));
+    scheduler->count = workers;
+    scheduler->started = 0;
+    scheduler->acquire = acquire;
+    scheduler->release = release;
+    pthread_mutex_init(&scheduler->lock, NULL);
+    pthread_cond_init(&scheduler->wake, NULL);
+    atomic_init(&scheduler->remaining, 0);
+    atomic_init(&scheduler->epoch, 0);
+    atomic_init(&scheduler->sleepers, 0);
+
+    for (size_t i = 0; i != workers; ++i)
+        scheduler->workers[i].deque.slots = NULL;
+
+    return scheduler;
+}
+
+/* Call scheduler_wait first if it was started */
+void scheduler_destroy(struct scheduler *scheduler)
+{
+    for (size_t i = 0; i != scheduler->tasks.count; ++i)
+        vector_task_fini(&scheduler->tasks.data[i]->successors);
+
+    for (size_t i = 0; i != scheduler->count; ++i)
+        mem_free(MEM_OTHER, scheduler->workers[i].deque.slots);
+
+    pthread_cond_destroy(&scheduler->wake);
+    pthread_mutex_destroy(&scheduler->lock);
+    vector_task_fini(&scheduler->tasks);
+    arena_destroy(scheduler->arena);
+    mem_free(MEM_OTHER, scheduler);
+}
+
+/* cost is only compared with costs of other tasks, e.g. bytes of input */
+struct task *scheduler_add(struct scheduler *scheduler,
+    void (*run)(void *data, size_t worker), void *data, uint64_t cost)
+{
+    struct task *task;
+
+    task = arena_alloc(scheduler->arena, sizeof(struct task));
+    task->run = run;
+    task->data = data;
+    task->cost = cost;
+    task->rank = 0;
+    task->dependencies = 0;
+    atomic_init(&task->pending, 0);
+    vector_task_init(&task->successors, MEM_OTHER);
+
+    vector_task_push(&scheduler->tasks, task);
+
+    return task;
+}
+
+/* task doesn't start before dependency finishes */
+void scheduler_depend(struct task *task, struct task *dependency)
+{
+    vector_task_push(&dependency->successors, task);
+    task->dependencies += 1;
+}
+
+/* Returns right away, tasks run on worker threads */
+void scheduler_start(struct scheduler *scheduler)
+{
+    size_t capacity;
+
+    compute_ranks(scheduler);
+
+    /* Power of two so that indices wrap with a mask */
+    capacity = 1;
+
+    while (capacity < scheduler->tasks.count)
+        capacity *= 2;
+
+    for (size_t i = 0; i != scheduler->count; ++i)
+    {
+        struct worker *worker;
+
+        worker = &scheduler->workers[i];
+        worker->scheduler = scheduler;
+        worker->index = i;
+        worker->seed = i * 0x9e3779b97f4a7c15u + 1;
+        worker->deque.slots = mem_alloc(MEM_OTHER,
+            capacity * sizeof(worker->deque.slots[0]));
+        worker->deque.mask = capacity - 1;
+        atomic_init(&worker->deque.top, 0);
+        atomic_init(&worker->deque.bottom, 0);
+    }
+
+    atomic_store(&scheduler->remaining, scheduler->tasks.count);
+
+    distribute(scheduler);
+
+    /* Nothing to do, nothing to start */
+    if (scheduler->tasks.count == 0)
+        return;
+
+    pthread_mutex_lock(&scheduler->lock);
+
+    start_worker(scheduler, false);
+
+    while (scheduler->started != scheduler->count
+        && scheduler->started < scheduler->tasks.count
+        && scheduler->acquire())
+        start_worker(scheduler, true);
+
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+/* Returns once every task has finished and every worker has exited */
+void scheduler_wait(struct scheduler *scheduler)
+{
+    size_t started;
+
+    pthread_mutex_lock(&scheduler->lock);
+
+    while (atomic_load(&scheduler->remaining) != 0)
+        pthread_cond_wait(&scheduler->wake, &scheduler->lock);
+
+    /* No worker starts another one once all tasks are done */
+    started = scheduler->started;
+
+    pthread_mutex_unlock(&scheduler->lock);
+
+    for (size_t i = 0; i != started; ++i)
+        pthread_join(scheduler->workers[i].thread, NULL);
+}
+
+/*
+  Kahn's algorithm gives a topological order, ranks are summed
+  walking it backwards so that successors are ranked first
+*/
+static void compute_ranks(struct scheduler *scheduler)
+{
+    struct vector_task order;
+    size_t count;
+
+    count = scheduler->tasks.count;
+    vector_task_init(&order, MEM_OTHER);
+    vector_task_reserve(&order, count);
+
+    for (size_t i = 0; i != count; ++i)
+    {
+        struct task *task;
+
+        task = scheduler->tasks.data[i];
+        atomic_store_explicit(&task->pending, task->dependencies,
+            memory_order_relaxed);
+
+        if (task->dependencies == 0)
+            vector_task_push(&order, task);
+    }
+
+    for (size_t i = 0; i != order.count; ++i)
+    {
+        struct task *task;
+
+        task = order.data[i];
+
+        for (size_t j = 0; j != task->successors.count; ++j)
+        {
+            struct task *successor;
+
+            successor = task->successors.data[j];
+
+            if (atomic_fetch_sub_explicit(&successor->pending, 1,
+                memory_order_relaxed) == 1)
+                vector_task_push(&order, successor);
+        }
+    }
+
+    if (order.count != count)
+    {
+        fatal(EXITCODE_INVOCATION_ERROR,
+            "Dependency cycle between units");
+    }
+
+    for (size_t i = count; i != 0; --i)
+    {
+        struct task *task;
+        uint64_t longest;
+
+        task = order.data[i - 1];
+        longest = 0;
+
+        for (size_t j = 0; j != task->successors.count; ++j)
+        {
+            if (task->successors.data[j]->rank > longest)
+                longest = task->successors.data[j]->rank;
+        }
+
+        task->rank = task->cost + longest;
+        atomic_store_explicit(&task->pending, task->dependencies,
+            memory_order_relaxed);
+    }
+
+    vector_task_fini(&order);
+}
+
+/*
+  Tasks without dependencies are dealt out like cards, highest rank
+  first, and pushed so that every worker pops its highest rank first
+*/
+static void distribute(struct scheduler *scheduler)
+{
+    struct vector_task ready;
+
+    vector_task_init(&ready, MEM_OTHER);
+
+    for (size_t i = 0; i != scheduler->tasks.count; ++i)
+    {
+        if (scheduler->tasks.data[i]->dependencies == 0)
+            vector_task_push(&ready, scheduler->tasks.data[i]);
+    }
+
+    /* Ascending, the highest rank is the last one */
+    qsort(ready.data, ready.count, sizeof(struct task *), compare_rank);
+
+    for (size_t i = 0; i != ready.count; ++i)
+    {
+        struct worker *worker;
+
+        worker = &scheduler->workers[(ready.count - 1 - i)
+            % scheduler->count];
+        deque_push(&worker->deque, ready.data[i]);
+    }
+
+    vector_task_fini(&ready);
+}
+
+/* Called with scheduler->lock held */
+static void start_worker(struct scheduler *scheduler, bool token)
+{
+    struct worker *worker;
+    int error;
+
+    worker = &scheduler->workers[scheduler->started];
+    worker->token = token;
+
+    error = pthread_create(&worker->thread, NULL, worker_main, worker);
+
+    if (error != 0)
+    {
+        fatal(EXITCODE_INTERNAL_ERROR, "Failed to start worker thread: %s",
+            strerror(error));
+    }
+
+    scheduler->started += 1;
+}
+
+/*
+  One more worker if there is more work than workers and acquire
+  lets us, e.g. a jobserver token became free meanwhile
+*/
+static void grow(struct scheduler *scheduler)
+{
+    pthread_mutex_lock(&scheduler->lock);
+
+    if (scheduler->started != scheduler->count
+        && atomic_load(&scheduler->remaining) > scheduler->started
+        && scheduler->acquire())
+        start_worker(scheduler, true);
+
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+/* Own tasks first, then stolen ones, sleep when there are none */
+static void *worker_main(void *data)
+{
+    struct worker *self;
+    struct scheduler *scheduler;
+    struct timer_span span;
+
+    self = data;
+    scheduler = self->scheduler;
+
+    trace_thread_name("worker");
+    span = timer_start(TIMER_WORKER);
+
+    while (atomic_load(&scheduler->remaining) != 0)
+    {
+        struct task *task;
+        size_t seen;
+
+        seen = atomic_load(&scheduler->epoch);
+
+        task = deque_pop(&self->deque);
+
+        if (task == NULL)
+            task = steal_any(self);
+
+        if (task == NULL)
+        {
+            idle(scheduler, seen);
+            continue;
+        }
+
+        task->run(task->data, self->index);
+        finish(self, task);
+        grow(scheduler);
+    }
+
+    /* Nothing left to run, let somebody else use it */
+    if (self->token)
+        scheduler->release();
+
+    timer_stop(&span);
+
+    return NULL;
+}
+
+/* Start at a random victim so that thieves don't all pick the same */
+static struct task *steal_any(struct worker *self)
+{
+    struct scheduler *scheduler;
+    size_t start;
+
+    scheduler = self->scheduler;
+
+    /* xorshift64 */
+    self->seed ^= self->seed << 13;
+    self->seed ^= self->seed >> 7;
+    self->seed ^= self->seed << 17;
+    start = self->seed % scheduler->count;
+
+    for (size_t i = 0; i != scheduler->count; ++i)
+    {
+        struct worker *victim;
+        struct task *task;
+
+        victim = &scheduler->workers[(start + i) % scheduler->count];
+
+        if (victim == self)
+            continue;
+
+        task = deque_steal(&victim->deque);
+
+        if (task != NULL)
+            return task;
+    }
+
+    return NULL;
+}
+
+/*
+  Successors that became ready go to our own deque, their inputs
+  are likely still in our caches, highest rank is pushed last so
+  that it's popped next
+*/
+static void finish(struct worker *self, struct task *task)
+{
+    struct scheduler *scheduler;
+    struct task **ready;
+    size_t count;
+
+    scheduler = self->scheduler;
+    ready = task->successors.data;
+    count = 0;
+
+    /* Successors that aren't ready are moved out of the way */
+    for (size_t i = 0; i != task->successors.count; ++i)
+    {
+        struct task *successor;
+
+        successor = task->successors.data[i];
+
+        if (atomic_fetch_sub(&successor->pending, 1) == 1)
+        {
+            ready[i] = ready[count];
+            ready[count] = successor;
+            count += 1;
+        }
+    }
+
+    if (count != 0)
+    {
+        qsort(ready, count, sizeof(struct task *), compare_rank);
+
+        for (size_t i = 0; i != count; ++i)
+            deque_push(&self->deque, ready[i]);
+
+        notify(scheduler);
+    }
+
+    if (atomic_fetch_sub(&scheduler->remaining, 1) == 1)
+    {
+        /* Last one, wake everybody up to exit, and scheduler_wait */
+        pthread_mutex_lock(&scheduler->lock);
+        pthread_cond_broadcast(&scheduler->wake);
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+}
+
+/*
+  Sleep unless tasks were pushed since seen was read or all are done
+  Sleepers announce themselves before they check epoch and pushers
+  change epoch before they check for sleepers, one of them sees
+  the other, see notify
+*/
+static void idle(struct scheduler *scheduler, size_t seen)
+{
+    pthread_mutex_lock(&scheduler->lock);
+
+    atomic_fetch_add(&scheduler->sleepers, 1);
+
+    if (atomic_load(&scheduler->epoch) == seen
+        && atomic_load(&scheduler->remaining) != 0)
+        pthread_cond_wait(&scheduler->wake, &scheduler->lock);
+
+    atomic_fetch_sub(&scheduler->sleepers, 1);
+
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+static void notify(struct scheduler *scheduler)
+{
+    atomic_fetch_add(&scheduler->epoch, 1);
+
+    if (atomic_load(&scheduler->sleepers) == 0)
+        return;
+
+    pthread_mutex_lock(&scheduler->lock);
+    pthread_cond_broadcast(&scheduler->wake);
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+/* Ascending rank */
+static int compare_rank(const void *a, const void *b)
+{
+    const struct task *left;
+    const struct task *right;
+
+    left = *(struct task * const *) a;
+    right = *(struct task * const *) b;
+
+    if (left->rank != right->rank)
+        return left->rank < right->rank ? -1 : 1;
+
+    return 0;
+}
+
+/*
+  Owner only, see Le, Pop, Cohen, Zappa Nardelli, "Correct and
+  Efficient Work-Stealing for Weak Memory Models"
+  Release store of bottom publishes the slot and the task to thieves
+*/
+static void deque_push(struct deque *deque, struct task *task)
+{
+    int64_t bottom;
+
+    bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+
+    atomic_store_explicit(&deque->slots[bottom & deque->mask], task,
+        memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+}
+
+/* Owner only, races with thieves for the last task */
+static struct task *deque_pop(struct deque *deque)
+{
+    struct task *task;
+    int64_t bottom;
+    int64_t top;
+
+    bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom)
+    {
+        /* Empty */
+        atomic_store_explicit(&deque->bottom, bottom + 1,
+            memory_order_relaxed);
+        return NULL;
+    }
+
+    task = atomic_load_explicit(&deque->slots[bottom & deque->mask],
+        memory_order_relaxed);
+
+    if (top == bottom)
+    {
+        if (atomic_compare_exchange_strong_explicit(&deque->top, &top,
+            top + 1, memory_order_seq_cst, memory_order_relaxed) == false)
+            task = NULL;
+
+        atomic_store_explicit(&deque->bottom, bottom + 1,
+            memory_order_relaxed);
+    }
+
+    return task;
+}
+
+/* Any thread, NULL if the deque is empty or another thief won */
+static struct task *deque_steal(struct deque *deque)
+{
+    struct task *task;
+    int64_t top;
+    int64_t bottom;
+
+    top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (top >= bottom)
+        return NULL;
+
+    task = atomic_load_explicit(&deque->slots[top & deque->mask],
+        memory_order_relaxed);
+
+    if (atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+        memory_order_seq_cst, memory_order_relaxed) == false)
+        return NULL;
+
+    return task;
+}
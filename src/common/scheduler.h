@@ -0,0 +1,34 @@
+#ifndef _COMMON_SCHEDULER_H_
+#define _COMMON_SCHEDULER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct task;
+struct scheduler;
+
+/*
+  Work-stealing task scheduler
+  Tasks and their dependencies are added before scheduler_start,
+  a task runs once every task it depends on has finished
+  Every worker has a Chase-Lev deque, it pushes and pops ready tasks
+  at the bottom, idle workers steal from the top of the others
+  Tasks on the critical path go first: rank of a task is its cost plus
+  the highest rank among tasks that depend on it, ready tasks are
+  handed out highest rank first
+  Worker 0 always runs, the others start only when acquire returns
+  true, e.g. for a jobserver token, and call release when they exit
+  run gets the index of the worker, below workers, for state of its own
+  Dependency cycles are fatal
+*/
+struct scheduler *scheduler_create(size_t workers, bool (*acquire)(void),
+    void (*release)(void));
+void scheduler_destroy(struct scheduler *scheduler);
+struct task *scheduler_add(struct scheduler *scheduler,
+    void (*run)(void *data, size_t worker), void *data, uint64_t cost);
+void scheduler_depend(struct task *task, struct task *dependency);
+void scheduler_start(struct scheduler *scheduler);
+void scheduler_wait(struct scheduler *scheduler);
+
+#endif
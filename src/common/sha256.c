@@ -0,0 +1,179 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sha256.h"
+
+#define ROTATE(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void compress(uint32_t *state, const unsigned char *block);
+
+static const uint32_t constants[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+void sha256_init(struct sha256 *sha)
+{
+    static const uint32_t initial[8] =
+    {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(sha->state, initial, sizeof(initial));
+    sha->length = 0;
+    sha->used = 0;
+}
+
+void sha256_update(struct sha256 *sha, const void *data, size_t size)
+{
+    const unsigned char *bytes;
+
+    bytes = data;
+    sha->length += size;
+
+    /* Finish a partial block first */
+    if (sha->used != 0)
+    {
+        size_t take;
+
+        take = SHA256_BLOCK_SIZE - sha->used;
+
+        if (take > size)
+            take = size;
+
+        memcpy(&sha->block[sha->used], bytes, take);
+        sha->used += take;
+        bytes += take;
+        size -= take;
+
+        if (sha->used != SHA256_BLOCK_SIZE)
+            return;
+
+        compress(sha->state, sha->block);
+        sha->used = 0;
+    }
+
+    /* Whole blocks straight from the caller's memory */
+    while (size >= SHA256_BLOCK_SIZE)
+    {
+        compress(sha->state, bytes);
+        bytes += SHA256_BLOCK_SIZE;
+        size -= SHA256_BLOCK_SIZE;
+    }
+
+    memcpy(sha->block, bytes, size);
+    sha->used = size;
+}
+
+void sha256_final(struct sha256 *sha, unsigned char *digest)
+{
+    uint64_t bits;
+
+    bits = sha->length * 8;
+
+    /* 1 bit, zeros up to 56 bytes of the last block, length in bits */
+    sha->block[sha->used] = 0x80;
+    sha->used += 1;
+
+    if (sha->used > SHA256_BLOCK_SIZE - 8)
+    {
+        memset(&sha->block[sha->used], 0, SHA256_BLOCK_SIZE - sha->used);
+        compress(sha->state, sha->block);
+        sha->used = 0;
+    }
+
+    memset(&sha->block[sha->used], 0, SHA256_BLOCK_SIZE - 8 - sha->used);
+
+    for (size_t i = 0; i != 8; ++i)
+        sha->block[SHA256_BLOCK_SIZE - 1 - i] = bits >> (i * 8);
+
+    compress(sha->state, sha->block);
+
+    for (size_t i = 0; i != 8; ++i)
+    {
+        digest[i * 4] = sha->state[i] >> 24;
+        digest[i * 4 + 1] = sha->state[i] >> 16;
+        digest[i * 4 + 2] = sha->state[i] >> 8;
+        digest[i * 4 + 3] = sha->state[i];
+    }
+}
+
+static void compress(uint32_t *state, const unsigned char *block)
+{
+    uint32_t schedule[64];
+    uint32_t a, b, c, d, e, f, g, h;
+
+    for (size_t i = 0; i != 16; ++i)
+    {
+        schedule[i] = (uint32_t) block[i * 4] << 24
+            | (uint32_t) block[i * 4 + 1] << 16
+            | (uint32_t) block[i * 4 + 2] << 8
+            | (uint32_t) block[i * 4 + 3];
+    }
+
+    for (size_t i = 16; i != 64; ++i)
+    {
+        uint32_t s0, s1;
+
+        s0 = ROTATE(schedule[i - 15], 7) ^ ROTATE(schedule[i - 15], 18)
+            ^ (schedule[i - 15] >> 3);
+        s1 = ROTATE(schedule[i - 2], 17) ^ ROTATE(schedule[i - 2], 19)
+            ^ (schedule[i - 2] >> 10);
+        schedule[i] = schedule[i - 16] + s0 + schedule[i - 7] + s1;
+    }
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
+
+    for (size_t i = 0; i != 64; ++i)
+    {
+        uint32_t t1, t2;
+
+        t1 = h + (ROTATE(e, 6) ^ ROTATE(e, 11) ^ ROTATE(e, 25))
+            + ((e & f) ^ (~e & g)) + constants[i] + schedule[i];
+        t2 = (ROTATE(a, 2) ^ ROTATE(a, 13) ^ ROTATE(a, 22))
+            + ((a & b) ^ (a & c) ^ (b & c));
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
@@ -0,0 +1,23 @@
+#ifndef _COMMON_SHA256_H_
+#define _COMMON_SHA256_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+
+/* Incremental SHA-256 (FIPS 180-4), feed data with sha256_update */
+struct sha256
+{
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char block[SHA256_BLOCK_SIZE];
+    size_t used;
+};
+
+void sha256_init(struct sha256 *sha);
+void sha256_update(struct sha256 *sha, const void *data, size_t size);
+void sha256_final(struct sha256 *sha, unsigned char *digest);
+
+#endif
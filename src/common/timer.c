@@ -0,0 +1,327 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "trace.h"
+
+#include "timer.h"
+
+/* Parent of phases directly under the whole run */
+#define TIMER_ROOT TIMER_PHASE_COUNT
+
+struct timer_counters
+{
+    atomic_uint_fast64_t calls;
+    atomic_uint_fast64_t wall_ns;
+    atomic_uint_fast64_t cpu_ns;
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t tokens;
+    atomic_uint_fast64_t perf[PERF_COUNTERS];
+};
+
+struct timer_phase_info
+{
+    const char *name;
+    enum timer_phase parent;
+};
+
+static uint64_t clock_ns(clockid_t clock);
+static void print_counters(FILE *fd);
+static void print_ratio(FILE *fd, uint64_t value, uint64_t divisor);
+static void print_phase(FILE *fd, enum timer_phase phase, size_t depth);
+static void print_row(FILE *fd, const char *name, size_t depth,
+    uint64_t calls, uint64_t wall_ns, uint64_t cpu_ns, uint64_t bytes,
+    uint64_t tokens);
+
+static const struct timer_phase_info phases[TIMER_PHASE_COUNT] =
+{
+    [TIMER_ARGUMENTS] = { "arguments", TIMER_ROOT },
+    [TIMER_WORKER] = { "worker", TIMER_ROOT },
+    [TIMER_UNIT] = { "unit", TIMER_ROOT },
+    [TIMER_LEX] = { "lex", TIMER_UNIT },
+    [TIMER_LOAD] = { "load", TIMER_LEX },
+    [TIMER_PARSE] = { "parse", TIMER_UNIT },
+    [TIMER_OUTPUT] = { "output", TIMER_UNIT },
+    [TIMER_CACHE] = { "cache", TIMER_UNIT },
+    [TIMER_WRITE] = { "write", TIMER_ROOT }
+};
+
+static struct timer_counters counters[TIMER_PHASE_COUNT];
+/* Written once by timer_enable before any other thread exists */
+static bool enabled;
+static uint64_t start_ns;
+
+
+void timer_enable(void)
+{
+    enabled = true;
+    start_ns = timer_now_ns();
+}
+
+bool timer_enabled(void)
+{
+    return enabled;
+}
+
+struct timer_span timer_start(enum timer_phase phase)
+{
+    return timer_start_detail(phase, NULL);
+}
+
+/* detail, e.g. a file name, is shown in traces, it is copied */
+struct timer_span timer_start_detail(enum timer_phase phase,
+    const char *detail)
+{
+    struct timer_span span;
+
+    span.phase = phase;
+    span.detail = detail;
+    span.active = enabled || trace_enabled();
+
+    if (span.active == false)
+        return span;
+
+    span.wall_ns = timer_now_ns();
+
+    /* Thread CPU time is a system call, traces don't need it */
+    span.cpu_ns = enabled ? clock_ns(CLOCK_THREAD_CPUTIME_ID) : 0;
+
+    if (enabled && perf_kind() != PERF_NONE)
+        perf_read(&span.perf);
+
+    return span;
+}
+
+void timer_stop(struct timer_span *span)
+{
+    struct timer_counters *phase;
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+
+    if (span->active == false)
+        return;
+
+    span->active = false;
+    wall_ns = timer_now_ns() - span->wall_ns;
+
+    trace_event(phases[span->phase].name, span->detail, span->wall_ns,
+        wall_ns);
+
+    if (enabled == false)
+        return;
+
+    cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID) - span->cpu_ns;
+
+    phase = &counters[span->phase];
+
+    atomic_fetch_add_explicit(&phase->calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&phase->wall_ns, wall_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&phase->cpu_ns, cpu_ns, memory_order_relaxed);
+
+    if (perf_kind() != PERF_NONE)
+    {
+        struct perf_sample now;
+
+        perf_read(&now);
+
+        for (size_t i = 0; i != PERF_COUNTERS; ++i)
+            atomic_fetch_add_explicit(&phase->perf[i],
+                now.values[i] - span->perf.values[i], memory_order_relaxed);
+    }
+}
+
+/* Bytes a phase processed, used for throughput */
+void timer_add_bytes(enum timer_phase phase, size_t bytes)
+{
+    if (enabled)
+        atomic_fetch_add_explicit(&counters[phase].bytes, bytes,
+            memory_order_relaxed);
+}
+
+/* Tokens a phase processed, used for throughput */
+void timer_add_tokens(enum timer_phase phase, size_t tokens)
+{
+    if (enabled)
+        atomic_fetch_add_explicit(&counters[phase].tokens, tokens,
+            memory_order_relaxed);
+}
+
+uint64_t timer_now_ns(void)
+{
+    return clock_ns(CLOCK_MONOTONIC);
+}
+
+/*
+  Table with a row per phase, children are indented under parents
+  Throughput is computed from wall time of the phase itself
+*/
+void timer_report_print(FILE *fd)
+{
+    fprintf(fd, "%-20s %10s %12s %12s %10s %14s\n", "phase", "calls",
+        "wall ms", "cpu ms", "MB/s", "tokens/s");
+
+    print_row(fd, "total", 0, 1, timer_now_ns() - start_ns,
+        clock_ns(CLOCK_PROCESS_CPUTIME_ID), 0, 0);
+
+    for (size_t i = 0; i != TIMER_PHASE_COUNT; ++i)
+        if (phases[i].parent == TIMER_ROOT)
+            print_phase(fd, i, 1);
+
+    if (perf_kind() != PERF_NONE)
+        print_counters(fd);
+}
+
+/* Same numbers for machines, times in nanoseconds */
+void timer_report_print_json(FILE *fd)
+{
+    fprintf(fd, "{\"wall_ns\":%llu,\"cpu_ns\":%llu,\"phases\":[",
+        (unsigned long long) (timer_now_ns() - start_ns),
+        (unsigned long long) clock_ns(CLOCK_PROCESS_CPUTIME_ID));
+
+    for (size_t i = 0; i != TIMER_PHASE_COUNT; ++i)
+    {
+        fprintf(fd, "%s{\"name\":\"%s\",\"parent\":\"%s\",\"calls\":%llu,"
+            "\"wall_ns\":%llu,\"cpu_ns\":%llu,\"bytes\":%llu,"
+            "\"tokens\":%llu",
+            i == 0 ? "" : ",", phases[i].name,
+            phases[i].parent == TIMER_ROOT
+                ? "total" : phases[phases[i].parent].name,
+            (unsigned long long) atomic_load(&counters[i].calls),
+            (unsigned long long) atomic_load(&counters[i].wall_ns),
+            (unsigned long long) atomic_load(&counters[i].cpu_ns),
+            (unsigned long long) atomic_load(&counters[i].bytes),
+            (unsigned long long) atomic_load(&counters[i].tokens));
+
+        if (perf_kind() != PERF_NONE)
+        {
+            fputs(",\"counters\":{", fd);
+
+            for (size_t j = 0; j != PERF_COUNTERS; ++j)
+                fprintf(fd, "%s\"%s\":%llu", j == 0 ? "" : ",",
+                    perf_counter_name(j),
+                    (unsigned long long) atomic_load(&counters[i].perf[j]));
+
+            fputs("}", fd);
+        }
+
+        fputs("}", fd);
+    }
+
+    fputs("]}\n", fd);
+}
+
+static uint64_t clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void print_phase(FILE *fd, enum timer_phase phase, size_t depth)
+{
+    struct timer_counters *phase_counters;
+
+    phase_counters = &counters[phase];
+
+    print_row(fd, phases[phase].name, depth,
+        atomic_load(&phase_counters->calls),
+        atomic_load(&phase_counters->wall_ns),
+        atomic_load(&phase_counters->cpu_ns),
+        atomic_load(&phase_counters->bytes),
+        atomic_load(&phase_counters->tokens));
+
+    for (size_t i = 0; i != TIMER_PHASE_COUNT; ++i)
+        if (phases[i].parent == phase)
+            print_phase(fd, i, depth + 1);
+}
+
+static void print_row(FILE *fd, const char *name, size_t depth,
+    uint64_t calls, uint64_t wall_ns, uint64_t cpu_ns, uint64_t bytes,
+    uint64_t tokens)
+{
+    double seconds;
+
+    /* Don't divide by zero on phases that never ran */
+    seconds = wall_ns != 0 ? wall_ns / 1e9 : 1e-9;
+
+    fprintf(fd, "%*s%-*s %10llu %12.3f %12.3f ", (int) depth * 2, "",
+        20 - (int) depth * 2, name, (unsigned long long) calls,
+        wall_ns / 1e6, cpu_ns / 1e6);
+
+    if (bytes != 0)
+        fprintf(fd, "%10.2f ", bytes / seconds / 1e6);
+    else
+        fprintf(fd, "%10s ", "-");
+
+    if (tokens != 0)
+        fprintf(fd, "%14.0f\n", tokens / seconds);
+    else
+        fprintf(fd, "%14s\n", "-");
+}
+
+/*
+  Counters of every phase with derived numbers
+  Hardware: instructions per cycle, branch and cache misses per token
+  Software: page faults per token
+*/
+static void print_counters(FILE *fd)
+{
+    bool hardware;
+
+    hardware = perf_kind() == PERF_HARDWARE;
+
+    fprintf(fd, "\n%-20s", hardware ? "counters" : "software counters");
+
+    for (size_t i = 0; i != PERF_COUNTERS; ++i)
+        fprintf(fd, " %16s", perf_counter_name(i));
+
+    if (hardware)
+        fprintf(fd, " %8s %14s %14s\n", "IPC", "br-miss/token",
+            "cache-miss/tok");
+    else
+        fprintf(fd, " %14s\n", "faults/token");
+
+    for (size_t phase = 0; phase != TIMER_PHASE_COUNT; ++phase)
+    {
+        uint64_t values[PERF_COUNTERS];
+        uint64_t tokens;
+
+        for (size_t i = 0; i != PERF_COUNTERS; ++i)
+            values[i] = atomic_load(&counters[phase].perf[i]);
+
+        tokens = atomic_load(&counters[phase].tokens);
+
+        fprintf(fd, "%-20s", phases[phase].name);
+
+        for (size_t i = 0; i != PERF_COUNTERS; ++i)
+            fprintf(fd, " %16llu", (unsigned long long) values[i]);
+
+        if (hardware)
+        {
+            fputs(" ", fd);
+            print_ratio(fd, values[1], values[0]);
+            print_ratio(fd, values[2], tokens);
+            print_ratio(fd, values[3], tokens);
+        }
+        else
+        {
+            print_ratio(fd, values[1], tokens);
+        }
+
+        fputs("\n", fd);
+    }
+}
+
+/* Dash when there is nothing to divide by */
+static void print_ratio(FILE *fd, uint64_t value, uint64_t divisor)
+{
+    if (divisor == 0)
+        fprintf(fd, " %14s", "-");
+    else
+        fprintf(fd, " %14.3f", (double) value / divisor);
+}
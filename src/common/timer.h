@@ -0,0 +1,67 @@
+#ifndef _COMMON_TIMER_H_
+#define _COMMON_TIMER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "perfcount.h"
+
+/*
+  Phases reported by --time-report
+  Every phase has a parent in the table in timer.c, the report is a tree
+  whose root is the whole run
+  Add new phases (parse, sema, IR, codegen...) before TIMER_PHASE_COUNT
+  and give them a name and a parent in timer.c
+*/
+enum timer_phase
+{
+    TIMER_ARGUMENTS,
+    TIMER_WORKER,
+    TIMER_UNIT,
+    TIMER_LEX,
+    TIMER_LOAD,
+    TIMER_PARSE,
+    TIMER_OUTPUT,
+    TIMER_CACHE,
+    TIMER_WRITE,
+    TIMER_PHASE_COUNT
+};
+
+/* Running measurement of one phase, see timer_start */
+struct timer_span
+{
+    enum timer_phase phase;
+    bool active;
+    const char *detail;
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+    struct perf_sample perf;
+};
+
+/*
+  Registry of phase timings
+  Spans measure monotonic wall time and CPU time of the calling thread,
+  they must be stopped by the thread that started them
+  Phases run by many threads at once add up, like CPU time does
+  Counters are atomic, spans can be used from any thread
+  Everything is a no-op until timer_enable is called, it must be
+  called before other threads are started
+  Spans are also recorded as trace events if tracing is enabled,
+  see common/trace.h, and read performance counters if those are,
+  see common/perfcount.h
+*/
+void timer_enable(void);
+bool timer_enabled(void);
+struct timer_span timer_start(enum timer_phase phase);
+struct timer_span timer_start_detail(enum timer_phase phase,
+    const char *detail);
+void timer_stop(struct timer_span *span);
+void timer_add_bytes(enum timer_phase phase, size_t bytes);
+void timer_add_tokens(enum timer_phase phase, size_t tokens);
+uint64_t timer_now_ns(void);
+void timer_report_print(FILE *fd);
+void timer_report_print_json(FILE *fd);
+
+#endif
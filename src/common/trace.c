@@ -0,0 +1,228 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "memory.h"
+#include "timer.h"
+#include "vector.h"
+
+#include "trace.h"
+
+/* name is a string literal, detail is a copy in the buffer's arena */
+struct trace_event
+{
+    const char *name;
+    const char *detail;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+};
+
+VECTOR(vector_trace_event, struct trace_event)
+
+/* Events of one thread, only that thread ever appends to it */
+struct trace_buffer
+{
+    struct trace_buffer *next;
+    struct vector_trace_event events;
+    struct arena *strings;
+    const char *thread_name;
+    unsigned int tid;
+};
+
+static struct trace_buffer *local_buffer(void);
+static void write_string(FILE *fd, const char *string);
+
+/* Written once by trace_enable before any other thread exists */
+static bool enabled;
+static const char *output_name;
+static uint64_t start_ns;
+
+static _Atomic(struct trace_buffer *) buffers;
+static atomic_uint next_tid;
+static _Thread_local struct trace_buffer *buffer;
+
+
+void trace_enable(const char *file_name)
+{
+    enabled = true;
+    output_name = file_name;
+    start_ns = timer_now_ns();
+
+    trace_thread_name("main");
+}
+
+bool trace_enabled(void)
+{
+    return enabled;
+}
+
+/* Name shown for the calling thread */
+void trace_thread_name(const char *name)
+{
+    struct trace_buffer *current;
+
+    if (enabled == false)
+        return;
+
+    current = local_buffer();
+    current->thread_name = arena_copy(current->strings, name,
+        strlen(name) + 1);
+}
+
+/* Complete event, detail is copied and may be NULL */
+void trace_event(const char *name, const char *detail, uint64_t start_ns,
+    uint64_t duration_ns)
+{
+    struct trace_buffer *current;
+    struct trace_event event;
+
+    if (enabled == false)
+        return;
+
+    current = local_buffer();
+
+    event.name = name;
+    event.detail = detail == NULL ? NULL
+        : arena_copy(current->strings, detail, strlen(detail) + 1);
+    event.start_ns = start_ns;
+    event.duration_ns = duration_ns;
+
+    vector_trace_event_push(&current->events, event);
+}
+
+/*
+  Write every buffer to the trace file and free them
+  Called at exit, other threads must not record events anymore
+*/
+void trace_write(void)
+{
+    struct trace_buffer *current;
+    FILE *fd;
+    bool first;
+    pid_t pid;
+
+    if (enabled == false)
+        return;
+
+    fd = fopen(output_name, "w");
+
+    if (fd == NULL)
+    {
+        fprintf(stderr, "Failed to open file '%s' for writing: %s\n",
+            output_name, strerror(errno));
+        return;
+    }
+
+    pid = getpid();
+    first = true;
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", fd);
+
+    current = atomic_load(&buffers);
+
+    while (current != NULL)
+    {
+        struct trace_buffer *next;
+
+        if (current->thread_name != NULL)
+        {
+            fprintf(fd, "%s{\"ph\":\"M\",\"name\":\"thread_name\","
+                "\"pid\":%d,\"tid\":%u,\"args\":{\"name\":",
+                first ? "" : ",\n", (int) pid, current->tid);
+            write_string(fd, current->thread_name);
+            fputs("}}", fd);
+            first = false;
+        }
+
+        for (size_t i = 0; i != current->events.count; ++i)
+        {
+            struct trace_event *event;
+
+            event = &current->events.data[i];
+
+            /* Trace timestamps are in microseconds since trace_enable */
+            fprintf(fd, "%s{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,"
+                "\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                first ? "" : ",\n", event->name, (int) pid, current->tid,
+                (event->start_ns - start_ns) / 1e3,
+                event->duration_ns / 1e3);
+
+            if (event->detail != NULL)
+            {
+                fputs(",\"args\":{\"file\":", fd);
+                write_string(fd, event->detail);
+                fputs("}", fd);
+            }
+
+            fputs("}", fd);
+            first = false;
+        }
+
+        next = current->next;
+
+        vector_trace_event_fini(&current->events);
+        arena_destroy(current->strings);
+        mem_free(MEM_OTHER, current);
+
+        current = next;
+    }
+
+    fputs("\n]}\n", fd);
+
+    if (fclose(fd) != 0)
+        fprintf(stderr, "Failed to write file '%s': %s\n",
+            output_name, strerror(errno));
+
+    atomic_store(&buffers, NULL);
+    buffer = NULL;
+}
+
+/* Buffer of the calling thread, registered on first use */
+static struct trace_buffer *local_buffer(void)
+{
+    struct trace_buffer *head;
+
+    if (buffer != NULL)
+        return buffer;
+
+    buffer = mem_alloc(MEM_OTHER, sizeof(struct trace_buffer));
+
+    vector_trace_event_init(&buffer->events, MEM_OTHER);
+    buffer->strings = arena_create(MEM_OTHER, 4096, 0);
+    buffer->thread_name = NULL;
+    buffer->tid = atomic_fetch_add(&next_tid, 1) + 1;
+
+    /* Push on the list, retry if another thread pushed in the meantime */
+    head = atomic_load(&buffers);
+
+    do
+        buffer->next = head;
+    while (!atomic_compare_exchange_weak(&buffers, &head, buffer));
+
+    return buffer;
+}
+
+/* JSON string literal, file names may contain anything */
+static void write_string(FILE *fd, const char *string)
+{
+    fputc('"', fd);
+
+    for (const char *c = string; *c != '\0'; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+            fprintf(fd, "\\%c", *c);
+        else if ((unsigned char) *c < 0x20)
+            fprintf(fd, "\\u%04x", (unsigned char) *c);
+        else
+            fputc(*c, fd);
+    }
+
+    fputc('"', fd);
+}
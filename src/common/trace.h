@@ -0,0 +1,22 @@
+#ifndef _COMMON_TRACE_H_
+#define _COMMON_TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+  Chrome trace event output, enabled by --trace=FILE
+  Open the file in Perfetto UI or chrome://tracing
+  Every thread records events into a buffer of its own, buffers are
+  registered once in a lock-free list and written out by trace_write
+  Recording an event takes no locks and makes no system calls
+  Events are normally recorded through timer spans, see common/timer.h
+*/
+void trace_enable(const char *file_name);
+bool trace_enabled(void);
+void trace_thread_name(const char *name);
+void trace_event(const char *name, const char *detail, uint64_t start_ns,
+    uint64_t duration_ns);
+void trace_write(void);
+
+#endif
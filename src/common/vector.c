@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "guard.h"
+#include "memory.h"
+
+#include "vector.h"
+
+/* Capacity of a vector after its first push */
+#define VECTOR_MINIMAL_CAPACITY 8
+
+
+/*
+  Shared by all vector types, see VECTOR in vector.h
+  Capacity is at least doubled, that is what makes pushes amortized O(1)
+*/
+void vector_grow(enum mem_subsystem subsystem, void **data, size_t *capacity,
+    size_t element_size, size_t needed)
+{
+    size_t new_capacity;
+    void *new_data;
+
+    new_capacity = *capacity * 2;
+
+    if (new_capacity < VECTOR_MINIMAL_CAPACITY)
+        new_capacity = VECTOR_MINIMAL_CAPACITY;
+
+    if (new_capacity < needed)
+        new_capacity = needed;
+
+    /* Multiplication below mustn't overflow */
+    if (new_capacity > SIZE_MAX / element_size)
+        new_data = NULL;
+    else
+        new_data = mem_realloc(subsystem, *data, new_capacity * element_size);
+
+    GUARD(new_data)
+
+    *data = new_data;
+    *capacity = new_capacity;
+}
+
+/* Make capacity equal to count, free everything if vector is empty */
+void vector_shrink(enum mem_subsystem subsystem, void **data,
+    size_t *capacity, size_t element_size, size_t count)
+{
+    void *new_data;
+
+    if (count == *capacity)
+        return;
+
+    /*
+      realloc with zero size may or may not return NULL
+      Don't rely on either behaviour
+    */
+    if (count == 0)
+    {
+        mem_free(subsystem, *data);
+        *data = NULL;
+        *capacity = 0;
+        return;
+    }
+
+    new_data = mem_realloc(subsystem, *data, count * element_size);
+
+    *data = new_data;
+    *capacity = count;
+}
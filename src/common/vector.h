@@ -0,0 +1,113 @@
+#ifndef _COMMON_VECTOR_H_
+#define _COMMON_VECTOR_H_
+
+#include <stddef.h>
+#include <string.h>
+
+#include "memory.h"
+
+/*
+  Type-generic growable array
+  VECTOR(name, type) defines struct name and static inline functions
+  name_init, name_fini, name_reserve, name_push, name_push_many,
+  name_pop, name_pop_many, name_last and name_shrink
+  Instantiate every vector type once, in a header if it is shared
+
+  Capacity grows geometrically so n pushes cost O(n) in total
+  Popping never reallocates, call name_shrink to give memory back
+  Running out of memory is a fatal error, just like with GUARD
+  Memory is accounted to a subsystem given to name_init
+
+  Example:
+    VECTOR(vector_int, int)
+
+    struct vector_int v;
+    vector_int_init(&v, MEM_OTHER);
+    vector_int_push(&v, 42);
+    v.data[0] == 42, v.count == 1
+    vector_int_fini(&v);
+*/
+
+void vector_grow(enum mem_subsystem subsystem, void **data, size_t *capacity,
+    size_t element_size, size_t needed);
+void vector_shrink(enum mem_subsystem subsystem, void **data,
+    size_t *capacity, size_t element_size, size_t count);
+
+#define VECTOR(name, type)                                               \
+struct name                                                              \
+{                                                                        \
+    type *data;                                                          \
+    size_t count;                                                        \
+    size_t capacity;                                                     \
+    enum mem_subsystem subsystem;                                        \
+};                                                                       \
+                                                                         \
+static inline void name##_init(struct name *vector,                      \
+    enum mem_subsystem subsystem)                                        \
+{                                                                        \
+    vector->data = NULL;                                                 \
+    vector->count = 0;                                                   \
+    vector->capacity = 0;                                                \
+    vector->subsystem = subsystem;                                       \
+}                                                                        \
+                                                                         \
+static inline void name##_fini(struct name *vector)                      \
+{                                                                        \
+    mem_free(vector->subsystem, vector->data);                           \
+}                                                                        \
+                                                                         \
+static inline void name##_reserve(struct name *vector, size_t capacity)  \
+{                                                                        \
+    if (capacity > vector->capacity)                                     \
+        vector_grow(vector->subsystem, (void **) &vector->data,          \
+            &vector->capacity, sizeof(type), capacity);                  \
+}                                                                        \
+                                                                         \
+static inline void name##_push(struct name *vector, type value)          \
+{                                                                        \
+    if (vector->count == vector->capacity)                               \
+        vector_grow(vector->subsystem, (void **) &vector->data,          \
+            &vector->capacity, sizeof(type), vector->count + 1);         \
+                                                                         \
+    vector->data[vector->count] = value;                                 \
+    vector->count += 1;                                                  \
+}                                                                        \
+                                                                         \
+static inline void name##_push_many(struct name *vector,                 \
+    const type *values, size_t count)                                    \
+{                                                                        \
+    if (count == 0)                                                      \
+        return;                                                          \
+                                                                         \
+    name##_reserve(vector, vector->count + count);                       \
+    memcpy(&vector->data[vector->count], values, count * sizeof(type));  \
+    vector->count += count;                                              \
+}                                                                        \
+                                                                         \
+/* Vector mustn't be empty */                                            \
+static inline type name##_pop(struct name *vector)                       \
+{                                                                        \
+    vector->count -= 1;                                                  \
+                                                                         \
+    return vector->data[vector->count];                                  \
+}                                                                        \
+                                                                         \
+/* Vector must have at least count elements */                           \
+static inline void name##_pop_many(struct name *vector, size_t count)    \
+{                                                                        \
+    vector->count -= count;                                              \
+}                                                                        \
+                                                                         \
+/* Vector mustn't be empty */                                            \
+static inline type *name##_last(struct name *vector)                     \
+{                                                                        \
+    return &vector->data[vector->count - 1];                             \
+}                                                                        \
+                                                                         \
+static inline void name##_shrink(struct name *vector)                    \
+{                                                                        \
+    vector_shrink(vector->subsystem, (void **) &vector->data,            \
+        &vector->capacity, sizeof(type), vector->count);                 \
+}
+
+#endif
@@ -0,0 +1,214 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <convert/digits.h>
+
+#include "check_io.h"
+#include "memory.h"
+#include "timer.h"
+
+#include "writer.h"
+
+/* Initial capacity of a memory writer */
+#define WRITER_MEMORY_CAPACITY 4096
+
+static void make_space(struct writer *writer, size_t length);
+static bool write_all(int fd, struct iovec *parts, int count);
+
+
+struct writer *writer_create_fd(int fd, size_t capacity)
+{
+    struct writer *writer;
+
+    writer = mem_alloc(MEM_OUTPUT, sizeof(struct writer));
+
+    writer->capacity = capacity != 0 ? capacity : WRITER_DEFAULT_CAPACITY;
+    writer->buffer = mem_alloc(MEM_OUTPUT, writer->capacity);
+    writer->used = 0;
+    writer->fd = fd;
+
+    return writer;
+}
+
+struct writer *writer_create_memory(void)
+{
+    struct writer *writer;
+
+    writer = writer_create_fd(-1, WRITER_MEMORY_CAPACITY);
+
+    return writer;
+}
+
+/* Doesn't flush nor close fd, call writer_flush first */
+void writer_destroy(struct writer *writer)
+{
+    mem_free(MEM_OUTPUT, writer->buffer);
+    mem_free(MEM_OUTPUT, writer);
+}
+
+/*
+  Point a file writer at another file, pending output goes to the old one
+  Buffer is kept, writing many files one after another allocates once
+*/
+void writer_set_fd(struct writer *writer, int fd)
+{
+    writer_flush(writer);
+    writer->fd = fd;
+}
+
+void writer_flush(struct writer *writer)
+{
+    struct iovec part;
+
+    if (writer->fd == -1 || writer->used == 0)
+        return;
+
+    part.iov_base = writer->buffer;
+    part.iov_len = writer->used;
+
+    CHECK_IO_ERROR(write_all(writer->fd, &part, 1) == false)
+
+    writer->used = 0;
+}
+
+/* Forget buffered output, used to reuse memory writers */
+void writer_clear(struct writer *writer)
+{
+    writer->used = 0;
+}
+
+void writer_put_buffer(struct writer *writer, const char *buffer,
+    size_t length)
+{
+    /*
+      Copying a large buffer just to write it out later is a waste
+      Write pending output and the buffer in one writev call instead
+    */
+    if (writer->fd != -1 && length >= writer->capacity / 2)
+    {
+        struct iovec parts[2];
+
+        parts[0].iov_base = writer->buffer;
+        parts[0].iov_len = writer->used;
+        parts[1].iov_base = (char *) buffer;
+        parts[1].iov_len = length;
+
+        CHECK_IO_ERROR(write_all(writer->fd, parts, 2) == false)
+
+        writer->used = 0;
+        return;
+    }
+
+    make_space(writer, length);
+
+    memcpy(&writer->buffer[writer->used], buffer, length);
+    writer->used += length;
+}
+
+void writer_put_string(struct writer *writer, const char *string)
+{
+    writer_put_buffer(writer, string, strlen(string));
+}
+
+void writer_put_lstring(struct writer *writer, struct lstring *lstring)
+{
+    writer_put_buffer(writer, lstring->text, lstring->length);
+}
+
+/* Digits are formatted right in the buffer, see convert/digits.c */
+void writer_put_size(struct writer *writer, size_t size)
+{
+    size_t digits;
+
+    digits = size_digits(size);
+    make_space(writer, digits);
+
+    size_write_decimal(&writer->buffer[writer->used], size, digits);
+    writer->used += digits;
+}
+
+void writer_put_char(struct writer *writer, char c)
+{
+    make_space(writer, 1);
+
+    writer->buffer[writer->used] = c;
+    writer->used += 1;
+}
+
+/*
+  Make sure length bytes fit into the buffer
+  File writers flush, memory writers grow
+  length of a file writer's request is less than its capacity
+*/
+static void make_space(struct writer *writer, size_t length)
+{
+    size_t capacity;
+
+    if (writer->capacity - writer->used >= length)
+        return;
+
+    if (writer->fd != -1)
+    {
+        writer_flush(writer);
+        return;
+    }
+
+    capacity = writer->capacity * 2;
+
+    if (capacity < writer->used + length)
+        capacity = writer->used + length;
+
+    writer->buffer = mem_realloc(MEM_OUTPUT, writer->buffer, capacity);
+    writer->capacity = capacity;
+}
+
+/* Write every part, retry on short writes and interrupts */
+static bool write_all(int fd, struct iovec *parts, int count)
+{
+    struct timer_span span;
+
+    span = timer_start(TIMER_WRITE);
+
+    for (int i = 0; i != count; ++i)
+        timer_add_bytes(TIMER_WRITE, parts[i].iov_len);
+
+    while (count != 0)
+    {
+        ssize_t written;
+
+        written = writev(fd, parts, count);
+
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            timer_stop(&span);
+            return false;
+        }
+
+        /* Skip parts that were written completely */
+        while (count != 0 && (size_t) written >= parts->iov_len)
+        {
+            written -= parts->iov_len;
+            parts += 1;
+            count -= 1;
+        }
+
+        if (count != 0)
+        {
+            parts->iov_base = (char *) parts->iov_base + written;
+            parts->iov_len -= written;
+        }
+    }
+
+    timer_stop(&span);
+
+    return true;
+}
@@ -0,0 +1,45 @@
+#ifndef _COMMON_WRITER_H_
+#define _COMMON_WRITER_H_
+
+#include <stddef.h>
+
+#include "lstring.h"
+
+/* Size of the buffer of a file writer */
+#define WRITER_DEFAULT_CAPACITY (256 * 1024)
+
+/*
+  Buffered output
+  A file writer collects output in a large buffer and writes it
+  with one system call when the buffer fills up or on writer_flush
+  Buffers too large to be worth copying are written straight from
+  the caller's memory together with pending output (writev)
+  A memory writer (fd is -1) never writes anything, its buffer grows
+  I/O errors are fatal and checked once per flush
+*/
+struct writer
+{
+    char *buffer;
+    size_t used;
+    size_t capacity;
+    int fd;
+};
+
+/* Append a string literal without computing its length at run time */
+#define WRITER_PUT_LITERAL(writer, literal) \
+    writer_put_buffer(writer, literal, sizeof(literal) - 1)
+
+struct writer *writer_create_fd(int fd, size_t capacity);
+struct writer *writer_create_memory(void);
+void writer_destroy(struct writer *writer);
+void writer_set_fd(struct writer *writer, int fd);
+void writer_flush(struct writer *writer);
+void writer_clear(struct writer *writer);
+void writer_put_buffer(struct writer *writer, const char *buffer,
+    size_t length);
+void writer_put_string(struct writer *writer, const char *string);
+void writer_put_lstring(struct writer *writer, struct lstring *lstring);
+void writer_put_size(struct writer *writer, size_t size);
+void writer_put_char(struct writer *writer, char c);
+
+#endif
@@ -0,0 +1,103 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "digits.h"
+
+/*
+  Two decimal digits for every number from 0 to 99
+  Value n is at subscript 2 * n, this halves the number of divisions
+*/
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char hex_digits[] = "0123456789abcdef";
+
+
+size_t size_digits(size_t value)
+{
+    size_t digits;
+
+    /* Compare against four powers of ten per division */
+    digits = 1;
+
+    while (true)
+    {
+        if (value < 10) return digits;
+        if (value < 100) return digits + 1;
+        if (value < 1000) return digits + 2;
+        if (value < 10000) return digits + 3;
+
+        value /= 10000;
+        digits += 4;
+    }
+}
+
+size_t size_hex_digits(size_t value)
+{
+    size_t bits;
+
+    /* Zero is written as a single digit */
+    if (value == 0)
+        return 1;
+
+    bits = sizeof(unsigned long long) * CHAR_BIT - __builtin_clzll(value);
+
+    /* Every hex digit holds four bits, round up */
+    return (bits + 3) / 4;
+}
+
+/*
+  Digits are written from the last one to the first one
+  We know how many there are so we know where the last one goes,
+  there is no need to reverse anything afterwards
+*/
+void size_write_decimal(char *dest, size_t value, size_t digits)
+{
+    size_t position;
+
+    position = digits;
+
+    while (value >= 100)
+    {
+        size_t pair;
+
+        pair = (value % 100) * 2;
+        value /= 100;
+
+        position -= 2;
+        dest[position] = digit_pairs[pair];
+        dest[position + 1] = digit_pairs[pair + 1];
+    }
+
+    if (value >= 10)
+    {
+        position -= 2;
+        dest[position] = digit_pairs[value * 2];
+        dest[position + 1] = digit_pairs[value * 2 + 1];
+    }
+    else
+    {
+        position -= 1;
+        dest[position] = '0' + value;
+    }
+}
+
+void size_write_hex(char *dest, size_t value, size_t digits)
+{
+    while (digits != 0)
+    {
+        digits -= 1;
+        dest[digits] = hex_digits[value & 0xf];
+        value >>= 4;
+    }
+}
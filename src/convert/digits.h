@@ -0,0 +1,17 @@
+#ifndef _CONVERT_DIGITS_H_
+#define _CONVERT_DIGITS_H_
+
+#include <stddef.h>
+
+/*
+  These functions write digits straight into a caller's buffer
+  Call *_digits first, make sure there is that much space
+  and pass the result to a matching *_write function
+  Nothing is allocated and the output isn't null terminated
+*/
+size_t size_digits(size_t value);
+size_t size_hex_digits(size_t value);
+void size_write_decimal(char *dest, size_t value, size_t digits);
+void size_write_hex(char *dest, size_t value, size_t digits);
+
+#endif
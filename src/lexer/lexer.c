@@ -6,9 +6,11 @@
 #include <string.h>
 
 //#include <common/status.h>
+#include <common/arena.h>
 #include <common/exitcodes.h>
 #include <common/guard.h>
 #include <common/lstring.h>
+#include <common/memory.h>
 #include <common/messages.h>
 
 #include "macros.h"
@@ -16,44 +18,52 @@
 
 #include "lexer.h"
 
-#define LEXME_ALLOCATION_STEP 64
-
-/* We add one because we want to make space for terminating null byte */
+/*
+  Lexme is built directly in lunit it will be returned in
+  Text is stored in lunit->lexme, see lexme_append
+  arena is NULL if lunit is allocated with malloc
+*/
 struct lexme_info
 {
-    size_t line;
-    size_t column;
-    size_t index;
-    size_t allocated_space;
-    char *text;
+    struct lunit *lunit;
+    struct arena *arena;
 };
 
 struct lunit *lunit_get(struct sources *sources);
+struct lunit *lunit_get_arena(struct sources *sources, struct arena *arena);
 void lunit_destroy(struct lunit *lunit);
 static struct lunit *lunit_create(struct lexme_info *lexme_info,
     enum token token);
-static void lexme_append(struct lexme_info *lexme_info, char c);
+static struct lunit *lunit_allocate(struct sources *sources,
+    struct arena *arena);
+static inline void lexme_append(struct lexme_info *lexme_info, char c);
 static void skip_whitespace_and_comments(struct sources *sources);
 static inline bool test_char_ident_i(char c);
 static inline bool test_char_ident_f(char c);
+static inline bool test_char_digit(char c);
 static inline bool test_char_whitespace(char c);
 
 
 struct lunit *lunit_get(struct sources *sources)
+{
+    return lunit_get_arena(sources, NULL);
+}
+
+/*
+  Same as lunit_get but lunit is allocated in arena
+  Such lunit is freed together with the arena, don't lunit_destroy it
+  and don't append to its lexme
+*/
+struct lunit *lunit_get_arena(struct sources *sources, struct arena *arena)
 {
     struct lexme_info lexme_info;
     char c;
-    
-    lexme_info.index = 0;
-    lexme_info.allocated_space = 0;
-    /* We are going to call realloc not malloc, see lexme_append */ 
-    lexme_info.text = NULL;
 
     skip_whitespace_and_comments(sources);
 
-    /* Save location of the lexme */
-    lexme_info.line = source_line(sources);
-    lexme_info.column = source_column(sources);
+    /* Saves location of the lexme too */
+    lexme_info.arena = arena;
+    lexme_info.lunit = lunit_allocate(sources, arena);
 
     c = source_get(sources);
 
@@ -67,6 +77,9 @@ struct lunit *lunit_get(struct sources *sources)
 
         goto ident;
     }
+
+    if (test_char_digit(c))
+        goto integer;
     
     if (c == '\t')
     {
@@ -129,67 +142,86 @@ ident:
         goto ident;
     else
         return lunit_create(&lexme_info, TOK_IDENTIFIER);
+
+integer:
+    /* Value is left to the parser, lexme keeps every digit */
+    lexme_append(&lexme_info, c);
+    source_next(sources);
+
+    c = source_get(sources);
+
+    if (test_char_digit(c))
+        goto integer;
+    else
+        return lunit_create(&lexme_info, TOK_INTEGER);
 }
 
-void lexme_append(struct lexme_info *lexme_info, char c)
+static inline void lexme_append(struct lexme_info *lexme_info, char c)
 {
-    char *new_text;
     /*
-      Check if there is space to accomodate new character
-      We reallocate space every LEXME_ALLOCATION_STEP chars
+      lstring grows geometrically and keeps short lexmes inline
+      so there is no allocation for most of the characters
     */
-    if (lexme_info->index == lexme_info->allocated_space)
-    {
-        size_t new_size;
-
-        new_size = lexme_info->allocated_space + LEXME_ALLOCATION_STEP;
-        new_text = realloc(lexme_info->text, new_size);
+    lstring_append_char(&lexme_info->lunit->lexme, c);
+}
 
-        GUARD(new_text)
+/* Allocate lunit at current position, lexme is appended to it later on */
+static struct lunit *lunit_allocate(struct sources *sources,
+    struct arena *arena)
+{
+    struct lunit *lunit;
 
-        lexme_info->allocated_space = new_size;
-        lexme_info->text = new_text;
+    if (arena != NULL)
+    {
+        lunit = arena_alloc(arena, sizeof(struct lunit));
+    }
+    else
+    {
+        lunit = mem_alloc(MEM_LEXER, sizeof(struct lunit));
     }
 
-    lexme_info->text[lexme_info->index] = c;
-    lexme_info->index += 1;
+    lunit->next = NULL;
+    lunit->line = source_line(sources);
+    lunit->column = source_column(sources);
+    lstring_init(&lunit->lexme);
+
+    return lunit;
 }
 
+/*
+  Lexme is complete, set its token and hand lunit over
+  It is called create because for the caller lunit comes into existence here
+*/
 static struct lunit *lunit_create(struct lexme_info *lexme_info,
     enum token token)
 {
-    struct lunit *lunit;
-
-    lunit = malloc(sizeof(struct lunit));
+    struct lstring *lexme;
 
-    GUARD(lunit)
+    lexme = &lexme_info->lunit->lexme;
+    lexme_info->lunit->token = token;
 
-    lunit->next = NULL;
-    lunit->token = token;
-    lunit->line = lexme_info->line;
-    lunit->column = lexme_info->column;
     /*
-      Yup, we don't copy it with strncpy
-      This way is way simpler, we don't have to free lexme_info->text
-      In lunit_get we can just return lunit_create(...)
-      Otherwise we would have to assign return value to some variable
-      then free lexme_info->text and then return that variable
-      We reallocate memory because we don't want to waste space
-      Size of lexme_info->text is multiple of LEXME_ALLOCATION_STEP
-      Most likely there are unused bytes there... realloc it
+      Long lexme outgrew inline storage and lives on the heap
+      Move it into the arena so that releasing the arena frees everything
     */
-    lunit->lexme = lstring_create();
-    lunit->lexme->text = realloc(lexme_info->text, lexme_info->index);
-    lunit->lexme->length = lexme_info->index;
+    if (lexme_info->arena != NULL && lexme->text != lexme->inline_text)
+    {
+        char *text;
 
-    return lunit;
+        text = arena_copy(lexme_info->arena, lexme->text, lexme->length);
+        mem_free(MEM_LSTRING, lexme->text);
+
+        lexme->text = text;
+        lexme->capacity = lexme->length;
+    }
+
+    return lexme_info->lunit;
 }
 
 void lunit_destroy(struct lunit *lunit)
 {
-    /* TODO Perhaps we don't have to free lexme but just pass the pointer? */
-    lstring_destroy(lunit->lexme);
-    free(lunit);
+    lstring_fini(&lunit->lexme);
+    mem_free(MEM_LEXER, lunit);
 }
 
 /* TODO skip comments */
@@ -230,11 +262,17 @@ static inline bool test_char_ident_i(char c)
 static inline bool test_char_ident_f(char c)
 {
     if (test_char_ident_i(c)) return true;
-    if (c >= '0' && c <= '9') return true;
+    if (test_char_digit(c)) return true;
 
     return false;
 }
 
+/* Check if char is a decimal digit */
+static inline bool test_char_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
 /* Name is self-explanatory */
 static inline bool test_char_whitespace(char c)
 {
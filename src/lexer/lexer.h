@@ -3,12 +3,15 @@
 
 #include <inttypes.h>
 
+#include <common/arena.h>
+
 #include "lunit.h"
 #include "source.h"
 
 
 
 struct lunit *lunit_get(struct sources *sources);
+struct lunit *lunit_get_arena(struct sources *sources, struct arena *arena);
 void lunit_destroy(struct lunit *lunit);
 
 #endif
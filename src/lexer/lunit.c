@@ -0,0 +1,34 @@
+#include <stddef.h>
+
+#include "lunit.h"
+
+struct token_name_info
+{
+    const char *text;
+    size_t length;
+};
+
+#define NAME(tok) [tok] = { #tok, sizeof(#tok) - 1 },
+
+/* Lengths are known at compile time, printers don't have to strlen */
+static const struct token_name_info token_names[] =
+{
+    NAME(TOK_PROCEDURE)
+    NAME(TOK_RETURN)
+    NAME(TOK_IDENTIFIER)
+    NAME(TOK_INTEGER)
+    NAME(TOK_TAB)
+    NAME(TOK_EOL)
+    NAME(TOK_EOF)
+    NAME(TOK_UNKNOWN)
+};
+
+
+/* Name of the enum constant, e.g. "TOK_EOF", length is optional */
+const char *token_name(enum token token, size_t *length)
+{
+    if (length != NULL)
+        *length = token_names[token].length;
+
+    return token_names[token].text;
+}
@@ -64,14 +64,19 @@ enum token
     TOK_UNKNOWN
 };
 
-/* next field is set to NULL by lexer; it is used by parser */
+/*
+  next field is set to NULL by lexer; it is used by parser
+  lexme is embedded so that short lexmes need no allocation of their own
+*/
 struct lunit
 {
     struct lunit *next;
-    struct lstring *lexme;
+    struct lstring lexme;
     size_t line;
     size_t column;
     enum token token;
 };
 
+const char *token_name(enum token token, size_t *length);
+
 #endif
@@ -8,8 +8,11 @@
 
 #include <common/check_io.h>
 #include <common/exitcodes.h>
-#include <common/guard.h>
+#include <common/fatal.h>
+#include <common/memory.h>
 #include <common/messages.h>
+#include <common/timer.h>
+#include <common/vector.h>
 
 #include "source.h"
 
@@ -29,10 +32,12 @@ struct source_info
     char buffer[SOURCE_BUFFER_SIZE];
 };
 
+VECTOR(vector_source, struct source_info *)
+
+/* Stack of sources, current one is on top (last) */
 struct sources
 {
-    struct source_info **array;
-    size_t count;
+    struct vector_source stack;
 };
 
 
@@ -43,51 +48,39 @@ struct sources *source_create_struct(void)
 {
     struct sources *sources;
 
-    sources = malloc(sizeof(struct sources));
-
-    GUARD(sources)
+    sources = mem_alloc(MEM_SOURCE, sizeof(struct sources));
 
-    sources->array = NULL;
-    sources->count = 0;
+    vector_source_init(&sources->stack, MEM_SOURCE);
 
     return sources;
 }
 
+/* Sources still on the stack, e.g. after a failed push, are freed too */
+void source_destroy_struct(struct sources *sources)
+{
+    while (sources->stack.count != 0)
+        mem_free(MEM_SOURCE, vector_source_pop(&sources->stack));
+
+    vector_source_fini(&sources->stack);
+    mem_free(MEM_SOURCE, sources);
+}
+
 void source_push(struct sources *sources, FILE *fd)
 {
-    size_t new_size;
     struct source_info *new_source;
-    struct source_info **new_array;
 
     /* Allocate and initialize new_source */
     new_source = source_create_info(fd);
 
     /*
-      We want to push new_source onto the source "stack"
-      To do this we need to allocate space first
-      When sources->array is NULL realloc works like malloc
-    */
-    new_size = (sources->count + 1) * sizeof(struct source_info *);
-    new_array = realloc(sources->array, new_size);
-
-    GUARD(new_array)
-
-    sources->array = new_array;
-
-
-    /*
-      Push new_source onto the stack
+      Push new_source onto the source stack
       This operation can be reverted with source_pop()
-      Array size used as its subscript points one element after the last one
+      Stack grows geometrically, it doesn't reallocate on every push
     */
-    sources->array[sources->count] = new_source;
-
-    /* Increment number of elements on the stack */
-    sources->count += 1;
-
+    vector_source_push(&sources->stack, new_source);
 
     /*
-      Now that sources->current points to newly created source
+      Now that new source is on top of the stack
       we can initialize buffer and buffer_index members of current source
     */
     load(sources);
@@ -95,71 +88,27 @@ void source_push(struct sources *sources, FILE *fd)
 
 void source_pop(struct sources *sources)
 {
-    size_t new_size;
-    struct source_info **new_array;
-
-
     /*
       Check whether stack is empty
       it is an error to pop element out of an empty stack
-      When structure of type 'sources' is initialized
-      member 'current' is initialized to NULL
+      When structure of type 'sources' is initialized stack is empty
       in order to prevent lexer from reading from source that doesn't exist
       See source_create_struct() in this file
     */
-    if (sources->count == 0)
+    if (sources->stack.count == 0)
     {
-        fprintf(stderr, "Attempted to pop source but stack is empty\n");
-        exit(EXITCODE_INTERNAL_ERROR);
+        fatal(EXITCODE_INTERNAL_ERROR,
+            "Attempted to pop source but stack is empty");
     }
 
-    /*
-      Array's size used as its subscript points one element past the last one
-      We want to free last element hence we substract one
-    */
-    free(sources->array[sources->count - 1]);
-
-    /* There is one element less on the stack */
-    sources->count -= 1;
+    mem_free(MEM_SOURCE, vector_source_pop(&sources->stack));
 
     /*
-      In realloc's man page I found this:
-      If size was equal to 0, either NULL or a pointer
-      suitable to be passed to free is returned
-
-      What happens when we pass this non-NULL pointer to realloc?
-      I don't know and this is why I wrote this if-else statement
-      I just want to be sure
-      -- Mapniv
+      Popping doesn't reallocate the stack
+      When the last source is gone there is nothing to keep though
     */
-    if (sources->count == 0)
-    {
-        free(sources->array);
-        /*
-          Very important, we don't want to pass invalid pointer to realloc
-          We are unlikely tp push another element after popping the last one
-          I want to be sure nothing goes wrong though
-        */
-        sources->array = NULL;
-    }
-    else
-    {
-        /*
-          Resize the stack
-
-          Is it neccessary? We are decreasing size of the stack
-          We aren't requesting more memory, what can go wrong there?
-          I don't know and that's why I'm checking whether reallocation failed
-          -- Mapniv
-        */
-        new_size = sources->count * sizeof(struct source_info *);
-        new_array = realloc(sources->array, new_size);
-
-        GUARD(new_array)
-
-        sources->array = new_array;
-        /* We already decremented sources->count */
-    }
+    if (sources->stack.count == 0)
+        vector_source_shrink(&sources->stack);
 }
 
 
@@ -168,9 +117,7 @@ static struct source_info *source_create_info(FILE *fd)
     struct source_info *new_source;
 
     /* Try to allocate new source */
-    new_source = malloc(sizeof(struct source_info));
-
-    GUARD(new_source)
+    new_source = mem_alloc(MEM_SOURCE, sizeof(struct source_info));
 
     /*
       Initialize members of the struct
@@ -190,11 +137,8 @@ char source_get(struct sources *sources)
 {
     struct source_info *current;
 
-    /*
-      Array's size used as its subscript points one element past the last one
-      and we want to access the last one, this is why we substract one
-    */
-    current = sources->array[sources->count - 1];
+    /* Current source is on top of the stack */
+    current = *vector_source_last(&sources->stack);
 
     return current->buffer[current->buffer_index];
 }
@@ -204,11 +148,8 @@ void source_next(struct sources *sources)
     struct source_info *current;
     bool previous_char_was_newline = false;
 
-    /* Get current (last) source
-      Array's size used as its subscript points one element past the last one
-      and we want to access the last one, this is why we substract one
-    */
-    current = sources->array[sources->count - 1];
+    /* Current source is on top of the stack */
+    current = *vector_source_last(&sources->stack);
 
     /*
       Check if current char is a EOL, if so set a flag
@@ -248,8 +189,7 @@ void source_next(struct sources *sources)
     {
         if (current->line == SIZE_MAX)
         {
-            fputs("File too big", stderr);
-            exit(EXITCODE_INTERNAL_ERROR);
+            fatal(EXITCODE_INTERNAL_ERROR, "File too big");
         }
         current->line += 1;
         current->column = 1;
@@ -258,8 +198,7 @@ void source_next(struct sources *sources)
     {
         if (current->column == SIZE_MAX)
         {
-            fputs("Line too long", stderr);
-            exit(EXITCODE_INTERNAL_ERROR);
+            fatal(EXITCODE_INTERNAL_ERROR, "Line too long");
         }
         current->column += 1;
     }
@@ -268,12 +207,8 @@ void source_next(struct sources *sources)
 size_t source_line(struct sources *sources)
 {
     struct source_info *current;
-    /*
-      Get current source
-      Array's size used as its subscript points one element past the last one
-      and we want to access the last one, this is why we substract one
-    */
-    current = sources->array[sources->count - 1];
+    /* Current source is on top of the stack */
+    current = *vector_source_last(&sources->stack);
 
     return current->line;
 }
@@ -281,12 +216,8 @@ size_t source_line(struct sources *sources)
 size_t source_column(struct sources *sources)
 {
     struct source_info *current;
-    /*
-      Get current source
-      Array's size used as its subscript points one element past the last one
-      and we want to access the last one, this is why we substract one
-    */
-    current = sources->array[sources->count - 1];
+    /* Current source is on top of the stack */
+    current = *vector_source_last(&sources->stack);
 
     return current->column;
 }
@@ -296,13 +227,10 @@ void load(struct sources *sources)
 {
     struct source_info *current;
     uint16_t chars_read;
+    struct timer_span span;
  
-    /*
-      Get current source
-      Array's size used as its subscript points one element past the last one
-      and we want to access the last one, this is why we substract one
-    */
-    current = sources->array[sources->count - 1];
+    /* Current source is on top of the stack */
+    current = *vector_source_last(&sources->stack);
 
     chars_read = 0;
 
@@ -311,13 +239,19 @@ void load(struct sources *sources)
       Fread returns number of chunks read, and we want to know how many
       chars we just read, setting chunk size to one solves the problem
     */
+    span = timer_start(TIMER_LOAD);
     chars_read = fread(current->buffer, 1, SOURCE_BUFFER_SIZE, current->fd);
+    timer_stop(&span);
+
+    /* Lexer sees every byte that was loaded */
+    timer_add_bytes(TIMER_LOAD, chars_read);
+    timer_add_bytes(TIMER_LEX, chars_read);
 
     /* We read less characters than we asked for, EOF or error */
     if (chars_read < SOURCE_BUFFER_SIZE)
     {
-        /* Positive errno indicates error */
-        CHECK_IO_ERROR(errno > 0)
+        /* errno may be stale, ask the stream whether the read failed */
+        CHECK_IO_ERROR(ferror(current->fd))
 
         current->buffer[chars_read] = '\0';
     }
@@ -6,6 +6,7 @@
 struct sources;
 
 struct sources *source_create_struct(void);
+void source_destroy_struct(struct sources *sources);
 void source_push(struct sources *sources, FILE *fd);
 void source_pop(struct sources *sources);
 char source_get(struct sources *sources);
@@ -0,0 +1,236 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <common/exitcodes.h>
+#include <common/fatal.h>
+#include <common/intern.h>
+#include <common/memory.h>
+#include <common/writer.h>
+
+#include "lunit.h"
+
+#include "tokfile.h"
+
+static uint32_t narrow(size_t value, const char *what);
+static void invalid(const char *file_name, const char *reason);
+
+
+struct tokfile_builder *tokfile_builder_create(void)
+{
+    struct tokfile_builder *builder;
+
+    builder = mem_alloc(MEM_OUTPUT, sizeof(struct tokfile_builder));
+
+    vector_tokfile_token_init(&builder->tokens, MEM_OUTPUT);
+    builder->pool = intern_create(MEM_OUTPUT);
+
+    return builder;
+}
+
+void tokfile_builder_destroy(struct tokfile_builder *builder)
+{
+    vector_tokfile_token_fini(&builder->tokens);
+    intern_destroy(builder->pool);
+    mem_free(MEM_OUTPUT, builder);
+}
+
+/* Forget all tokens but keep memory for the next file */
+void tokfile_builder_clear(struct tokfile_builder *builder)
+{
+    builder->tokens.count = 0;
+    intern_clear(builder->pool);
+}
+
+/* lunit is copied, caller may release it right away */
+void tokfile_builder_add(struct tokfile_builder *builder,
+    struct lunit *lunit)
+{
+    struct tokfile_token token;
+    size_t id;
+
+    id = intern_add(builder->pool, lunit->lexme.text, lunit->lexme.length);
+
+    token.offset = builder->pool->entries.data[id].offset;
+    token.length = narrow(lunit->lexme.length, "Lexme");
+    token.kind = lunit->token;
+    token.line = narrow(lunit->line, "Line number");
+    token.column = narrow(lunit->column, "Column number");
+
+    vector_tokfile_token_push(&builder->tokens, token);
+}
+
+void tokfile_builder_write(struct tokfile_builder *builder,
+    struct writer *out)
+{
+    struct tokfile_header header;
+
+    /* Padding must not leak stack contents into the file */
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TOKFILE_MAGIC, TOKFILE_MAGIC_LENGTH);
+    header.version = TOKFILE_VERSION;
+    header.byte_order = TOKFILE_BYTE_ORDER;
+    header.token_size = sizeof(struct tokfile_token);
+    header.token_count = builder->tokens.count;
+    header.pool_size = builder->pool->pool.count;
+
+    writer_put_buffer(out, (const char *) &header, sizeof(header));
+    writer_put_buffer(out, (const char *) builder->tokens.data,
+        builder->tokens.count * sizeof(struct tokfile_token));
+    writer_put_buffer(out, builder->pool->pool.data,
+        builder->pool->pool.count);
+}
+
+/* True if file starts with TOKFILE_MAGIC, errors are left to the caller */
+bool tokfile_detect(const char *file_name)
+{
+    char magic[TOKFILE_MAGIC_LENGTH];
+    ssize_t got;
+    int fd;
+
+    fd = open(file_name, O_RDONLY);
+
+    if (fd == -1)
+        return false;
+
+    got = read(fd, magic, TOKFILE_MAGIC_LENGTH);
+    close(fd);
+
+    return got == TOKFILE_MAGIC_LENGTH
+        && memcmp(magic, TOKFILE_MAGIC, TOKFILE_MAGIC_LENGTH) == 0;
+}
+
+/*
+  Map the whole file read only and validate it
+  Every offset is checked here once so that readers don't have to
+*/
+struct tokfile *tokfile_open(const char *file_name)
+{
+    struct tokfile *tokfile;
+    const struct tokfile_header *header;
+    struct stat info;
+    uint64_t tokens_size;
+    void *map;
+    int fd;
+
+    fd = open(file_name, O_RDONLY);
+
+    if (fd == -1 || fstat(fd, &info) == -1)
+    {
+        fatal(EXITCODE_INTERNAL_ERROR,
+            "Failed to open file '%s' for reading: %s",
+            file_name, strerror(errno));
+    }
+
+    if ((size_t) info.st_size < sizeof(struct tokfile_header))
+        invalid(file_name, "truncated header");
+
+    map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        fatal(EXITCODE_INTERNAL_ERROR, "Failed to map file '%s': %s",
+            file_name, strerror(errno));
+    }
+
+    header = map;
+
+    if (memcmp(header->magic, TOKFILE_MAGIC, TOKFILE_MAGIC_LENGTH) != 0)
+        invalid(file_name, "bad magic");
+
+    if (header->byte_order != TOKFILE_BYTE_ORDER)
+        invalid(file_name, "written on a machine of different byte order");
+
+    if (header->version != TOKFILE_VERSION
+        || header->token_size != sizeof(struct tokfile_token))
+        invalid(file_name, "unsupported version");
+
+    /* Written this way so that huge counts can't overflow */
+    if (header->token_count > (info.st_size - sizeof(struct tokfile_header))
+        / sizeof(struct tokfile_token))
+        invalid(file_name, "truncated token table");
+
+    tokens_size = header->token_count * sizeof(struct tokfile_token);
+
+    if (header->pool_size != info.st_size - sizeof(struct tokfile_header)
+        - tokens_size)
+        invalid(file_name, "pool size mismatch");
+
+    tokfile = mem_alloc(MEM_SOURCE, sizeof(struct tokfile));
+
+    tokfile->map = map;
+    tokfile->map_size = info.st_size;
+    tokfile->header = header;
+    tokfile->tokens = (const struct tokfile_token *) (header + 1);
+    tokfile->pool = (const char *) (tokfile->tokens + header->token_count);
+
+    for (size_t i = 0; i != header->token_count; ++i)
+    {
+        const struct tokfile_token *token;
+
+        token = &tokfile->tokens[i];
+
+        if (token->kind > TOK_UNKNOWN || token->offset > header->pool_size
+            || token->length > header->pool_size - token->offset)
+            invalid(file_name, "token out of range");
+    }
+
+    return tokfile;
+}
+
+void tokfile_close(struct tokfile *tokfile)
+{
+    munmap(tokfile->map, tokfile->map_size);
+    mem_free(MEM_SOURCE, tokfile);
+}
+
+size_t tokfile_count(struct tokfile *tokfile)
+{
+    return tokfile->header->token_count;
+}
+
+/*
+  Fill lunit with token at index without copying the lexme
+  lexme points into the read only mapping, it mustn't be modified,
+  finalized or used after tokfile_close
+*/
+void tokfile_lunit(struct tokfile *tokfile, size_t index,
+    struct lunit *lunit)
+{
+    const struct tokfile_token *token;
+
+    token = &tokfile->tokens[index];
+
+    lunit->next = NULL;
+    lunit->lexme.text = (char *) &tokfile->pool[token->offset];
+    lunit->lexme.length = token->length;
+    lunit->lexme.capacity = token->length;
+    lunit->line = token->line;
+    lunit->column = token->column;
+    lunit->token = token->kind;
+}
+
+static uint32_t narrow(size_t value, const char *what)
+{
+    if (value > UINT32_MAX)
+    {
+        fatal(EXITCODE_INPUT_ERROR, "%s too large for binary format", what);
+    }
+
+    return value;
+}
+
+static void invalid(const char *file_name, const char *reason)
+{
+    fatal(EXITCODE_INPUT_ERROR, "File '%s' isn't a valid token file: %s",
+        file_name, reason);
+}
@@ -0,0 +1,86 @@
+#ifndef _LEXER_TOKFILE_H_
+#define _LEXER_TOKFILE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <common/intern.h>
+#include <common/vector.h>
+#include <common/writer.h>
+
+#include "lunit.h"
+
+/*
+  Binary token file, written by 'dump lunits --format=binary'
+  Layout:
+    struct tokfile_header
+    token_count times struct tokfile_token
+    pool_size bytes of lexmes, every distinct lexme is stored once
+  All integers are in the byte order of the machine that wrote the file
+  byte_order lets readers reject files written on another one
+  Tokens start right after the header and both are 8 byte aligned,
+  a reader can mmap the file and index tokens directly
+  Bump TOKFILE_VERSION whenever layout or enum token changes
+*/
+/* Starts with a byte no source file does, like ELF */
+#define TOKFILE_MAGIC "\177MKT"
+#define TOKFILE_MAGIC_LENGTH 4
+#define TOKFILE_VERSION 1
+#define TOKFILE_BYTE_ORDER 0x01020304
+
+struct tokfile_header
+{
+    char magic[TOKFILE_MAGIC_LENGTH];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t token_size;
+    uint64_t token_count;
+    uint64_t pool_size;
+};
+
+/* kind is enum token, offset is relative to the start of the pool */
+struct tokfile_token
+{
+    uint64_t offset;
+    uint32_t length;
+    uint32_t kind;
+    uint32_t line;
+    uint32_t column;
+};
+
+VECTOR(vector_tokfile_token, struct tokfile_token)
+
+/* Collects tokens in memory, the header needs their count up front */
+struct tokfile_builder
+{
+    struct vector_tokfile_token tokens;
+    struct intern *pool;
+};
+
+/* File opened for reading, tokens and pool point into the mapping */
+struct tokfile
+{
+    void *map;
+    size_t map_size;
+    const struct tokfile_header *header;
+    const struct tokfile_token *tokens;
+    const char *pool;
+};
+
+struct tokfile_builder *tokfile_builder_create(void);
+void tokfile_builder_destroy(struct tokfile_builder *builder);
+void tokfile_builder_clear(struct tokfile_builder *builder);
+void tokfile_builder_add(struct tokfile_builder *builder,
+    struct lunit *lunit);
+void tokfile_builder_write(struct tokfile_builder *builder,
+    struct writer *out);
+
+bool tokfile_detect(const char *file_name);
+struct tokfile *tokfile_open(const char *file_name);
+void tokfile_close(struct tokfile *tokfile);
+size_t tokfile_count(struct tokfile *tokfile);
+void tokfile_lunit(struct tokfile *tokfile, size_t index,
+    struct lunit *lunit);
+
+#endif
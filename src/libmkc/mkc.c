@@ -0,0 +1,228 @@
+#include <errno.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <common/arena.h>
+#include <common/fatal.h>
+#include <common/memory.h>
+#include <common/status.h>
+#include <lexer/lexer.h>
+#include <lexer/lunit.h>
+#include <lexer/source.h>
+
+#include "mkc.h"
+
+/* Defined by the build from the project version */
+#ifndef MKC_VERSION_STRING
+#define MKC_VERSION_STRING "unknown"
+#endif
+
+_Static_assert((int) MKC_OK == (int) OK, "mkc_status doesn't match status");
+_Static_assert((int) MKC_FAILURE == (int) FAILURE,
+    "mkc_status doesn't match status");
+_Static_assert((int) MKC_TOKEN_PROCEDURE == (int) TOK_PROCEDURE
+    && (int) MKC_TOKEN_RETURN == (int) TOK_RETURN
+    && (int) MKC_TOKEN_IDENTIFIER == (int) TOK_IDENTIFIER
+    && (int) MKC_TOKEN_INTEGER == (int) TOK_INTEGER
+    && (int) MKC_TOKEN_TAB == (int) TOK_TAB
+    && (int) MKC_TOKEN_EOL == (int) TOK_EOL
+    && (int) MKC_TOKEN_EOF == (int) TOK_EOF
+    && (int) MKC_TOKEN_UNKNOWN == (int) TOK_UNKNOWN,
+    "mkc_token_kind doesn't match token");
+
+/*
+  Lunits live in arena, everything after mark is released by the next
+  call so that memory doesn't grow with the length of the input
+  After a fatal error the state of sources is unknown, failed makes
+  every following call fail with the same message
+*/
+struct mkc_lexer
+{
+    FILE *fd;
+    struct sources *sources;
+    struct arena *arena;
+    struct arena_mark mark;
+    bool failed;
+    char error[FATAL_MESSAGE_SIZE];
+};
+
+static enum status lexer_open(FILE *fd, struct mkc_lexer **lexer);
+static void set_error(const char *message);
+
+/* Message of the last failure of the calling thread */
+static _Thread_local char last_error[FATAL_MESSAGE_SIZE];
+
+
+MKC_API enum mkc_status mkc_lexer_open_file(const char *file_name,
+    struct mkc_lexer **lexer)
+{
+    FILE *fd;
+
+    fd = fopen(file_name, "r");
+
+    if (fd == NULL)
+    {
+        snprintf(last_error, sizeof(last_error),
+            "Failed to open file '%s' for reading: %s",
+            file_name, strerror(errno));
+        return MKC_FAILURE;
+    }
+
+    return (enum mkc_status) lexer_open(fd, lexer);
+}
+
+/* text must stay valid and unchanged until the lexer is closed */
+MKC_API enum mkc_status mkc_lexer_open_memory(const char *text,
+    size_t length, struct mkc_lexer **lexer)
+{
+    FILE *fd;
+
+    /* Stream is read only, it never writes into text */
+    fd = fmemopen((char *) text, length, "r");
+
+    if (fd == NULL)
+    {
+        snprintf(last_error, sizeof(last_error),
+            "Failed to open memory stream: %s", strerror(errno));
+        return MKC_FAILURE;
+    }
+
+    return (enum mkc_status) lexer_open(fd, lexer);
+}
+
+/* After MKC_TOKEN_EOF every call returns MKC_TOKEN_EOF again */
+MKC_API enum mkc_status mkc_lexer_next(struct mkc_lexer *lexer,
+    struct mkc_token *token)
+{
+    struct fatal_frame frame;
+    struct lunit *lunit;
+
+    if (lexer->failed)
+    {
+        set_error(lexer->error);
+        return MKC_FAILURE;
+    }
+
+    fatal_push(&frame);
+
+    if (setjmp(frame.env) != 0)
+    {
+        lexer->failed = true;
+        snprintf(lexer->error, sizeof(lexer->error), "%s", frame.message);
+        set_error(frame.message);
+        return MKC_FAILURE;
+    }
+
+    arena_release(lexer->arena, lexer->mark);
+    lunit = lunit_get_arena(lexer->sources, lexer->arena);
+
+    fatal_pop(&frame);
+
+    token->kind = (enum mkc_token_kind) lunit->token;
+    token->text = lunit->lexme.text;
+    token->length = lunit->lexme.length;
+    token->line = lunit->line;
+    token->column = lunit->column;
+
+    return MKC_OK;
+}
+
+MKC_API void mkc_lexer_close(struct mkc_lexer *lexer)
+{
+    struct fatal_frame frame;
+    FILE *fd;
+
+    if (lexer == NULL)
+        return;
+
+    fd = lexer->fd;
+
+    /* Nothing here is expected to fail, don't let it exit if it does */
+    fatal_push(&frame);
+
+    if (setjmp(frame.env) == 0)
+    {
+        source_pop(lexer->sources);
+        source_destroy_struct(lexer->sources);
+        arena_destroy(lexer->arena);
+        mem_free(MEM_OTHER, lexer);
+        fatal_pop(&frame);
+    }
+    else
+    {
+        set_error(frame.message);
+    }
+
+    fclose(fd);
+}
+
+MKC_API const char *mkc_error(void)
+{
+    return last_error;
+}
+
+MKC_API const char *mkc_token_name(enum mkc_token_kind kind)
+{
+    if ((int) kind < MKC_TOKEN_PROCEDURE || kind > MKC_TOKEN_UNKNOWN)
+        return NULL;
+
+    return token_name((enum token) kind, NULL);
+}
+
+MKC_API const char *mkc_version(void)
+{
+    return MKC_VERSION_STRING;
+}
+
+/* Takes ownership of fd, closes it on failure */
+static enum status lexer_open(FILE *fd, struct mkc_lexer **lexer)
+{
+    struct fatal_frame frame;
+    /* Set after setjmp, whatever was built is torn down on failure */
+    struct sources *volatile sources = NULL;
+    struct arena *volatile arena = NULL;
+    struct mkc_lexer *volatile new_lexer = NULL;
+
+    fatal_push(&frame);
+
+    if (setjmp(frame.env) != 0)
+    {
+        set_error(frame.message);
+
+        if (new_lexer != NULL)
+            mem_free(MEM_OTHER, new_lexer);
+        if (arena != NULL)
+            arena_destroy(arena);
+        if (sources != NULL)
+            source_destroy_struct(sources);
+
+        fclose(fd);
+        return FAILURE;
+    }
+
+    sources = source_create_struct();
+    source_push(sources, fd);
+    arena = arena_create(MEM_LEXER, 0, 0);
+    new_lexer = mem_alloc(MEM_OTHER, sizeof(struct mkc_lexer));
+
+    new_lexer->fd = fd;
+    new_lexer->sources = sources;
+    new_lexer->arena = arena;
+    new_lexer->mark = arena_mark(arena);
+    new_lexer->failed = false;
+    new_lexer->error[0] = '\0';
+
+    fatal_pop(&frame);
+
+    *lexer = new_lexer;
+
+    return OK;
+}
+
+static void set_error(const char *message)
+{
+    snprintf(last_error, sizeof(last_error), "%s", message);
+}
@@ -0,0 +1,75 @@
+#ifndef _LIBMKC_MKC_H_
+#define _LIBMKC_MKC_H_
+
+/*
+  Public interface of libmkc, the only header embedders include
+  It doesn't depend on any other header of the project, types
+  used internally are mirrored here and kept in sync by the library
+  No function exits the process, failures are reported as MKC_FAILURE
+  and mkc_error describes the last one of the calling thread
+*/
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define MKC_API __attribute__((visibility("default")))
+#else
+#define MKC_API
+#endif
+
+/* Same values as enum status of common/status.h */
+enum mkc_status
+{
+    MKC_FAILURE = 0,
+    MKC_OK = 1
+};
+
+/* Same order as enum token of lexer/lunit.h */
+enum mkc_token_kind
+{
+    MKC_TOKEN_PROCEDURE,
+    MKC_TOKEN_RETURN,
+    MKC_TOKEN_IDENTIFIER,
+    MKC_TOKEN_INTEGER,
+    MKC_TOKEN_TAB,
+    MKC_TOKEN_EOL,
+    MKC_TOKEN_EOF,
+    MKC_TOKEN_UNKNOWN
+};
+
+/* Lexer of one input, a lexer must be used by one thread at a time */
+struct mkc_lexer;
+
+/*
+  text is not null terminated, it stays valid until the next call
+  of mkc_lexer_next or mkc_lexer_close on the same lexer
+*/
+struct mkc_token
+{
+    enum mkc_token_kind kind;
+    const char *text;
+    size_t length;
+    size_t line;
+    size_t column;
+};
+
+MKC_API enum mkc_status mkc_lexer_open_file(const char *file_name,
+    struct mkc_lexer **lexer);
+MKC_API enum mkc_status mkc_lexer_open_memory(const char *text,
+    size_t length, struct mkc_lexer **lexer);
+MKC_API enum mkc_status mkc_lexer_next(struct mkc_lexer *lexer,
+    struct mkc_token *token);
+MKC_API void mkc_lexer_close(struct mkc_lexer *lexer);
+MKC_API const char *mkc_error(void);
+MKC_API const char *mkc_token_name(enum mkc_token_kind kind);
+MKC_API const char *mkc_version(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
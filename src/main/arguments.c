@@ -1,10 +1,16 @@
+#include <ctype.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include <common/guard.h>
+#include <common/arena.h>
+#include <common/exitcodes.h>
+#include <common/fatal.h>
+#include <common/memory.h>
 #include <common/status.h>
+#include <common/timer.h>
 
 #include "arguments.h"
 
@@ -17,7 +23,11 @@ void arg_register(struct arguments *args, struct switch_info *info);
 
 void arg_parse(struct arguments *args, int argc, char **argv);
 
-struct switch_info *arg_create_switch_info(bool takes_parameters);
+void arg_read_manifest(struct arguments *args, char *file_name,
+    struct vector_manifest *entries);
+
+struct switch_info *arg_create_switch_info(struct arguments *args,
+    bool takes_parameters);
 
 static void arg_destroy_switch_info(struct switch_info *info);
 
@@ -29,6 +39,18 @@ struct switch_info *arg_find_short(struct arguments *args, char c);
 
 struct switch_info *arg_find_long(struct arguments *args, char *str);
 
+static void parse_expanded(struct arguments *args, int argc, char **argv);
+
+static void expand_arguments(struct arguments *args, int argc, char **argv,
+    struct vector_string *expanded, int depth);
+
+static void expand_response_file(struct arguments *args, char *file_name,
+    struct vector_string *expanded, int depth);
+
+static char *read_file(struct arguments *args, char *file_name);
+
+static char *next_word(char **cursor);
+
 static void handle_parameter(struct arguments *args,
     char **argv, int *iter_ptr);
 
@@ -47,7 +69,7 @@ static struct switch_info *find_long_switch(struct arguments *args, char *str);
 
 static void append(struct switch_info *info, char *value);
 
-static char *copy_switch_name(char *arg);
+static char *copy_switch_name(struct arguments *args, char *arg);
 
 
 
@@ -55,18 +77,18 @@ struct arguments *arg_create_struct(void)
 {
     struct arguments *args;
 
-    args = malloc(sizeof(struct arguments));
-
-    GUARD(args)
+    args = mem_alloc(MEM_ARGUMENTS, sizeof(struct arguments));
 
     /*
-      These NULL values are going to be used
-      in arg_register() and arg_parse()
+      Switch infos and switch names live as long as args does
+      There are few of them, small chunks are enough
+      They are all freed at once in arg_destroy_struct()
     */
-    args->switches = NULL;
-    args->parameters = NULL;
-    args->switch_count = 0;
-    args->parameter_count = 0;
+    args->arena = arena_create(MEM_ARGUMENTS, 4096, 0);
+
+    /* Vectors are filled in arg_register() and arg_parse() */
+    vector_switch_init(&args->switches, MEM_ARGUMENTS);
+    vector_string_init(&args->parameters, MEM_ARGUMENTS);
 
     return args;
 }
@@ -75,60 +97,111 @@ void arg_destroy_struct(struct arguments *args)
 {
     /* Free struct arguments recursively */
 
-    /*
-      Destroy all switch_info structures
-      args->switch_count is a size_t
-    */
-    for (size_t iter = 0; iter != args->switch_count; ++iter)
-        arg_destroy_switch_info(args->switches[iter]);
+    /* Destroy all switch_info structures */
+    for (size_t iter = 0; iter != args->switches.count; ++iter)
+        arg_destroy_switch_info(args->switches.data[iter]);
 
     /* Free array that used to hold pointers to arguments structs */
-    free(args->switches);
+    vector_switch_fini(&args->switches);
 
     /*
       Free array that used to hold pointers to parameters 
-      Parameters are string literals and shouldn't be freed
+      Parameters point into argv or args->arena, they aren't freed here
     */
-    free(args->parameters);
+    vector_string_fini(&args->parameters);
+
+    /* Frees all switch_info structures */
+    arena_destroy(args->arena);
 
-    free(args);
+    mem_free(MEM_ARGUMENTS, args);
 }
 
 void arg_register(struct arguments *args, struct switch_info *info)
 {
-    size_t new_size;
-    struct switch_info **new_switches;
-
-    /*
-      Right now we have space allocated for args->switch_count pointers
-      We need one more
-      Also if args->switches is NULL realloc works like malloc
-    */
-    new_size = (args->switch_count + 1) * sizeof(struct switch_info *);
-    new_switches = realloc(args->switches, new_size);
-
     /*
       If we can't parse all the arguments
       what is the point of running the program?
+      Vector won't return if it runs out of memory
     */
-    GUARD(new_switches)
+    vector_switch_push(&args->switches, info);
+}
 
-    args->switches = new_switches;
+/*
+  Arguments of the form @file are replaced by words read from file
+  before parsing, so that lists longer than the system allows in argv
+  can be passed, see expand_response_file
+*/
+void arg_parse(struct arguments *args, int argc, char **argv)
+{
+    struct vector_string expanded;
+    struct timer_span span;
 
-    /*
-      In reality we have args->switch_count + 1 infos
-      but we use it as an array subscript
-      Think about it, count = 0, count + 1 (1) infos
-      Where do we put that info? At array subscript 0 (count)!
-      Think again, count = 1, count + 1 (2) infos,
-      Where do we put that second info? At array subscript 1!
-      Afterwards we update count of course
-    */
-    args->switches[args->switch_count] = info;
-    args->switch_count += 1;
+    span = timer_start(TIMER_ARGUMENTS);
+
+    vector_string_init(&expanded, MEM_ARGUMENTS);
+
+    expand_arguments(args, argc, argv, &expanded, 0);
+    parse_expanded(args, expanded.count, expanded.data);
+
+    /* Strings live in argv or in args->arena, only the array goes */
+    vector_string_fini(&expanded);
+
+    timer_stop(&span);
 }
 
-void arg_parse(struct arguments *args, int argc, char **argv)
+/*
+  Manifest lists units to process, one per line: input and optionally
+  output, words are quoted like in response files
+  Empty lines and lines starting with '#' are skipped
+  Strings live as long as args does
+*/
+void arg_read_manifest(struct arguments *args, char *file_name,
+    struct vector_manifest *entries)
+{
+    char *line;
+    size_t line_number;
+
+    line = read_file(args, file_name);
+    line_number = 1;
+
+    while (true)
+    {
+        struct manifest_entry entry;
+        char *end;
+        char *cursor;
+
+        end = strchr(line, '\n');
+
+        if (end != NULL)
+            *end = '\0';
+
+        cursor = line;
+
+        while (isspace((unsigned char) *cursor)) ++cursor;
+
+        if (*cursor != '#' && *cursor != '\0')
+        {
+            entry.input = next_word(&cursor);
+            entry.output = next_word(&cursor);
+
+            if (next_word(&cursor) != NULL)
+            {
+                fatal(EXITCODE_INVOCATION_ERROR,
+                    "%s:%zu: expected input file and "
+                    "optional output file", file_name, line_number);
+            }
+
+            vector_manifest_push(entries, entry);
+        }
+
+        if (end == NULL) break;
+
+        line = end + 1;
+        line_number += 1;
+    }
+}
+
+static void parse_expanded(struct arguments *args, int argc, char **argv)
 {
     int iter;
 
@@ -139,8 +212,7 @@ void arg_parse(struct arguments *args, int argc, char **argv)
         /* Check if argument is empty */
         if (strcmp(argv[iter], "") == 0)
         {
-            fputs("Got empty argument", stderr);
-            exit(EXITCODE_INVOCATION_ERROR);
+            fatal(EXITCODE_INVOCATION_ERROR, "Got empty argument");
         }
 
         /* Check if it is a parameter */
@@ -153,8 +225,7 @@ void arg_parse(struct arguments *args, int argc, char **argv)
         /* Check if we are dealing with lone hyphen */
         if (strcmp(argv[iter], "-") == 0)
         {
-            fputs("Got lone hyphen as an argument", stderr);
-            exit(EXITCODE_INVOCATION_ERROR);
+            fatal(EXITCODE_INVOCATION_ERROR, "Got lone hyphen as an argument");
         }       
 
         /* Check whether it is a short switch */
@@ -174,8 +245,7 @@ void arg_parse(struct arguments *args, int argc, char **argv)
         /* Option with no name? This is obviously invalid */
         if (strncmp(argv[iter], "--=", 3) == 0)
         {
-            fputs("No switch can start with '--='", stderr);
-            exit(EXITCODE_INVOCATION_ERROR);
+            fatal(EXITCODE_INVOCATION_ERROR, "No switch can start with '--='");
         }
 
         /* We are dealing with long switch */
@@ -183,27 +253,21 @@ void arg_parse(struct arguments *args, int argc, char **argv)
     }
 }
 
-struct switch_info *arg_create_switch_info(bool takes_parameter)
+struct switch_info *arg_create_switch_info(struct arguments *args,
+    bool takes_parameter)
 {
     struct switch_info *info;
 
-    info = malloc(sizeof(struct switch_info));
-
-    /* This is a fatal error if we can't parse program's arguments */
-    GUARD(info)
+    /* Arena won't return if it runs out of memory */
+    info = arena_alloc(args->arena, sizeof(struct switch_info));
 
-    /*
-      We are going to realloc these
-      realloc(NULL, size) works like malloc(size)
-    */
-    info->parameters = NULL;
-    info->short_switches = NULL;
-    info->long_switches = NULL;
+    /* These are filled in a preparation to parsing and during it */
+    vector_string_init(&info->parameters, MEM_ARGUMENTS);
+    vector_char_init(&info->short_switches, MEM_ARGUMENTS);
+    vector_string_init(&info->long_switches, MEM_ARGUMENTS);
 
     info->takes_parameter = takes_parameter;
 
-    info->short_count = 0;
-    info->long_count = 0;
     info->occurrences = 0;
 
     return info;
@@ -216,81 +280,39 @@ static void arg_destroy_switch_info(struct switch_info *info)
       Array of strings, free the array but not the strings
       Strings are string literals, they weren't created using malloc
     */
-    free(info->long_switches);
+    vector_string_fini(&info->long_switches);
 
     /* Array of chars, free it */
-    free(info->short_switches);
+    vector_char_fini(&info->short_switches);
 
     /*
-      We do not free info->parameters[x] because these are string literals
+      We do not free info->parameters.data[x], they point into argv
+      or into args->arena
       The array info->parameters must be freed though
     */
-    free(info->parameters);
+    vector_string_fini(&info->parameters);
 
-    free(info);
+    /* info itself lives in args->arena */
 }
 
 void arg_add_short(struct switch_info *info, char c)
 {
-    size_t new_size;
-    char *new_short_switches;
-
-    /*
-      Right now we have space allocated for short_count characters
-      We need one more
-      Also if short_switches is NULL realloc works like malloc
-    */
-    new_size = info->short_count + 1;
-    new_short_switches = realloc(info->short_switches, new_size);
-
     /*
       If we can't parse all the switches then
       what is the point of running the program?
+      Vector won't return if it runs out of memory
     */
-    GUARD(new_short_switches)
-
-    info->short_switches = new_short_switches;
-
-    /*
-      short_count is no longer valid but it can be used to
-      insert new character, that is it can be used as array subscript
-      Afterwards update short_count
-    */
-    info->short_switches[info->short_count] = c;
-    info->short_count += 1;
+    vector_char_push(&info->short_switches, c);
 }
 
 void arg_add_long(struct switch_info *info, char *str)
 {
-    size_t new_size;
-    char **new_long_switches;
-
-    /*
-      Right now we have space allocated for long_count strings
-      We need one more
-      Also if long_switches is NULL realloc works like malloc
-    */
-    new_size = (info->long_count + 1) * sizeof(char *);
-    new_long_switches = realloc(info->long_switches, new_size);
-
     /*
-      If we can't parse all the switches then
-      what is the point of running the program?
-    */
-    GUARD(new_long_switches)
-
-    info->long_switches = new_long_switches;
-
-    /*
-      long_count is no longer valid but it can be used to
-      insert new string, that is it can be used as array subscript
-      Afterwards update long_count
       Note we aren't copying str, just copying its pointer
       This is because str is a constant
       TODO add const modifier to str maybe?
     */
-    info->long_switches[info->long_count] = str;
-    info->long_count += 1;
+    vector_string_push(&info->long_switches, str);
 }
 
 struct switch_info *arg_find_short(struct arguments *args, char c)
@@ -300,14 +322,14 @@ struct switch_info *arg_find_short(struct arguments *args, char c)
       switches user will register, he might even register more
       than value of INT_MAX (maximal number of arguments to main)
     */
-    for (size_t i = 0; i != args->switch_count; ++i)
+    for (size_t i = 0; i != args->switches.count; ++i)
     {
         struct switch_info *info;
 
-        info = args->switches[i];
+        info = args->switches.data[i];
 
-        for (size_t j = 0; j != info->short_count; ++j)
-            if (info->short_switches[j] == c)
+        for (size_t j = 0; j != info->short_switches.count; ++j)
+            if (info->short_switches.data[j] == c)
                 return info;
     }
     return NULL;
@@ -320,50 +342,181 @@ struct switch_info *arg_find_long(struct arguments *args, char *str)
       switches user will register, he might even register more
       than value of INT_MAX (maximal number of arguments to main)
     */
-    for (size_t i = 0; i != args->switch_count; ++i)
+    for (size_t i = 0; i != args->switches.count; ++i)
     {
         struct switch_info *info;
 
-        info = args->switches[i];
+        info = args->switches.data[i];
 
-        for (size_t j = 0; j != info->long_count; ++j)
-            if (strcmp(info->long_switches[j], str) == 0)
+        for (size_t j = 0; j != info->long_switches.count; ++j)
+            if (strcmp(info->long_switches.data[j], str) == 0)
                 return info;
     }
 
     return NULL;
 }
 
-static void handle_parameter(struct arguments *args,
-    char **argv, int *iter_ptr)
+static void expand_arguments(struct arguments *args, int argc, char **argv,
+    struct vector_string *expanded, int depth)
 {
-    /*
-      int is enough, main takes up to INT_MAX arguments
-      Not all of the arguments are parameters
-    */
-    int iter;
-    int new_size;
-    char **new_parameters;
+    for (int i = 0; i != argc; ++i)
+    {
+        /* Lone '@' is an ordinary parameter */
+        if (argv[i][0] == '@' && argv[i][1] != '\0')
+            expand_response_file(args, &argv[i][1], expanded, depth);
+        else
+            vector_string_push(expanded, argv[i]);
+    }
+}
 
-    /* It is more readable this way */
-    iter = *iter_ptr;
+/*
+  Response file contains arguments separated by whitespace
+  Quotes ('' or "") and backslash protect whitespace and quotes
+  Response files may name other response files, up to a limit
+  so that a file that names itself doesn't loop forever
+*/
+static void expand_response_file(struct arguments *args, char *file_name,
+    struct vector_string *expanded, int depth)
+{
+    struct vector_string words;
+    char *cursor;
+    char *word;
+
+    if (depth == ARG_MAX_RESPONSE_DEPTH)
+    {
+        fatal(EXITCODE_INVOCATION_ERROR,
+            "Response file %s is nested too deeply", file_name);
+    }
+
+    vector_string_init(&words, MEM_ARGUMENTS);
+
+    cursor = read_file(args, file_name);
+
+    while ((word = next_word(&cursor)) != NULL)
+        vector_string_push(&words, word);
+
+    expand_arguments(args, words.count, words.data, expanded, depth + 1);
+
+    vector_string_fini(&words);
+}
+
+/* Whole file as a null terminated string in args->arena */
+static char *read_file(struct arguments *args, char *file_name)
+{
+    FILE *fd;
+    char *text;
+    size_t length;
+    size_t capacity;
+    size_t got;
+
+    fd = fopen(file_name, "r");
+
+    if (fd == NULL)
+    {
+        fatal(EXITCODE_INVOCATION_ERROR,
+            "Failed to open file '%s' for reading: %s",
+            file_name, strerror(errno));
+    }
 
     /*
-      There is space allocated for args->parameter_count parameters
-      but we want to allocate apace for one more
-      Calling realloc(NULL, size) is equivalent to malloc(size)
+      Size isn't known up front for pipes, grow until EOF
+      Text is the last allocation in the arena so it grows in place
     */
-    new_size = (args->parameter_count + 1) * sizeof(char *);
-    new_parameters = realloc(args->parameters, new_size);
+    capacity = 4096;
+    length = 0;
+    text = arena_alloc_aligned(args->arena, capacity, 1);
+
+    /* One byte is always left for the terminating null byte */
+    while ((got = fread(&text[length], 1, capacity - length - 1, fd)) != 0)
+    {
+        length += got;
 
-    GUARD(new_parameters)
+        if (capacity - length == 1)
+        {
+            text = arena_grow(args->arena, text, capacity, capacity * 2);
+            capacity *= 2;
+        }
+    }
+
+    if (ferror(fd))
+    {
+        fatal(EXITCODE_INVOCATION_ERROR, "Failed to read file '%s': %s",
+            file_name, strerror(errno));
+    }
 
-    args->parameters = new_parameters;
+    fclose(fd);
 
-    /* parameter_count is invalid but can be used as a subscript */
-    args->parameters[args->parameter_count] = argv[iter];
-    /* It is valid now */
-    args->parameter_count += 1;
+    text[length] = '\0';
+
+    return text;
+}
+
+/*
+  Unquote next whitespace separated word in place and return it
+  Returns NULL when there are no more words
+  Unquoted text is never longer than quoted, so writing never
+  overtakes reading
+*/
+static char *next_word(char **cursor)
+{
+    char *read;
+    char *write;
+    char *word;
+    char quote;
+
+    read = *cursor;
+
+    while (isspace((unsigned char) *read)) ++read;
+
+    if (*read == '\0')
+    {
+        *cursor = read;
+        return NULL;
+    }
+
+    word = write = read;
+    quote = '\0';
+
+    while (*read != '\0')
+    {
+        if (quote == '\0' && isspace((unsigned char) *read))
+            break;
+
+        if (*read == '\\' && read[1] != '\0')
+        {
+            *write++ = read[1];
+            read += 2;
+        }
+        else if (quote == '\0' && (*read == '\'' || *read == '"'))
+        {
+            quote = *read++;
+        }
+        else if (*read == quote)
+        {
+            quote = '\0';
+            read += 1;
+        }
+        else
+        {
+            *write++ = *read++;
+        }
+    }
+
+    /* Step over the separator before write may reach it */
+    if (*read != '\0')
+        read += 1;
+
+    *write = '\0';
+    *cursor = read;
+
+    return word;
+}
+
+static void handle_parameter(struct arguments *args,
+    char **argv, int *iter_ptr)
+{
+    /* Parameters live in argv or args->arena, we store pointers only */
+    vector_string_push(&args->parameters, argv[*iter_ptr]);
 
     /* Update iterator */
     *iter_ptr += 1;
@@ -420,9 +573,9 @@ static void handle_short_switch(struct arguments *args,
         */
         if (iter == argc - 1)
         {
-            fprintf(stderr, "Switch %c (the last one) requires a parameter",
+            fatal(EXITCODE_INVOCATION_ERROR,
+                "Switch %c (the last one) requires a parameter",
                 switch_name);
-            exit(EXITCODE_INVOCATION_ERROR);
         }
         /* Next argument exists, mark it as current one */
         iter += 1;
@@ -458,9 +611,9 @@ static void handle_long_switch(struct arguments *args,
 
     /* 
       Option is everything between two leading hyphens and '='/null byte
-      Copy it to this variable (and don't forget to free it)
+      Copy it to this variable, it is freed together with args
     */
-    switch_name = copy_switch_name(argv[iter]);
+    switch_name = copy_switch_name(args, argv[iter]);
 
     /*
       Retrieve information about switch we are dealing with
@@ -500,9 +653,9 @@ static void handle_long_switch(struct arguments *args,
     {
         if (iter == argc - 1)
         {
-            fprintf(stderr, "Option %s (the last one) requires a parameter",
+            fatal(EXITCODE_INVOCATION_ERROR,
+                "Option %s (the last one) requires a parameter",
                 switch_name);
-            exit(EXITCODE_INVOCATION_ERROR);
         }
 
         /* Move to next argument */
@@ -522,12 +675,6 @@ static void handle_long_switch(struct arguments *args,
         append(info, tail);
     }
 
-    /*
-      It was used to find appropriate struct switch_info
-      and to print an error message, it is no longer needed, free it
-    */
-    free(switch_name);
-
     /* Make iter point to next switch/parameter to parse */
     iter += 1;
 
@@ -567,8 +714,7 @@ static struct switch_info *find_short_switch(struct arguments *args, char c)
 
     if (info == NULL)
     {
-        fprintf(stderr, "Unknown short switch %c\n", c);
-        exit(EXITCODE_INVOCATION_ERROR);
+        fatal(EXITCODE_INVOCATION_ERROR, "Unknown short switch %c", c);
     }
 
     return info;
@@ -582,8 +728,7 @@ static struct switch_info *find_long_switch(struct arguments *args, char *str)
 
     if (info == NULL)
     {
-        fprintf(stderr, "Unknown long switch %s\n", str);
-        exit(EXITCODE_INVOCATION_ERROR);
+        fatal(EXITCODE_INVOCATION_ERROR, "Unknown long switch %s", str);
     }
 
     return info;
@@ -591,38 +736,17 @@ static struct switch_info *find_long_switch(struct arguments *args, char *str)
 
 static void append(struct switch_info *info, char *value)
 {
-    size_t new_size;
-    char **new_parameters;
-
-    /*
-      We have space for info->occurrences strings
-      and need space for one more
-      However info->occurrences has ALREADY been incremented
-      That is we have occurrences - 1 elements in the array
-      If info->parameters is NULL realloc works like malloc
-    */
-    new_size = info->occurrences * sizeof(char *);
-    new_parameters = realloc(info->parameters, new_size);
-
     /*
       We can't parse all the parameters, what now? Nothing.
       If we don't full understand what our user intended to do then
       what should we do? Nothing. Compilers don't guess what has to be done
+      Vector won't return if it runs out of memory
+      We copy pointer and not the string, value outlives info
     */
-    GUARD(new_parameters)
-
-    info->parameters = new_parameters;
-
-    /*
-      Just like in all similar functions above
-      Insert our new value into the list
-      Remember info->occurrences has already been incremented
-      We copy pointer and not the string, value is a string literal
-    */
-    info->parameters[info->occurrences - 1] = value;
+    vector_string_push(&info->parameters, value);
 }
 
-static char *copy_switch_name(char *arg)
+static char *copy_switch_name(struct arguments *args, char *arg)
 {
     char *switch_name;
     size_t start, stop, length;
@@ -645,9 +769,7 @@ static char *copy_switch_name(char *arg)
     length = stop - start;
 
     /* +1 because terminating null byte */
-    switch_name = malloc(length + 1);
-
-    GUARD(switch_name)
+    switch_name = arena_alloc_aligned(args->arena, length + 1, 1);
 
     /* We skip two leading hyphens */
     strncpy(switch_name, &arg[2], length);
@@ -1,6 +1,15 @@
 #ifndef _MAIN_OPTIONS_H_
 #define _MAIN_OPTIONS_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <common/arena.h>
+#include <common/vector.h>
+
+VECTOR(vector_char, char)
+VECTOR(vector_string, char *)
+
 /*
   This structure records information about one kind of option
   There may be multiple strings or chars that match as one kind of option
@@ -11,35 +20,46 @@
   That is parameters of these options will be kept in field parameters
   and parameter_count will be sum of number of uses of these options
   Field takes_parameter is set when creating option_info
-  Fields short_switches, long_switches, short_count and long_count
-  are set in a preparation to parsing
-  Fields parameters and parameter_count are set during parsing process
+  Fields short_switches and long_switches are set in a preparation to parsing
+  Fields parameters and occurrences are set during parsing process
+  If switch takes a parameter then parameters.count equals occurrences
 */
 struct switch_info
 {
-    char **parameters; /* array of strings */
-    char *short_switches; /* array of chars */
-    char **long_switches; /* array of strings */
-    size_t short_count;
-    size_t long_count;
+    struct vector_string parameters;
+    struct vector_char short_switches;
+    struct vector_string long_switches;
     int occurrences;
     bool takes_parameter;
 };
 
+VECTOR(vector_switch, struct switch_info *)
+
+/* Response files (@file) may name other response files this deep */
+#define ARG_MAX_RESPONSE_DEPTH 16
+
+/* One line of a manifest, output is NULL if the line has none */
+struct manifest_entry
+{
+    char *input;
+    char *output;
+};
+
+VECTOR(vector_manifest, struct manifest_entry)
+
 /* 
   This structure records information about all the options available
   It also records all the "standalone" parameters
   (not to be confused with option parameters)
-  Field option_count is set before parsing takes place
-  Field options is set before parsing but its members are modified during it
-  Fields parameters and parameter_count are set during parsing process
+  Field switches is set before parsing but its members are modified during it
+  Field parameters is set during parsing process
+  Field arena holds switch infos and everything else freed along with args
 */
 struct arguments
 {
-    struct switch_info **switches; /* array of pointers */
-    char **parameters;
-    size_t switch_count;
-    int parameter_count;
+    struct vector_switch switches;
+    struct vector_string parameters;
+    struct arena *arena;
 };
 
 
@@ -51,7 +71,11 @@ void arg_register(struct arguments *args, struct switch_info *info);
 
 void arg_parse(struct arguments *args, int argc, char **argv);
 
-struct switch_info *arg_create_switch_info(bool takes_parameters);
+void arg_read_manifest(struct arguments *args, char *file_name,
+    struct vector_manifest *entries);
+
+struct switch_info *arg_create_switch_info(struct arguments *args,
+    bool takes_parameters);
 
 void arg_add_short(struct switch_info *info, char c);
 
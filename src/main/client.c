@@ -0,0 +1,219 @@
+/* SO_PEERCRED */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <common/exitcodes.h>
+#include <common/fatal.h>
+#include <common/jobserver.h>
+#include <common/memory.h>
+
+#include "serve.h"
+
+#include "client.h"
+
+static int connect_server(void);
+static bool send_request(int connection, int cwd, int argc, char **argv);
+static bool write_all(int fd, const void *buffer, size_t size);
+
+
+/*
+  Run argv on a mkc serve server if one is listening
+  Returns false when there is no server, it can't take the request or
+  it runs another version of mkc, the caller then runs the command
+  itself
+  Only dump and compile are forwarded, they depend on nothing but
+  arguments, standard streams, the working directory and make's
+  jobserver, which the server uses instead of its own limits
+*/
+bool client_forward(int argc, char **argv, int *exitcode)
+{
+    int32_t value;
+    ssize_t received;
+    int connection;
+    int cwd;
+
+    if (argc < 2 || (strcmp(argv[1], "dump") != 0
+        && strcmp(argv[1], "compile") != 0))
+        return false;
+
+    connection = connect_server();
+
+    if (connection == -1)
+        return false;
+
+    cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (cwd == -1 || send_request(connection, cwd, argc, argv) == false)
+    {
+        if (cwd != -1)
+            close(cwd);
+
+        close(connection);
+        return false;
+    }
+
+    close(cwd);
+
+    do
+        received = read(connection, &value, sizeof(value));
+    while (received == -1 && errno == EINTR);
+
+    close(connection);
+
+    /* Nothing was run, see serve_request */
+    if (received == sizeof(value) && value == SERVE_REFUSED)
+        return false;
+
+    /* Server has the request, running it again could repeat side effects */
+    if (received != sizeof(value))
+        fatal(EXITCODE_EXTERNAL_ERROR, "Lost connection to mkc server");
+
+    *exitcode = value;
+
+    return true;
+}
+
+/* Connected socket or -1, a server of another user doesn't count */
+static int connect_server(void)
+{
+    struct sockaddr_un address;
+    struct ucred credentials;
+    socklen_t length;
+    int fd;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (serve_socket_path(address.sun_path, sizeof(address.sun_path))
+        == false)
+        return -1;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd == -1)
+        return -1;
+
+    length = sizeof(credentials);
+
+    if (connect(fd, (struct sockaddr *) &address, sizeof(address)) == -1
+        || getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials,
+            &length) == -1
+        || credentials.uid != getuid())
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static bool send_request(int connection, int cwd, int argc, char **argv)
+{
+    union
+    {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(SERVE_MAX_FD_COUNT * sizeof(int))];
+    } control;
+    int fds[SERVE_MAX_FD_COUNT] = { STDIN_FILENO, STDOUT_FILENO,
+        STDERR_FILENO };
+    struct serve_request request;
+    struct cmsghdr *message_header;
+    struct msghdr message;
+    struct iovec part;
+    char *buffer;
+    size_t fd_count;
+    size_t size;
+    bool sent;
+
+    fds[3] = cwd;
+    fd_count = SERVE_FD_COUNT;
+
+    if (jobserver_descriptors(&fds[4], &fds[5]))
+        fd_count = SERVE_MAX_FD_COUNT;
+
+    size = 0;
+
+    for (int i = 0; i != argc; ++i)
+        size += strlen(argv[i]) + 1;
+
+    if (size > SERVE_MAX_ARGUMENTS_SIZE)
+        return false;
+
+    request.magic = SERVE_MAGIC;
+    request.argc = argc;
+    request.size = size;
+    request.protocol = SERVE_PROTOCOL;
+    request.version = serve_version();
+
+    part.iov_base = &request;
+    part.iov_len = sizeof(request);
+
+    memset(&control, 0, sizeof(control));
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = CMSG_SPACE(fd_count * sizeof(int));
+
+    message_header = CMSG_FIRSTHDR(&message);
+    message_header->cmsg_level = SOL_SOCKET;
+    message_header->cmsg_type = SCM_RIGHTS;
+    message_header->cmsg_len = CMSG_LEN(fd_count * sizeof(int));
+    memcpy(CMSG_DATA(message_header), fds, fd_count * sizeof(int));
+
+    if (sendmsg(connection, &message, MSG_NOSIGNAL) != sizeof(request))
+        return false;
+
+    buffer = mem_alloc(MEM_ARGUMENTS, size);
+    size = 0;
+
+    for (int i = 0; i != argc; ++i)
+    {
+        size_t length;
+
+        length = strlen(argv[i]) + 1;
+        memcpy(&buffer[size], argv[i], length);
+        size += length;
+    }
+
+    sent = write_all(connection, buffer, size);
+
+    mem_free(MEM_ARGUMENTS, buffer);
+
+    return sent;
+}
+
+static bool write_all(int fd, const void *buffer, size_t size)
+{
+    const char *cursor;
+
+    cursor = buffer;
+
+    while (size != 0)
+    {
+        ssize_t result;
+
+        result = send(fd, cursor, size, MSG_NOSIGNAL);
+
+        if (result == -1 && errno == EINTR)
+            continue;
+
+        if (result <= 0)
+            return false;
+
+        cursor += result;
+        size -= result;
+    }
+
+    return true;
+}
@@ -0,0 +1,8 @@
+#ifndef _MAIN_CLIENT_H_
+#define _MAIN_CLIENT_H_
+
+#include <stdbool.h>
+
+bool client_forward(int argc, char **argv, int *exitcode);
+
+#endif
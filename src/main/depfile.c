@@ -0,0 +1,87 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <common/exitcodes.h>
+#include <common/fatal.h>
+#include <common/writer.h>
+
+#include "arguments.h"
+
+#include "depfile.h"
+
+static void put_name(struct writer *out, const char *name);
+
+
+/*
+  Make rules telling what every output was made from, like gcc -MD
+  Units with their own output get a rule each, the rest were written
+  to main_output, NULL for standard output which has no rule
+  Build systems include this file so that outputs are made again
+  whenever one of their inputs changes
+*/
+void depfile_write(const char *file_name, struct vector_manifest *units,
+    const char *main_output)
+{
+    struct writer *out;
+    int fd;
+
+    fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    if (fd == -1)
+    {
+        fatal(EXITCODE_INTERNAL_ERROR,
+            "Failed to open file '%s' for writing: %s",
+            file_name, strerror(errno));
+    }
+
+    out = writer_create_fd(fd, 0);
+
+    if (main_output != NULL)
+    {
+        put_name(out, main_output);
+        WRITER_PUT_LITERAL(out, ":");
+
+        for (size_t i = 0; i != units->count; ++i)
+        {
+            if (units->data[i].output != NULL)
+                continue;
+
+            WRITER_PUT_LITERAL(out, " \\\n ");
+            put_name(out, units->data[i].input);
+        }
+
+        WRITER_PUT_LITERAL(out, "\n");
+    }
+
+    for (size_t i = 0; i != units->count; ++i)
+    {
+        if (units->data[i].output == NULL)
+            continue;
+
+        put_name(out, units->data[i].output);
+        WRITER_PUT_LITERAL(out, ": ");
+        put_name(out, units->data[i].input);
+        WRITER_PUT_LITERAL(out, "\n");
+    }
+
+    writer_flush(out);
+    writer_destroy(out);
+    close(fd);
+}
+
+/* Quoted the way make reads it: spaces, '#' and '$' */
+static void put_name(struct writer *out, const char *name)
+{
+    for (; *name != '\0'; ++name)
+    {
+        if (*name == ' ' || *name == '\t' || *name == '#')
+            writer_put_char(out, '\\');
+        else if (*name == '$')
+            writer_put_char(out, '$');
+
+        writer_put_char(out, *name);
+    }
+}
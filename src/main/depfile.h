@@ -0,0 +1,9 @@
+#ifndef _MAIN_DEPFILE_H_
+#define _MAIN_DEPFILE_H_
+
+#include "arguments.h"
+
+void depfile_write(const char *file_name, struct vector_manifest *units,
+    const char *main_output);
+
+#endif
@@ -3,7 +3,9 @@
 #include <string.h>
 
 #include <common/exitcodes.h>
+#include <common/fatal.h>
 
+#include "dump_ast.h"
 #include "dump_lunits.h"
 
 void dump(int argc, char **argv)
@@ -12,9 +14,8 @@ void dump(int argc, char **argv)
 
     if (argc < 3)
     {
-        puts("You must specify a mode");
-        puts("Invoke mkc with 'help dump' for help");
-        exit(EXITCODE_INVOCATION_ERROR);
+        fatal(EXITCODE_INVOCATION_ERROR, "You must specify a mode\n"
+            "Invoke mkc with 'help dump' for help");
     }
 
     /* 0 - program name, 1 - subcommand, 2 - mode */
@@ -25,9 +26,15 @@ void dump(int argc, char **argv)
         dump_lunits(argc, argv);
         return;
     }
-    printf("Unknown mode %s\n", mode);
-    puts("Invoke mkc with 'help dump' for help");
-    exit(EXITCODE_INVOCATION_ERROR);
 
-    // TODO dump ast and ir
+    if (strcmp(mode, "ast") == 0)
+    {
+        dump_ast(argc, argv);
+        return;
+    }
+
+    fatal(EXITCODE_INVOCATION_ERROR, "Unknown mode %s\n"
+        "Invoke mkc with 'help dump' for help", mode);
+
+    // TODO dump ir
 }
@@ -0,0 +1,299 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <common/arena.h>
+#include <common/exitcodes.h>
+#include <common/fatal.h>
+#include <common/memory.h>
+#include <common/timer.h>
+#include <common/writer.h>
+#include <lexer/lexer.h>
+#include <lexer/source.h>
+#include <parser/ast.h>
+#include <parser/parser.h>
+#include <parser/pipeline.h>
+
+#include "arguments.h"
+
+#include "dump_ast.h"
+
+/*
+  Lexer side of a unit being parsed, only the lunit the parser looks
+  at is alive, the arena is released back to mark for the next one
+*/
+struct ast_input
+{
+    struct sources *sources;
+    struct arena *arena;
+    struct arena_mark mark;
+    size_t tokens;
+};
+
+static struct arguments *register_options(void);
+static char *get_output_name(struct arguments *args);
+static struct ast *parse_file(struct parser *parser, char *file_name,
+    bool pipelined, size_t *tokens);
+static struct lunit *next_lunit(void *context);
+static void write_node(struct writer *out, struct ast *ast, uint32_t index,
+    size_t depth);
+
+
+/*
+  mkc dump ast [-o FILE] [--pipeline] file.kr ...
+  Parses every input and prints its tree, a node per line indented by
+  its depth, with its name or value and where it starts:
+
+    AST_UNIT 1:1
+      AST_PROCEDURE main 1:1
+        AST_RETURN 2:2
+          AST_IDENTIFIER x 2:9
+
+  Many inputs are preceded by File: lines like in dump lunits
+  With --pipeline every unit is lexed on a thread of its own while it
+  is parsed, see parser/pipeline.h
+*/
+void dump_ast(int argc, char **argv)
+{
+    struct arguments *args;
+    struct parser *parser;
+    struct writer *out;
+    char *output_name;
+    bool pipelined;
+    int out_fd;
+    size_t tokens;
+
+    args = register_options();
+
+    /* Skip program name, subcommand and mode */
+    arg_parse(args, argc - 3, &argv[3]);
+
+    output_name = get_output_name(args);
+    pipelined = arg_find_long(args, "pipeline")->occurrences != 0;
+
+    if (args->parameters.count == 0)
+        fatal(EXITCODE_INVOCATION_ERROR, "No input files");
+
+    out_fd = STDOUT_FILENO;
+
+    if (output_name != NULL)
+    {
+        out_fd = open(output_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+        if (out_fd == -1)
+        {
+            fatal(EXITCODE_INTERNAL_ERROR,
+                "Failed to open file '%s' for writing: %s",
+                output_name, strerror(errno));
+        }
+    }
+
+    out = writer_create_fd(out_fd, 0);
+    parser = parser_create();
+    tokens = 0;
+
+    for (size_t i = 0; i != args->parameters.count; ++i)
+    {
+        char *file_name;
+        struct timer_span span;
+        struct ast *ast;
+
+        file_name = args->parameters.data[i];
+
+        if (args->parameters.count != 1)
+        {
+            WRITER_PUT_LITERAL(out, "File: ");
+            writer_put_string(out, file_name);
+            WRITER_PUT_LITERAL(out, "\n\n");
+        }
+
+        span = timer_start_detail(TIMER_UNIT, file_name);
+        ast = parse_file(parser, file_name, pipelined, &tokens);
+
+        write_node(out, ast, ast->root, 0);
+        WRITER_PUT_LITERAL(out, "\n");
+
+        ast_destroy(ast);
+        timer_stop(&span);
+    }
+
+    mem_add_tokens(tokens);
+
+    parser_destroy(parser);
+    writer_flush(out);
+    writer_destroy(out);
+
+    if (out_fd != STDOUT_FILENO)
+        close(out_fd);
+
+    arg_destroy_struct(args);
+}
+
+static struct arguments *register_options(void)
+{
+    struct arguments *args;
+    struct switch_info *info;
+
+    args = arg_create_struct();
+
+    info = arg_create_switch_info(args, true);
+    arg_add_long(info, "output");
+    arg_add_long(info, "output-file");
+    arg_add_short(info, 'o');
+    arg_register(args, info);
+
+    info = arg_create_switch_info(args, false);
+    arg_add_long(info, "pipeline");
+    arg_register(args, info);
+
+    return args;
+}
+
+/* NULL if output goes to stdout */
+static char *get_output_name(struct arguments *args)
+{
+    struct switch_info *info;
+
+    info = arg_find_long(args, "output");
+    assert(info != NULL);
+
+    if (info->occurrences > 1)
+    {
+        fatal(EXITCODE_INVOCATION_ERROR,
+            "Expected up to one occurrence of option output, "
+            "got more");
+    }
+
+    if (info->occurrences == 0)
+        return NULL;
+
+    return info->parameters.data[0];
+}
+
+/*
+  Lexing happens as the parser asks for lunits, it is timed as parse,
+  unless it is pipelined, then the lexer thread times it
+*/
+static struct ast *parse_file(struct parser *parser, char *file_name,
+    bool pipelined, size_t *tokens)
+{
+    struct ast_input input;
+    struct timer_span span;
+    struct ast *ast;
+    FILE *in;
+
+    in = fopen(file_name, "r");
+
+    if (in == NULL)
+    {
+        fatal(EXITCODE_INVOCATION_ERROR,
+            "Failed to open file '%s' for reading: %s",
+            file_name, strerror(errno));
+    }
+
+    if (pipelined)
+    {
+        struct pipeline *pipeline;
+        struct fatal_frame frame;
+        size_t count;
+
+        pipeline = pipeline_start(in);
+
+        /* Lexer thread is joined before the error exits, see pipeline.h */
+        fatal_push(&frame);
+
+        if (setjmp(frame.env) != 0)
+        {
+            pipeline_stop(pipeline);
+            fclose(in);
+            fatal(frame.exitcode, "%s", frame.message);
+        }
+
+        span = timer_start(TIMER_PARSE);
+        ast = parser_parse(parser, file_name, pipeline_next, pipeline);
+        timer_stop(&span);
+        fatal_pop(&frame);
+
+        count = pipeline_finish(pipeline);
+        timer_add_tokens(TIMER_PARSE, count);
+        fclose(in);
+
+        *tokens += count;
+
+        return ast;
+    }
+
+    input.sources = source_create_struct();
+    source_push(input.sources, in);
+    input.arena = arena_create(MEM_LEXER, 0, 0);
+    input.mark = arena_mark(input.arena);
+    input.tokens = 0;
+
+    span = timer_start(TIMER_PARSE);
+    ast = parser_parse(parser, file_name, next_lunit, &input);
+    timer_stop(&span);
+    timer_add_tokens(TIMER_PARSE, input.tokens);
+
+    arena_destroy(input.arena);
+    source_pop(input.sources);
+    source_destroy_struct(input.sources);
+    fclose(in);
+
+    *tokens += input.tokens;
+
+    return ast;
+}
+
+static struct lunit *next_lunit(void *context)
+{
+    struct ast_input *input;
+
+    input = context;
+    input->tokens += 1;
+
+    arena_release(input->arena, input->mark);
+
+    return lunit_get_arena(input->sources, input->arena);
+}
+
+/* Depth is bounded by nesting of procedures, every level is a tab */
+static void write_node(struct writer *out, struct ast *ast, uint32_t index,
+    size_t depth)
+{
+    struct ast_node *node;
+    const char *text;
+    size_t length;
+
+    node = &ast->nodes[index];
+
+    for (size_t i = 0; i != depth; ++i)
+        WRITER_PUT_LITERAL(out, "  ");
+
+    text = ast_kind_name(node->kind, &length);
+    writer_put_buffer(out, text, length);
+    writer_put_char(out, ' ');
+
+    if (node->kind == AST_PROCEDURE || node->kind == AST_IDENTIFIER)
+    {
+        text = ast_name(ast, node, &length);
+        writer_put_buffer(out, text, length);
+        writer_put_char(out, ' ');
+    }
+    else if (node->kind == AST_INTEGER)
+    {
+        writer_put_size(out, ast->integers[node->value]);
+        writer_put_char(out, ' ');
+    }
+
+    writer_put_size(out, node->line);
+    writer_put_char(out, ':');
+    writer_put_size(out, node->column);
+    writer_put_char(out, '\n');
+
+    for (uint32_t i = 0; i != node->count; ++i)
+        write_node(out, ast, ast->children[node->first + i], depth + 1);
+}
@@ -0,0 +1,6 @@
+#ifndef _MAIN_DUMP_AST_H_
+#define _MAIN_DUMP_AST_H_
+
+void dump_ast(int argc, char **argv);
+
+#endif
@@ -1,94 +1,1419 @@
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h> /* For strerror */
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include <common/arena.h>
+#include <common/cache.h>
 #include <common/exitcodes.h>
-#include <common/lstring.h>
+#include <common/fatal.h>
+#include <common/intern.h>
+#include <common/jobserver.h>
+#include <common/memory.h>
+#include <common/scheduler.h>
+#include <common/sha256.h>
 #include <common/status.h>
+#include <common/timer.h>
+#include <common/vector.h>
+#include <common/writer.h>
 #include <lexer/lexer.h>
 #include <lexer/source.h>
+#include <lexer/tokfile.h>
+#include <libmkc/mkc.h>
 
 #include "arguments.h"
+#include "depfile.h"
+#include "file_cache.h"
+#include "libinfo.h"
+#include "pool.h"
+#include "summary.h"
 
 #include "dump_lunits.h"
 
+/* Lunits lexed before they are dumped, see dump_source */
+#define DUMP_BATCH_SIZE 4096
+
+/* Sinks kept between requests, see dump_lunits_keep_warm */
+#define DUMP_WARM_SINKS 64
+
+/*
+  Part of every cache key and of the flags of incremental outputs,
+  bump it when lexing or dumping changes the output so that neither
+  old cache entries nor old outputs are used anymore
+*/
+#define DUMP_CACHE_VERSION 3
+
+/* Cache entries start with the number of lunits and the interface */
+#define DUMP_CACHE_HEADER_SIZE (8 + SHA256_DIGEST_SIZE)
+
+/* Flags recorded in library information files, see get_flags */
+#define DUMP_FLAGS_SIZE LIBINFO_FLAGS_SIZE
+
+/* Output format selected with --format */
+enum dump_format
+{
+    FORMAT_TEXT,
+    FORMAT_BINARY,
+    /* --summary, statistics instead of lunits */
+    FORMAT_SUMMARY
+};
+
+/*
+  Where lunits of a unit go
+  builder is set for binary output, summary for --summary,
+  text is formatted straight into out otherwise
+  Dumps of sources are looked up in cache if it isn't NULL,
+  capture collects dumps that are going to be stored in it
+  interface is collected from lunits if track_interface is set
+*/
+struct dump_sink
+{
+    struct writer *out;
+    struct tokfile_builder *builder;
+    struct summary *summary;
+    struct arena *arena;
+    struct lunit **batch;
+    struct cache *cache;
+    struct writer *capture;
+    bool track_interface;
+    struct libinfo_interface interface;
+};
+
+/*
+  One input of a multi-file dump, a task of the scheduler
+  Unit with output_name is written to that file by its worker,
+  otherwise it is formatted into output for the calling thread
+  output and tokens are set by a worker, done tells the writer
+  they are ready, all three are protected by dump_job.lock
+*/
+struct dump_unit
+{
+    struct dump_job *job;
+    char *file_name;
+    char *output_name;
+    struct writer *output;
+    size_t tokens;
+    bool done;
+};
+
+/*
+  Sinks of finished requests, their arenas, batches and intern tables
+  stay allocated for the next request with the same format
+*/
+struct dump_warm
+{
+    bool enabled;
+    pthread_mutex_t lock;
+    struct dump_sink sinks[DUMP_WARM_SINKS];
+    size_t count;
+};
+
+/*
+  State of one worker of the scheduler, created by its first unit
+  Its sink's arena and tables are reused by every unit the worker
+  runs, so is the buffer of file_out, it is pointed at every output file
+*/
+struct dump_slot
+{
+    bool ready;
+    struct dump_sink sink;
+    struct writer *file_out;
+};
+
+/*
+  Dump of one input kept by dump_lunits_remember, output is NULL
+  until the input is dumped and after it is forgotten
+*/
+struct dump_memo_entry
+{
+    struct writer *output;
+    size_t tokens;
+    bool interface_known;
+    unsigned char interface[SHA256_DIGEST_SIZE];
+};
+
+VECTOR(vector_dump_memo_entry, struct dump_memo_entry)
+
+/*
+  Dumps of inputs for the next dump with the same options, see mkc watch
+  names interns input names, their ids index entries
+  input is told about every file a dump reads
+*/
+struct dump_memo
+{
+    bool enabled;
+    pthread_mutex_t lock;
+    struct intern *names;
+    struct vector_dump_memo_entry entries;
+    void (*input)(const char *file_name);
+};
+
+/*
+  Shared by all workers, slots are indexed by worker
+  flags isn't NULL for incremental dumps, see unit_current
+  out, written, tokens and exitcode are used by dump_processes only,
+  written counts units written to out so far
+*/
+struct dump_job
+{
+    struct dump_unit *units;
+    size_t count;
+    enum dump_format format;
+    size_t top;
+    struct cache *cache;
+    const char *flags;
+    struct dump_slot *slots;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    struct writer *out;
+    size_t written;
+    size_t tokens;
+    int exitcode;
+};
+
 static struct arguments *register_options(void);
 
-static FILE *get_output_stream(struct arguments *args);
+static enum dump_format get_format(struct arguments *args);
+
+static char *get_output_name(struct arguments *args);
+
+static char *get_depfile(struct arguments *args);
+
+static void get_flags(enum dump_format format, size_t top, char *flags);
+
+static size_t get_jobs(struct arguments *args);
+
+static void get_units(struct arguments *args, struct vector_manifest *units);
+
+static void check_units(struct vector_manifest *units,
+    enum dump_format format);
+
+static void check_forgotten(struct vector_manifest *units);
+
+static int open_output(char *file_name);
+
+static FILE *open_input(char *file_name, struct file_cache_entry **entry);
+
+static size_t get_top(struct arguments *args);
+
+static struct cache *get_cache(struct arguments *args,
+    enum dump_format format);
+
+static void sink_init(struct dump_sink *sink, enum dump_format format,
+    size_t top, struct cache *cache, struct writer *out);
+
+static void sink_fini(struct dump_sink *sink);
+
+static bool sink_take_warm(struct dump_sink *sink, enum dump_format format,
+    size_t top);
+
+static bool sink_give_warm(struct dump_sink *sink);
+
+static size_t dump_file(char *file_name, struct dump_sink *sink);
+
+static size_t dump_input(char *file_name, struct dump_sink *sink);
+
+static size_t dump_remembered(char *file_name, struct dump_sink *sink);
+
+static struct dump_memo_entry *memo_entry(const char *file_name);
+
+static size_t dump_source(char *file_name, struct dump_sink *sink);
+
+static size_t dump_stream(FILE *in, struct dump_sink *sink);
+
+static size_t dump_cached(char *file_name, struct dump_sink *sink);
+
+static char *read_source(char *file_name, size_t *size);
+
+static void cache_key_make(struct dump_sink *sink, const char *text,
+    size_t size, struct cache_key *key);
+
+static void write_binary(struct dump_sink *sink);
+
+static size_t dump_tokfile(char *file_name, struct dump_sink *sink);
+
+static void emit(struct dump_sink *sink, struct lunit *lunit);
+
+static size_t input_size(char *file_name);
+
+static bool unit_current(struct dump_job *job, struct dump_unit *unit,
+    struct libinfo *info);
+
+static void unit_record(struct dump_unit *unit, struct dump_sink *sink,
+    struct libinfo *info);
+
+static size_t dump_parallel(struct manifest_entry *entries, size_t count,
+    size_t jobs, enum dump_format format, size_t top, struct cache *cache,
+    const char *flags, struct writer *out);
+
+static void dump_unit(void *data, size_t worker);
+
+static size_t dump_unit_into(struct dump_unit *unit, struct dump_slot *slot,
+    struct writer *output);
+
+static size_t dump_processes(struct manifest_entry *entries, size_t count,
+    size_t jobs, enum dump_format format, size_t top, struct cache *cache,
+    const char *flags, struct writer *out, int *exitcode);
+
+static uint64_t pool_dump(void *context, size_t index, struct writer *out);
+
+static void pool_done(void *context, size_t index, uint64_t tokens,
+    const char *data, size_t size);
+
+static void pool_failed(void *context, size_t index, int status);
+
+static void write_ready(struct dump_job *job);
+
+static void write_unit(struct writer *out, char *file_name,
+    const char *data, size_t size);
+
+static void log_lunit(struct writer *out, struct lunit *lunit);
+
+static void log_token(struct writer *out, struct lunit *lunit);
+
+static void log_lexme(struct writer *out, struct lunit *lunit);
+
+static void log_line(struct writer *out, struct lunit *lunit);
+
+static void log_column(struct writer *out, struct lunit *lunit);
+
+static void log_length(struct writer *out, struct lunit *lunit);
+
+static struct dump_warm warm = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static struct dump_memo memo = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+
+void dump_lunits(int argc, char **argv)
+{
+    struct arguments *args;
+    struct vector_manifest units;
+    enum dump_format format;
+    char *output_name;
+    char *depfile;
+    char flags[DUMP_FLAGS_SIZE];
+    bool incremental;
+    bool processes;
+    int exitcode;
+    int out_fd;
+    size_t jobs;
+    size_t top;
+    struct cache *cache;
+    struct writer *out;
+    size_t tokens;
+
+    args = register_options();
+
+    /*
+      0 - program name
+      1 - subcommand (dump)
+      2 - mode (lunits)
+      3 - first option
+      Skip program name, subcommand and mode
+    */
+    arg_parse(args, argc - 3, &argv[3]);
+
+    format = get_format(args);
+    output_name = get_output_name(args);
+    depfile = get_depfile(args);
+    jobs = get_jobs(args);
+    top = get_top(args);
+    cache = get_cache(args, format);
+    incremental = arg_find_long(args, "incremental")->occurrences != 0;
+    processes = arg_find_long(args, "processes")->occurrences != 0;
+    exitcode = 0;
+    get_flags(format, top, flags);
+
+    vector_manifest_init(&units, MEM_ARGUMENTS);
+    get_units(args, &units);
+
+    /* Only a unit with an output file of its own can be skipped */
+    if (incremental && output_name != NULL && units.count == 1
+        && units.data[0].output == NULL)
+    {
+        units.data[0].output = output_name;
+        output_name = NULL;
+    }
+
+    check_units(&units, format);
+
+    if (memo.enabled)
+        check_forgotten(&units);
+
+    /* Output stream defaults to stdout */
+    out_fd = output_name != NULL ? open_output(output_name) : STDOUT_FILENO;
+
+    /* Output is formatted into a large buffer and written in big blocks */
+    out = writer_create_fd(out_fd, 0);
+
+    if (units.count == 1 && units.data[0].output == NULL)
+    {
+        struct dump_sink sink;
+
+        /* Common case, stream straight to out without threads */
+        sink_init(&sink, format, top, cache, out);
+        tokens = dump_file(units.data[0].input, &sink);
+        sink_fini(&sink);
+    }
+    else if (processes)
+    {
+        tokens = dump_processes(units.data, units.count, jobs, format, top,
+            cache, incremental ? flags : NULL, out, &exitcode);
+    }
+    else
+    {
+        tokens = dump_parallel(units.data, units.count, jobs, format, top,
+            cache, incremental ? flags : NULL, out);
+    }
+
+    mem_add_tokens(tokens);
+
+    if (cache != NULL)
+        cache_close(cache);
+
+    writer_flush(out);
+    writer_destroy(out);
+
+    if (out_fd != STDOUT_FILENO)
+        close(out_fd);
+
+    /* Written last, outputs it names are complete */
+    if (depfile != NULL && exitcode == 0)
+        depfile_write(depfile, &units, output_name);
+
+    vector_manifest_fini(&units);
+    arg_destroy_struct(args);
+
+    /* Output of the units that worked is complete */
+    if (exitcode != 0)
+        fatal(exitcode, "Some units failed, their output is missing");
+}
+
+/*
+  Keep sinks of finished dumps for the following ones, used by
+  mkc serve workers which dump many times in one process
+  Call before starting threads
+*/
+void dump_lunits_keep_warm(void)
+{
+    warm.enabled = true;
+}
+
+/*
+  Keep the dump of every input in memory, the next dump copies it
+  instead of reading the input again, until it is forgotten
+  input is called with every input and manifest a dump reads
+  Options must be the same for all dumps, in-process dumps only,
+  workers of --processes keep theirs to themselves
+  Call before starting threads
+*/
+void dump_lunits_remember(void (*input)(const char *file_name))
+{
+    memo.enabled = true;
+    memo.names = intern_create(MEM_OUTPUT);
+    vector_dump_memo_entry_init(&memo.entries, MEM_OUTPUT);
+    memo.input = input;
+}
+
+/* The next dump reads file_name again, call between dumps */
+void dump_lunits_forget(const char *file_name)
+{
+    struct dump_memo_entry *entry;
+
+    if (memo.enabled == false)
+        return;
+
+    entry = memo_entry(file_name);
+
+    if (entry->output != NULL)
+    {
+        writer_destroy(entry->output);
+        entry->output = NULL;
+    }
+}
+
+/* Everything a unit needs besides its name, reused by many units */
+static void sink_init(struct dump_sink *sink, enum dump_format format,
+    size_t top, struct cache *cache, struct writer *out)
+{
+    if (warm.enabled && sink_take_warm(sink, format, top))
+    {
+        sink->out = out;
+        sink->cache = cache;
+        sink->track_interface = cache != NULL;
+        return;
+    }
+
+    sink->out = out;
+    sink->cache = cache;
+    sink->capture = NULL;
+    /* Cache entries record interfaces for incremental dumps */
+    sink->track_interface = cache != NULL;
+    sink->builder = format == FORMAT_BINARY ? tokfile_builder_create() : NULL;
+    sink->summary = format == FORMAT_SUMMARY ? summary_create(top) : NULL;
+    sink->arena = arena_create(MEM_LEXER, 0, 0);
+    sink->batch = mem_alloc(MEM_LEXER,
+        DUMP_BATCH_SIZE * sizeof(struct lunit *));
+}
+
+static void sink_fini(struct dump_sink *sink)
+{
+    if (warm.enabled && sink_give_warm(sink))
+        return;
+
+    if (sink->builder != NULL)
+        tokfile_builder_destroy(sink->builder);
+
+    if (sink->summary != NULL)
+        summary_destroy(sink->summary);
+
+    if (sink->capture != NULL)
+        writer_destroy(sink->capture);
+
+    arena_destroy(sink->arena);
+    mem_free(MEM_LEXER, sink->batch);
+}
+
+/* Reuse a kept sink of the same format if there is one */
+static bool sink_take_warm(struct dump_sink *sink, enum dump_format format,
+    size_t top)
+{
+    bool found;
+
+    found = false;
+
+    pthread_mutex_lock(&warm.lock);
+
+    for (size_t i = warm.count; i != 0; --i)
+    {
+        struct dump_sink *candidate;
+
+        candidate = &warm.sinks[i - 1];
+
+        if ((candidate->builder != NULL) != (format == FORMAT_BINARY)
+            || (candidate->summary != NULL) != (format == FORMAT_SUMMARY))
+            continue;
+
+        *sink = *candidate;
+        warm.count -= 1;
+        warm.sinks[i - 1] = warm.sinks[warm.count];
+        found = true;
+        break;
+    }
+
+    pthread_mutex_unlock(&warm.lock);
+
+    if (found && sink->summary != NULL)
+        sink->summary->top = top;
+
+    return found;
+}
+
+/* Returns false if there are enough kept sinks already */
+static bool sink_give_warm(struct dump_sink *sink)
+{
+    bool kept;
+
+    pthread_mutex_lock(&warm.lock);
+
+    kept = warm.count != DUMP_WARM_SINKS;
+
+    if (kept)
+    {
+        sink->out = NULL;
+        sink->cache = NULL;
+        warm.sinks[warm.count] = *sink;
+        warm.count += 1;
+    }
+
+    pthread_mutex_unlock(&warm.lock);
+
+    return kept;
+}
+
+/*
+  Dump lunits of one input, returns number of lunits
+  Token files are reloaded instead of lexed again, sources come
+  from the cache if there is one
+  A summary is written once the whole unit has been seen
+*/
+static size_t dump_file(char *file_name, struct dump_sink *sink)
+{
+    if (memo.enabled)
+        return dump_remembered(file_name, sink);
+
+    return dump_input(file_name, sink);
+}
+
+static size_t dump_input(char *file_name, struct dump_sink *sink)
+{
+    struct timer_span span;
+    size_t tokens;
+
+    span = timer_start_detail(TIMER_UNIT, file_name);
+
+    if (sink->summary != NULL)
+        summary_begin(sink->summary, input_size(file_name));
+
+    if (sink->track_interface)
+        libinfo_interface_init(&sink->interface);
+
+    if (tokfile_detect(file_name))
+    {
+        tokens = dump_tokfile(file_name, sink);
+        write_binary(sink);
+    }
+    else if (sink->cache != NULL)
+    {
+        /* Complete dump, binary output included */
+        tokens = dump_cached(file_name, sink);
+    }
+    else
+    {
+        tokens = dump_source(file_name, sink);
+        write_binary(sink);
+    }
+
+    if (sink->summary != NULL)
+    {
+        summary_end(sink->summary);
+        summary_write(sink->summary, sink->out);
+    }
+
+    if (sink->track_interface)
+        libinfo_interface_finish(&sink->interface);
+
+    timer_stop(&span);
+    timer_add_tokens(TIMER_UNIT, tokens);
+
+    /* Size is known only for timing, don't stat files otherwise */
+    if (timer_enabled())
+        timer_add_bytes(TIMER_UNIT, input_size(file_name));
+
+    return tokens;
+}
+
+/*
+  Dump an input through memo, see dump_lunits_remember
+  A remembered dump is copied, otherwise the input is dumped into
+  a writer that is kept
+  Entries are only destroyed between dumps, so their output is read
+  without holding the lock
+*/
+static size_t dump_remembered(char *file_name, struct dump_sink *sink)
+{
+    struct dump_memo_entry *entry;
+    struct writer *output;
+    struct writer *out;
+    struct timer_span span;
+    size_t tokens;
+
+    pthread_mutex_lock(&memo.lock);
+    entry = memo_entry(file_name);
+    output = entry->output;
+    tokens = entry->tokens;
+
+    if (output != NULL)
+    {
+        memcpy(sink->interface.digest, entry->interface, SHA256_DIGEST_SIZE);
+        sink->interface.known = entry->interface_known;
+    }
+
+    pthread_mutex_unlock(&memo.lock);
+
+    if (output != NULL)
+    {
+        span = timer_start(TIMER_OUTPUT);
+        writer_put_buffer(sink->out, output->buffer, output->used);
+        timer_stop(&span);
+
+        return tokens;
+    }
+
+    output = writer_create_memory();
+
+    out = sink->out;
+    sink->out = output;
+    tokens = dump_input(file_name, sink);
+    sink->out = out;
+
+    writer_put_buffer(out, output->buffer, output->used);
+
+    pthread_mutex_lock(&memo.lock);
+    /* Vector may have grown, look it up again */
+    entry = memo_entry(file_name);
+
+    /* Same input twice in one dump, first one is kept */
+    if (entry->output == NULL)
+    {
+        entry->output = output;
+        entry->tokens = tokens;
+        memcpy(entry->interface, sink->interface.digest, SHA256_DIGEST_SIZE);
+        entry->interface_known = sink->track_interface;
+        output = NULL;
+    }
+
+    pthread_mutex_unlock(&memo.lock);
+
+    if (output != NULL)
+        writer_destroy(output);
+
+    return tokens;
+}
+
+/* Entry of file_name, a new one if it wasn't seen, call with lock held */
+static struct dump_memo_entry *memo_entry(const char *file_name)
+{
+    size_t id;
+
+    id = intern_add(memo.names, file_name, strlen(file_name));
+
+    while (memo.entries.count <= id)
+    {
+        struct dump_memo_entry empty;
+
+        empty.output = NULL;
+        empty.tokens = 0;
+        empty.interface_known = false;
+        vector_dump_memo_entry_push(&memo.entries, empty);
+    }
+
+    return &memo.entries.data[id];
+}
+
+/* Binary output needs all tokens before it can write the header */
+static void write_binary(struct dump_sink *sink)
+{
+    if (sink->builder == NULL)
+        return;
+
+    tokfile_builder_write(sink->builder, sink->out);
+    tokfile_builder_clear(sink->builder);
+}
+
+/* Lex file_name and dump its lunits, returns number of lunits */
+static size_t dump_source(char *file_name, struct dump_sink *sink)
+{
+    FILE *in;
+    struct file_cache_entry *entry;
+    size_t tokens;
+
+    in = open_input(file_name, &entry);
+    tokens = dump_stream(in, sink);
+    file_cache_close(in, entry);
+
+    return tokens;
+}
+
+/*
+  Lex in until EOF and dump its lunits, returns number of lunits
+  Lunits are lexed in batches and then dumped, so that lexing and
+  output can be timed separately without reading clocks per lunit
+*/
+static size_t dump_stream(FILE *in, struct dump_sink *sink)
+{
+    struct sources *sources;
+    size_t tokens;
+    bool finish;
+
+    sources = source_create_struct();
+    source_push(sources, in);
+
+    tokens = 0;
+    finish = false;
+
+    while (finish == false)
+    {
+        struct arena_mark mark;
+        struct timer_span span;
+        size_t count;
+
+        /*
+          Lunits of a batch live in the arena until the batch is dumped
+          Releasing the mark frees all of them, the next batch reuses
+          the same memory
+        */
+        mark = arena_mark(sink->arena);
+        count = 0;
+
+        span = timer_start(TIMER_LEX);
+
+        while (count != DUMP_BATCH_SIZE && finish == false)
+        {
+            struct lunit *lunit;
+
+            lunit = lunit_get_arena(sources, sink->arena);
+            sink->batch[count] = lunit;
+            count += 1;
+
+            if (lunit->token == TOK_EOF)
+                finish = true;
+        }
+
+        timer_stop(&span);
+        timer_add_tokens(TIMER_LEX, count);
+
+        span = timer_start(TIMER_OUTPUT);
+
+        for (size_t i = 0; i != count; ++i)
+            emit(sink, sink->batch[i]);
+
+        timer_stop(&span);
+        timer_add_tokens(TIMER_OUTPUT, count);
+
+        arena_release(sink->arena, mark);
+        tokens += count;
+    }
+
+    source_pop(sources);
+    source_destroy_struct(sources);
+
+    return tokens;
+}
+
+/*
+  Dump a source through the cache, returns number of lunits
+  A hit copies the stored dump, nothing is lexed
+  A miss lexes the source from memory into capture, stores that
+  and copies it to out
+  Entries are the number of lunits, 8 bytes little endian, and
+  the digest of the interface followed by the dump
+*/
+static size_t dump_cached(char *file_name, struct dump_sink *sink)
+{
+    struct cache_key key;
+    struct cache_blob blob;
+    struct timer_span span;
+    struct writer *out;
+    FILE *in;
+    char *text;
+    size_t size;
+    size_t tokens;
+    bool hit;
+
+    text = read_source(file_name, &size);
+
+    span = timer_start(TIMER_CACHE);
+    cache_key_make(sink, text, size, &key);
+    hit = cache_fetch(sink->cache, &key, &blob);
+    timer_stop(&span);
+
+    /* Truncated entries can't be written by us, treat them as misses */
+    if (hit && blob.size < DUMP_CACHE_HEADER_SIZE)
+    {
+        cache_release(&blob);
+        hit = false;
+    }
+
+    if (hit)
+    {
+        tokens = 0;
+
+        for (size_t i = 8; i != 0; --i)
+            tokens = tokens << 8 | (unsigned char) blob.data[i - 1];
+
+        memcpy(sink->interface.digest, &blob.data[8], SHA256_DIGEST_SIZE);
+        sink->interface.known = true;
+
+        span = timer_start(TIMER_OUTPUT);
+        writer_put_buffer(sink->out, &blob.data[DUMP_CACHE_HEADER_SIZE],
+            blob.size - DUMP_CACHE_HEADER_SIZE);
+        timer_stop(&span);
+
+        cache_release(&blob);
+        mem_free(MEM_SOURCE, text);
+
+        return tokens;
+    }
+
+    if (sink->capture == NULL)
+        sink->capture = writer_create_memory();
+    else
+        writer_clear(sink->capture);
+
+    /* Room for the number of lunits, it's known only at the end */
+    for (size_t i = 0; i != DUMP_CACHE_HEADER_SIZE; ++i)
+        writer_put_char(sink->capture, '\0');
+
+    in = fmemopen(text, size, "r");
+
+    if (in == NULL)
+    {
+        fatal(EXITCODE_INTERNAL_ERROR,
+            "Failed to open file '%s' for reading: %s",
+            file_name, strerror(errno));
+    }
+
+    out = sink->out;
+    sink->out = sink->capture;
+
+    tokens = dump_stream(in, sink);
+    write_binary(sink);
+
+    sink->out = out;
+    fclose(in);
+    mem_free(MEM_SOURCE, text);
+
+    for (size_t i = 0; i != 8; ++i)
+        sink->capture->buffer[i] = (uint64_t) tokens >> (8 * i);
+
+    libinfo_interface_finish(&sink->interface);
+    memcpy(&sink->capture->buffer[8], sink->interface.digest,
+        SHA256_DIGEST_SIZE);
+
+    span = timer_start(TIMER_CACHE);
+    cache_store(sink->cache, &key, sink->capture->buffer,
+        sink->capture->used);
+    timer_stop(&span);
+
+    writer_put_buffer(out, &sink->capture->buffer[DUMP_CACHE_HEADER_SIZE],
+        sink->capture->used - DUMP_CACHE_HEADER_SIZE);
+
+    return tokens;
+}
+
+/* Whole file in memory, it's hashed and lexed from there */
+static char *read_source(char *file_name, size_t *size)
+{
+    struct stat info;
+    char *text;
+    size_t capacity;
+    size_t used;
+    int fd;
+
+    fd = open(file_name, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1 || fstat(fd, &info) == -1)
+    {
+        fatal(EXITCODE_INTERNAL_ERROR,
+            "Failed to open file '%s' for reading: %s",
+            file_name, strerror(errno));
+    }
+
+    /* One byte more than needed tells that the file ended, or grew */
+    capacity = info.st_size + 1;
+    text = mem_alloc(MEM_SOURCE, capacity);
+    used = 0;
+
+    while (true)
+    {
+        ssize_t count;
+
+        if (used == capacity)
+        {
+            capacity *= 2;
+            text = mem_realloc(MEM_SOURCE, text, capacity);
+        }
+
+        count = read(fd, &text[used], capacity - used);
+
+        if (count == -1 && errno == EINTR)
+            continue;
+
+        if (count == -1)
+        {
+            fatal(EXITCODE_INTERNAL_ERROR, "Failed to read file '%s': %s",
+                file_name, strerror(errno));
+        }
+
+        if (count == 0)
+            break;
+
+        used += count;
+    }
+
+    close(fd);
+    *size = used;
+
+    return text;
+}
+
+/*
+  Everything a dump depends on: version of mkc and of the cache layout,
+  output format and the bytes of the source
+  Bytes are hashed as they are, every one of them can change line and
+  column numbers of the lunits after it, so there is nothing to normalize
+  Strings are hashed with their terminators so they can't run together
+*/
+static void cache_key_make(struct dump_sink *sink, const char *text,
+    size_t size, struct cache_key *key)
+{
+    struct sha256 sha;
+    const char *version;
+    const char *format;
+    unsigned char layout;
+
+    version = mkc_version();
+    format = sink->builder != NULL ? "lunits binary" : "lunits text";
+    layout = DUMP_CACHE_VERSION;
+
+    sha256_init(&sha);
+    sha256_update(&sha, version, strlen(version) + 1);
+    sha256_update(&sha, &layout, 1);
+    sha256_update(&sha, format, strlen(format) + 1);
+    sha256_update(&sha, text, size);
+    sha256_final(&sha, key->digest);
+}
+
+/* Dump lunits stored in a token file, nothing is lexed */
+static size_t dump_tokfile(char *file_name, struct dump_sink *sink)
+{
+    struct tokfile *tokfile;
+    size_t tokens;
+
+    struct timer_span span;
 
-static FILE *get_input_stream(struct arguments *args);
+    tokfile = tokfile_open(file_name);
+    tokens = tokfile_count(tokfile);
 
-static void log_lunit(FILE *fd, struct lunit *lunit);
+    /* There is nothing to lex, all the work is output */
+    span = timer_start(TIMER_OUTPUT);
 
-static void log_token(struct lstring *log, struct lunit *lunit);
+    for (size_t i = 0; i != tokens; ++i)
+    {
+        struct lunit lunit;
+
+        /* lunit borrows its lexme from the mapping, no copies */
+        tokfile_lunit(tokfile, i, &lunit);
+        emit(sink, &lunit);
+    }
 
-static void log_lexme(struct lstring *log, struct lunit *lunit);
+    timer_stop(&span);
+    timer_add_tokens(TIMER_OUTPUT, tokens);
 
-static void log_line(struct lstring *log, struct lunit *lunit);
+    tokfile_close(tokfile);
 
-static void log_column(struct lstring *log, struct lunit *lunit);
+    return tokens;
+}
 
-static void log_length(struct lstring *log, struct lunit *lunit);
+static void emit(struct dump_sink *sink, struct lunit *lunit)
+{
+    if (sink->track_interface)
+        libinfo_interface_add(&sink->interface, lunit);
+
+    if (sink->builder != NULL)
+        tokfile_builder_add(sink->builder, lunit);
+    else if (sink->summary != NULL)
+        summary_add(sink->summary, lunit);
+    else
+        log_lunit(sink->out, lunit);
+}
 
-static char *token_to_str(enum token token);
+/* Size of the input for summaries, errors are reported when it's opened */
+static size_t input_size(char *file_name)
+{
+    struct stat info;
 
+    if (stat(file_name, &info) == -1)
+        return 0;
 
+    return info.st_size;
+}
 
-void dump_lunits(int argc, char **argv)
+/*
+  True if the output of unit is up to date according to its library
+  information file: same mkc, same flags, same source bytes and
+  the output is still the file that was written
+  Sources are compared by content, touching one doesn't rebuild it
+  info gets the flags and digest of the current source either way
+*/
+static bool unit_current(struct dump_job *job, struct dump_unit *unit,
+    struct libinfo *info)
 {
-    struct arguments *args;
-    FILE *out;
-    FILE *in;
-    struct sources *sources;
+    struct libinfo recorded;
+    struct sha256 sha;
+    struct stat output;
+    char *info_name;
+    char *text;
+    size_t size;
+    bool found;
+
+    snprintf(info->flags, LIBINFO_FLAGS_SIZE, "%s", job->flags);
+
+    text = read_source(unit->file_name, &size);
+    sha256_init(&sha);
+    sha256_update(&sha, text, size);
+    sha256_final(&sha, info->source);
+    mem_free(MEM_SOURCE, text);
+
+    info_name = libinfo_name(unit->output_name);
+    found = libinfo_read(info_name, &recorded);
+    mem_free(MEM_OUTPUT, info_name);
+
+    if (found == false || stat(unit->output_name, &output) == -1)
+        return false;
+
+    return strcmp(recorded.flags, info->flags) == 0
+        && memcmp(recorded.source, info->source, SHA256_DIGEST_SIZE) == 0
+        && recorded.output_size == (uint64_t) output.st_size
+        && recorded.output_mtime.tv_sec == output.st_mtim.tv_sec
+        && recorded.output_mtime.tv_nsec == output.st_mtim.tv_nsec;
+}
 
-    args = register_options();
+/* Library information file for an output that was just written */
+static void unit_record(struct dump_unit *unit, struct dump_sink *sink,
+    struct libinfo *info)
+{
+    struct stat output;
+    char *info_name;
 
-    /*
-      0 - program name
-      1 - subcommand (dump)
-      2 - mode (lunits)
-      3 - first option
-      Skip program name, subcommand and mode
-    */
-    arg_parse(args, argc - 3, &argv[3]);
+    if (stat(unit->output_name, &output) == -1)
+    {
+        fatal(EXITCODE_INTERNAL_ERROR, "Failed to stat file '%s': %s",
+            unit->output_name, strerror(errno));
+    }
 
-    out = get_output_stream(args);
-    in = get_input_stream(args);
+    memcpy(info->interface, sink->interface.digest, SHA256_DIGEST_SIZE);
+    info->output_size = output.st_size;
+    info->output_mtime = output.st_mtim;
 
-    arg_destroy_struct(args);
+    info_name = libinfo_name(unit->output_name);
+    libinfo_write(info_name, info);
+    mem_free(MEM_OUTPUT, info_name);
+}
 
-    sources = source_create_struct();
-    source_push(sources, in);
+/*
+  Dump many inputs on jobs worker threads of a scheduler
+  Largest inputs are dumped first so that one of them found last
+  doesn't keep all but one worker waiting at the end
+  Every unit is formatted into its own memory writer, the calling thread
+  writes them to out in command line order as soon as they are complete
+  and frees them, so output doesn't depend on scheduling
+  First worker runs on the token we were started with, the others need
+  one from make's jobserver if there is one, see common/scheduler.h
+*/
+static size_t dump_parallel(struct manifest_entry *entries, size_t count,
+    size_t jobs, enum dump_format format, size_t top, struct cache *cache,
+    const char *flags, struct writer *out)
+{
+    struct dump_job job;
+    struct scheduler *scheduler;
+    size_t tokens;
+
+    /* Extra threads would have nothing to do */
+    if (jobs > count)
+        jobs = count;
+
+    job.units = mem_alloc(MEM_OUTPUT, count * sizeof(struct dump_unit));
+    job.count = count;
+    job.format = format;
+    job.top = top;
+    job.cache = cache;
+    job.flags = flags;
+    job.slots = mem_alloc(MEM_OTHER, jobs * sizeof(struct dump_slot));
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.finished, NULL);
+
+    for (size_t i = 0; i != jobs; ++i)
+        job.slots[i].ready = false;
+
+    scheduler = scheduler_create(jobs, jobserver_try_acquire,
+        jobserver_release);
+
+    /* Units don't import each other yet, there are no dependencies */
+    for (size_t i = 0; i != count; ++i)
+    {
+        job.units[i].job = &job;
+        job.units[i].file_name = entries[i].input;
+        job.units[i].output_name = entries[i].output;
+        job.units[i].output = NULL;
+        job.units[i].tokens = 0;
+        job.units[i].done = false;
+
+        scheduler_add(scheduler, dump_unit, &job.units[i],
+            input_size(entries[i].input));
+    }
 
-    while (true)
+    scheduler_start(scheduler);
+
+    tokens = 0;
+
+    for (size_t i = 0; i != count; ++i)
     {
-        struct lunit *lunit;
-        bool finish;
+        struct dump_unit *unit;
+
+        unit = &job.units[i];
 
-        finish = false;
+        pthread_mutex_lock(&job.lock);
 
-        /* Get one lunit from lexer */
-        lunit = lunit_get(sources);
+        while (unit->done == false)
+            pthread_cond_wait(&job.finished, &job.lock);
 
-        log_lunit(out, lunit);
+        pthread_mutex_unlock(&job.lock);
 
-        /* We have to destroy lunit before quitting so save this state */
-        if (lunit->token == TOK_EOF)
-            finish = true;
+        tokens += unit->tokens;
 
-        lunit_destroy(lunit);
+        /* Worker has written it to its own file already */
+        if (unit->output == NULL)
+            continue;
 
-        if (finish == true) break;
+        write_unit(out, unit->file_name, unit->output->buffer,
+            unit->output->used);
+        writer_destroy(unit->output);
     }
 
-    source_pop(sources);
-    free(sources);
+    scheduler_wait(scheduler);
+    scheduler_destroy(scheduler);
 
-    fclose(in);
-    fclose(out);
+    for (size_t i = 0; i != jobs; ++i)
+    {
+        if (job.slots[i].ready == false)
+            continue;
+
+        if (job.slots[i].file_out != NULL)
+            writer_destroy(job.slots[i].file_out);
+
+        sink_fini(&job.slots[i].sink);
+    }
+
+    pthread_cond_destroy(&job.finished);
+    pthread_mutex_destroy(&job.lock);
+    mem_free(MEM_OTHER, job.slots);
+    mem_free(MEM_OUTPUT, job.units);
+
+    return tokens;
+}
+
+/* Task of the scheduler, runs on worker */
+static void dump_unit(void *data, size_t worker)
+{
+    struct dump_unit *unit;
+    struct dump_job *job;
+    struct writer *output;
+    size_t tokens;
+
+    unit = data;
+    job = unit->job;
+
+    output = unit->output_name == NULL ? writer_create_memory() : NULL;
+    tokens = dump_unit_into(unit, &job->slots[worker], output);
+
+    pthread_mutex_lock(&job->lock);
+    unit->output = output;
+    unit->tokens = tokens;
+    unit->done = true;
+    pthread_cond_broadcast(&job->finished);
+    pthread_mutex_unlock(&job->lock);
+}
+
+/*
+  Dump unit with the sink of slot to its own output file or to output,
+  returns number of lunits, zero if the output file was up to date
+*/
+static size_t dump_unit_into(struct dump_unit *unit, struct dump_slot *slot,
+    struct writer *output)
+{
+    struct dump_job *job;
+    struct libinfo info;
+    size_t tokens;
+
+    job = unit->job;
+
+    if (slot->ready == false)
+    {
+        sink_init(&slot->sink, job->format, job->top, job->cache, NULL);
+        slot->file_out = NULL;
+        slot->ready = true;
+
+        if (job->flags != NULL)
+            slot->sink.track_interface = true;
+    }
+
+    if (unit->output_name != NULL && job->flags != NULL
+        && unit_current(job, unit, &info))
+    {
+        /* Nothing it was made from changed */
+        tokens = 0;
+    }
+    else if (unit->output_name != NULL)
+    {
+        int fd;
+
+        fd = open_output(unit->output_name);
+
+        if (slot->file_out == NULL)
+            slot->file_out = writer_create_fd(fd, 0);
+        else
+            writer_set_fd(slot->file_out, fd);
+
+        slot->sink.out = slot->file_out;
+        tokens = dump_file(unit->file_name, &slot->sink);
+
+        writer_flush(slot->file_out);
+        close(fd);
+
+        if (job->flags != NULL)
+            unit_record(unit, &slot->sink, &info);
+    }
+    else
+    {
+        slot->sink.out = output;
+        tokens = dump_file(unit->file_name, &slot->sink);
+    }
+
+    return tokens;
+}
+
+/*
+  Like dump_parallel, but units run in worker processes and come back
+  through shared memory, see main/pool.h
+  A unit whose worker crashed is left out and exitcode is set, the rest
+  of them is dumped anyway
+  Results are written to out in command line order, units that finished
+  early wait in memory
+*/
+static size_t dump_processes(struct manifest_entry *entries, size_t count,
+    size_t jobs, enum dump_format format, size_t top, struct cache *cache,
+    const char *flags, struct writer *out, int *exitcode)
+{
+    struct dump_job job;
+    struct pool_work work;
+
+    job.units = mem_alloc(MEM_OUTPUT, count * sizeof(struct dump_unit));
+    job.count = count;
+    job.format = format;
+    job.top = top;
+    job.cache = cache;
+    job.flags = flags;
+    /* Every worker process has just one */
+    job.slots = mem_alloc(MEM_OTHER, sizeof(struct dump_slot));
+    job.slots[0].ready = false;
+    job.out = out;
+    job.written = 0;
+    job.tokens = 0;
+    job.exitcode = 0;
+
+    for (size_t i = 0; i != count; ++i)
+    {
+        job.units[i].job = &job;
+        job.units[i].file_name = entries[i].input;
+        job.units[i].output_name = entries[i].output;
+        job.units[i].output = NULL;
+        job.units[i].tokens = 0;
+        job.units[i].done = false;
+    }
+
+    work.context = &job;
+    work.run = pool_dump;
+    work.done = pool_done;
+    work.failed = pool_failed;
+
+    pool_run(&work, count, jobs);
+
+    /* Workers stored entries in a copy of cache we don't see */
+    if (cache != NULL)
+        cache_trim(cache);
+
+    *exitcode = job.exitcode;
+
+    mem_free(MEM_OTHER, job.slots);
+    mem_free(MEM_OUTPUT, job.units);
+
+    return job.tokens;
+}
+
+/* Runs in a worker process */
+static uint64_t pool_dump(void *context, size_t index, struct writer *out)
+{
+    struct dump_job *job;
+
+    job = context;
+
+    return dump_unit_into(&job->units[index], &job->slots[0], out);
+}
+
+static void pool_done(void *context, size_t index, uint64_t tokens,
+    const char *data, size_t size)
+{
+    struct dump_job *job;
+    struct dump_unit *unit;
+
+    job = context;
+    unit = &job->units[index];
+
+    job->tokens += tokens;
+    unit->done = true;
+
+    /* Next in order goes out right away, the others wait */
+    if (unit->output_name == NULL && index == job->written)
+    {
+        write_unit(job->out, unit->file_name, data, size);
+        job->written += 1;
+    }
+    else if (unit->output_name == NULL)
+    {
+        unit->output = writer_create_memory();
+        writer_put_buffer(unit->output, data, size);
+    }
+
+    write_ready(job);
+}
+
+static void pool_failed(void *context, size_t index, int status)
+{
+    struct dump_job *job;
+    struct dump_unit *unit;
+    int exitcode;
+
+    job = context;
+    unit = &job->units[index];
+
+    /* A worker that exited has told why already, see fatal */
+    if (WIFSIGNALED(status))
+    {
+        fprintf(stderr, "Worker dumping '%s' was killed by signal %d\n",
+            unit->file_name, WTERMSIG(status));
+        exitcode = EXITCODE_INTERNAL_ERROR;
+    }
+    else
+    {
+        exitcode = WEXITSTATUS(status);
+    }
+
+    if (job->exitcode == 0)
+        job->exitcode = exitcode != 0 ? exitcode : EXITCODE_INTERNAL_ERROR;
+
+    unit->done = true;
+    write_ready(job);
+}
+
+/* Units that are done and next in order, failed ones have no output */
+static void write_ready(struct dump_job *job)
+{
+    while (job->written != job->count && job->units[job->written].done)
+    {
+        struct dump_unit *unit;
+
+        unit = &job->units[job->written];
+
+        if (unit->output != NULL)
+        {
+            write_unit(job->out, unit->file_name, unit->output->buffer,
+                unit->output->used);
+            writer_destroy(unit->output);
+            unit->output = NULL;
+        }
+
+        job->written += 1;
+    }
+}
+
+/* Tell units apart, a single input is dumped without this line */
+static void write_unit(struct writer *out, char *file_name,
+    const char *data, size_t size)
+{
+    WRITER_PUT_LITERAL(out, "File: ");
+    writer_put_string(out, file_name);
+    WRITER_PUT_LITERAL(out, "\n\n");
+
+    writer_put_buffer(out, data, size);
 }
 
 static struct arguments *register_options(void)
@@ -98,158 +1423,431 @@ static struct arguments *register_options(void)
 
     args = arg_create_struct();
 
-    info = arg_create_switch_info(true);
+    info = arg_create_switch_info(args, true);
     arg_add_long(info, "output");
     arg_add_long(info, "output-file");
     arg_add_short(info, 'o');
     arg_register(args, info);
 
+    info = arg_create_switch_info(args, true);
+    arg_add_long(info, "format");
+    arg_register(args, info);
+
+    info = arg_create_switch_info(args, true);
+    arg_add_long(info, "jobs");
+    arg_add_short(info, 'j');
+    arg_register(args, info);
+
+    info = arg_create_switch_info(args, false);
+    arg_add_long(info, "summary");
+    arg_register(args, info);
+
+    info = arg_create_switch_info(args, true);
+    arg_add_long(info, "top");
+    arg_register(args, info);
+
+    info = arg_create_switch_info(args, true);
+    arg_add_long(info, "manifest");
+    arg_register(args, info);
+
+    info = arg_create_switch_info(args, true);
+    arg_add_long(info, "cache-dir");
+    arg_register(args, info);
+
+    info = arg_create_switch_info(args, true);
+    arg_add_long(info, "cache-size");
+    arg_register(args, info);
+
+    info = arg_create_switch_info(args, false);
+    arg_add_long(info, "incremental");
+    arg_register(args, info);
+
+    info = arg_create_switch_info(args, true);
+    arg_add_long(info, "depfile");
+    arg_register(args, info);
+
+    info = arg_create_switch_info(args, false);
+    arg_add_long(info, "processes");
+    arg_register(args, info);
+
     return args;
 }
 
 
-static FILE *get_output_stream(struct arguments *args)
+/* NULL if output goes to stdout */
+static char *get_output_name(struct arguments *args)
 {
-    char *file_name;
     struct switch_info *info;
-    FILE *fd;
 
     info = arg_find_long(args, "output");
     assert(info != NULL);
 
     if (info->occurrences > 1)
     {
-        fprintf(stderr, "Expected up to one occurrence of option output, "
-            "got more\n");
-        printf("%d\n", info->occurrences);
-        exit(EXITCODE_INVOCATION_ERROR);
+        fatal(EXITCODE_INVOCATION_ERROR,
+            "Expected up to one occurrence of option output, "
+            "got more");
     }
 
-    /* Output stream defaults to stdout */
     if (info->occurrences == 0)
-        return stdout;
+        return NULL;
+
+    return info->parameters.data[0];
+}
 
-    file_name = info->parameters[0];
+/* Make rules for outputs, NULL if none were asked for */
+static char *get_depfile(struct arguments *args)
+{
+    struct switch_info *info;
 
-    fd = fopen(file_name, "w");
+    info = arg_find_long(args, "depfile");
+    assert(info != NULL);
 
-    if (fd == NULL)
+    if (info->occurrences > 1)
+    {
+        fatal(EXITCODE_INVOCATION_ERROR,
+            "Expected up to one occurrence of option depfile, "
+            "got more");
+    }
+
+    if (info->occurrences == 0)
+        return NULL;
+
+    return info->parameters.data[0];
+}
+
+/*
+  Everything besides the source that changes the output of a unit,
+  outputs made with other flags aren't up to date, see unit_current
+*/
+static void get_flags(enum dump_format format, size_t top, char *flags)
+{
+    switch (format)
     {
-        fprintf(stderr, "Failed to open file '%s' for reading: %s\n",
+    case FORMAT_TEXT:
+        snprintf(flags, DUMP_FLAGS_SIZE, "lunits %d format=text",
+            DUMP_CACHE_VERSION);
+        break;
+    case FORMAT_BINARY:
+        snprintf(flags, DUMP_FLAGS_SIZE, "lunits %d format=binary",
+            DUMP_CACHE_VERSION);
+        break;
+    case FORMAT_SUMMARY:
+        snprintf(flags, DUMP_FLAGS_SIZE, "lunits %d summary top=%zu",
+            DUMP_CACHE_VERSION, top);
+        break;
+    }
+}
+
+/* Output goes through a writer, it doesn't need stdio buffering */
+static int open_output(char *file_name)
+{
+    int fd;
+
+    fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    if (fd == -1)
+    {
+        fatal(EXITCODE_INTERNAL_ERROR,
+            "Failed to open file '%s' for writing: %s",
             file_name, strerror(errno));
-        exit(EXITCODE_INTERNAL_ERROR);
     }
 
     return fd;
 }
 
-static FILE *get_input_stream(struct arguments *args)
+/* Format defaults to text, last occurrence wins */
+static enum dump_format get_format(struct arguments *args)
 {
-    char *file_name;
-    FILE *fd;
+    struct switch_info *info;
+    char *format;
+
+    info = arg_find_long(args, "format");
+    assert(info != NULL);
 
-    if (args->parameter_count == 0)
+    if (arg_find_long(args, "summary")->occurrences != 0)
     {
-        fputs("No input files", stderr);
-        exit(EXITCODE_INVOCATION_ERROR);
+        if (info->occurrences != 0)
+        {
+            fatal(EXITCODE_INVOCATION_ERROR,
+                "Options summary and format are mutually exclusive");
+        }
+
+        return FORMAT_SUMMARY;
     }
 
-    if (args->parameter_count > 1)
+    if (info->occurrences == 0)
+        return FORMAT_TEXT;
+
+    format = info->parameters.data[info->occurrences - 1];
+
+    if (strcmp(format, "text") == 0)
+        return FORMAT_TEXT;
+
+    if (strcmp(format, "binary") == 0)
+        return FORMAT_BINARY;
+
+    fatal(EXITCODE_INVOCATION_ERROR,
+        "Unknown format '%s', expected text or binary", format);
+}
+
+/* Defaults to number of online processors, last occurrence wins */
+static size_t get_jobs(struct arguments *args)
+{
+    struct switch_info *info;
+    unsigned long jobs;
+    char *end;
+    long online;
+
+    info = arg_find_long(args, "jobs");
+    assert(info != NULL);
+
+    if (info->occurrences == 0)
     {
-        fputs("Expected one input file, got more\n", stderr);
-        exit(EXITCODE_INVOCATION_ERROR);
+        online = sysconf(_SC_NPROCESSORS_ONLN);
+        return online > 0 ? online : 1;
     }
 
-    file_name = args->parameters[0];
+    errno = 0;
+    jobs = strtoul(info->parameters.data[info->occurrences - 1], &end, 10);
+
+    if (errno != 0 || *end != '\0' || jobs == 0)
+    {
+        fatal(EXITCODE_INVOCATION_ERROR,
+            "Option jobs expects a positive number");
+    }
 
-    fd = fopen(file_name, "r");
+    return jobs;
+}
 
-    if (fd == NULL)
+/* Number of identifiers listed by --summary */
+static size_t get_top(struct arguments *args)
+{
+    struct switch_info *info;
+    unsigned long top;
+    char *end;
+
+    info = arg_find_long(args, "top");
+    assert(info != NULL);
+
+    if (info->occurrences == 0)
+        return SUMMARY_DEFAULT_TOP;
+
+    errno = 0;
+    top = strtoul(info->parameters.data[info->occurrences - 1], &end, 10);
+
+    if (errno != 0 || *end != '\0')
     {
-        fprintf(stderr, "Failed to open file '%s' for writing: %s\n",
-            file_name, strerror(errno));
-        exit(EXITCODE_INTERNAL_ERROR);
+        fatal(EXITCODE_INVOCATION_ERROR, "Option top expects a number");
     }
 
-    return fd;
+    return top;
 }
 
-static void log_lunit(FILE *fd, struct lunit *lunit)
+/*
+  Cache directory and its size limit in megabytes come from options,
+  environment otherwise, last occurrence wins
+  Summaries have timings in them, they are never cached
+  Returns NULL if there is no cache
+*/
+static struct cache *get_cache(struct arguments *args,
+    enum dump_format format)
 {
-    struct lstring *log;
+    struct switch_info *info;
+    unsigned long size;
+    char *dir;
+    char *limit;
+    char *end;
+
+    info = arg_find_long(args, "cache-dir");
+    assert(info != NULL);
+
+    if (info->occurrences != 0)
+        dir = info->parameters.data[info->occurrences - 1];
+    else
+        dir = getenv(CACHE_DIR_ENV);
+
+    info = arg_find_long(args, "cache-size");
+    assert(info != NULL);
+
+    if (info->occurrences != 0)
+        limit = info->parameters.data[info->occurrences - 1];
+    else
+        limit = getenv(CACHE_SIZE_ENV);
 
-    log = lstring_create();
+    size = CACHE_DEFAULT_SIZE;
 
-    log_token(log, lunit);
-    log_lexme(log, lunit);
-    log_line(log, lunit);
-    log_column(log, lunit);
-    log_length(log, lunit);
-    lstring_append_string(log, "\n");
+    if (limit != NULL)
+    {
+        errno = 0;
+        size = strtoul(limit, &end, 10);
+
+        if (errno != 0 || *end != '\0' || size == 0
+            || size > SIZE_MAX / (1024 * 1024))
+        {
+            fatal(EXITCODE_INVOCATION_ERROR,
+                "Cache size expects a positive number of megabytes");
+        }
+    }
 
-    lstring_print(log, fd);
-    lstring_destroy(log);
+    if (dir == NULL || *dir == '\0' || format == FORMAT_SUMMARY)
+        return NULL;
+
+    return cache_open(dir, size * 1024 * 1024);
 }
 
-static void log_token(struct lstring *log, struct lunit *lunit)
+/*
+  Inputs given on the command line go to the main output,
+  manifests (--manifest) add units that may have outputs of their own
+*/
+static void get_units(struct arguments *args, struct vector_manifest *units)
 {
-    char *token_str;
+    struct switch_info *info;
+
+    for (size_t i = 0; i != args->parameters.count; ++i)
+    {
+        struct manifest_entry entry;
+
+        entry.input = args->parameters.data[i];
+        entry.output = NULL;
+
+        vector_manifest_push(units, entry);
+    }
+
+    info = arg_find_long(args, "manifest");
+    assert(info != NULL);
+
+    for (int i = 0; i != info->occurrences; ++i)
+    {
+        /* Before reading, a broken manifest is worth watching too */
+        if (memo.input != NULL)
+            memo.input(info->parameters.data[i]);
+
+        arg_read_manifest(args, info->parameters.data[i], units);
+    }
+
+    if (memo.input == NULL)
+        return;
 
-    token_str = token_to_str(lunit->token);
-    lstring_append_string(log, "Token: ");
-    lstring_append_string(log, token_str);
-    lstring_append_string(log, "\n");
+    for (size_t i = 0; i != units->count; ++i)
+        memo.input(units->data[i].input);
 }
 
-static void log_lexme(struct lstring *log, struct lunit *lunit)
+static void check_units(struct vector_manifest *units,
+    enum dump_format format)
 {
-    enum token t;
+    if (units->count == 0)
+    {
+        fatal(EXITCODE_INVOCATION_ERROR, "No input files");
+    }
 
-    t = lunit->token;
+    if (format != FORMAT_BINARY || units->count == 1)
+        return;
 
-    if (t != TOK_EOL && t != TOK_EOF && t != TOK_TAB)
+    /* Binary file has one header, it can't hold more than one unit */
+    for (size_t i = 0; i != units->count; ++i)
     {
-        lstring_append_string(log, "Lexme: ");
-        lstring_append_lstring(log, lunit->lexme);
-        lstring_append_string(log, "\n");
+        if (units->data[i].output == NULL)
+        {
+            fatal(EXITCODE_INVOCATION_ERROR,
+                "Binary format expects one input file per output file");
+        }
     }
 }
 
-static void log_line(struct lstring *log, struct lunit *lunit)
+/*
+  Inputs that aren't remembered must be readable, workers have no
+  fatal frame to fail to, see mkc watch
+  One deleted right after this check still ends the process
+*/
+static void check_forgotten(struct vector_manifest *units)
 {
-    lstring_append_string(log, "Line: ");
-    lstring_append_size(log, lunit->line);
-    lstring_append_string(log, "\n");
+    for (size_t i = 0; i != units->count; ++i)
+    {
+        bool remembered;
+
+        pthread_mutex_lock(&memo.lock);
+        remembered = memo_entry(units->data[i].input)->output != NULL;
+        pthread_mutex_unlock(&memo.lock);
+
+        if (remembered == false && access(units->data[i].input, R_OK) == -1)
+        {
+            fatal(EXITCODE_INVOCATION_ERROR,
+                "Failed to open file '%s' for reading: %s",
+                units->data[i].input, strerror(errno));
+        }
+    }
 }
 
-static void log_column(struct lstring *log, struct lunit *lunit)
+/* Inputs come from memory if file_cache is enabled and has them */
+static FILE *open_input(char *file_name, struct file_cache_entry **entry)
 {
-    lstring_append_string(log, "Column: ");
-    lstring_append_size(log, lunit->column);
-    lstring_append_string(log, "\n");
+    FILE *fd;
+
+    fd = file_cache_open(file_name, entry);
+
+    if (fd == NULL)
+    {
+        fatal(EXITCODE_INTERNAL_ERROR,
+            "Failed to open file '%s' for reading: %s",
+            file_name, strerror(errno));
+    }
+
+    return fd;
 }
 
-static void log_length(struct lstring *log, struct lunit *lunit)
+static void log_lunit(struct writer *out, struct lunit *lunit)
 {
-    lstring_append_string(log, "Length: ");
-    lstring_append_size(log, lunit->lexme->length);
-    lstring_append_string(log, "\n");
+    log_token(out, lunit);
+    log_lexme(out, lunit);
+    log_line(out, lunit);
+    log_column(out, lunit);
+    log_length(out, lunit);
+    WRITER_PUT_LITERAL(out, "\n");
 }
 
+static void log_token(struct writer *out, struct lunit *lunit)
+{
+    const char *token_str;
+    size_t length;
 
-#define CASE(tok) case tok: return #tok;
+    token_str = token_name(lunit->token, &length);
+    WRITER_PUT_LITERAL(out, "Token: ");
+    writer_put_buffer(out, token_str, length);
+    WRITER_PUT_LITERAL(out, "\n");
+}
 
-static char *token_to_str(enum token token)
+static void log_lexme(struct writer *out, struct lunit *lunit)
 {
-    switch (token)
+    enum token t;
+
+    t = lunit->token;
+
+    if (t != TOK_EOL && t != TOK_EOF && t != TOK_TAB)
     {
-        CASE(TOK_PROCEDURE)
-        CASE(TOK_RETURN)
-        CASE(TOK_IDENTIFIER)
-        CASE(TOK_INTEGER)
-        CASE(TOK_TAB)
-        CASE(TOK_EOL)
-        CASE(TOK_EOF)
-        CASE(TOK_UNKNOWN)
+        WRITER_PUT_LITERAL(out, "Lexme: ");
+        writer_put_lstring(out, &lunit->lexme);
+        WRITER_PUT_LITERAL(out, "\n");
     }
 }
+
+static void log_line(struct writer *out, struct lunit *lunit)
+{
+    WRITER_PUT_LITERAL(out, "Line: ");
+    writer_put_size(out, lunit->line);
+    WRITER_PUT_LITERAL(out, "\n");
+}
+
+static void log_column(struct writer *out, struct lunit *lunit)
+{
+    WRITER_PUT_LITERAL(out, "Column: ");
+    writer_put_size(out, lunit->column);
+    WRITER_PUT_LITERAL(out, "\n");
+}
+
+static void log_length(struct writer *out, struct lunit *lunit)
+{
+    WRITER_PUT_LITERAL(out, "Length: ");
+    writer_put_size(out, lunit->lexme.length);
+    WRITER_PUT_LITERAL(out, "\n");
+}
@@ -2,5 +2,8 @@
 #define _MAIN_DUMP_LUNITS_H_
 
 void dump_lunits(int argc, char **argv);
+void dump_lunits_keep_warm(void);
+void dump_lunits_remember(void (*input)(const char *file_name));
+void dump_lunits_forget(const char *file_name);
 
 #endif
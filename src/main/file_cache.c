@@ -0,0 +1,273 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <common/intern.h>
+#include <common/memory.h>
+#include <common/vector.h>
+
+#include "file_cache.h"
+
+/* Files larger than this fraction of the budget are never cached */
+#define FILE_CACHE_LARGEST_FRACTION 4
+
+/*
+  Contents of one file, identified by device and inode so that
+  the same file opened through different paths or working directories
+  is found, size and times tell whether it changed since it was read
+  data is NULL for evicted entries, users counts streams reading it
+*/
+struct file_cache_entry
+{
+    char *data;
+    size_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+    size_t users;
+    uint64_t last_use;
+};
+
+/* Entries don't move when the vector grows, streams point to them */
+VECTOR(vector_file_cache_entry, struct file_cache_entry *)
+
+/*
+  Inputs kept in memory between requests of mkc serve
+  keys interns device and inode, its ids index entries
+*/
+struct file_cache
+{
+    bool enabled;
+    pthread_mutex_t lock;
+    struct intern *keys;
+    struct vector_file_cache_entry entries;
+    size_t max_bytes;
+    size_t bytes;
+    uint64_t clock;
+};
+
+static struct file_cache_entry *lookup(struct stat *info);
+static bool fresh(struct file_cache_entry *entry, struct stat *info);
+static bool load(struct file_cache_entry *entry, const char *file_name,
+    struct stat *info);
+static void evict(size_t needed);
+
+static struct file_cache cache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+
+/* Call before starting threads */
+void file_cache_enable(size_t max_bytes)
+{
+    cache.enabled = true;
+    cache.keys = intern_create(MEM_SOURCE);
+    vector_file_cache_entry_init(&cache.entries, MEM_SOURCE);
+    cache.max_bytes = max_bytes;
+}
+
+/*
+  Same as fopen(file_name, "r") but served from memory when the file
+  didn't change since it was last read
+  Pass the stream and entry to file_cache_close
+  Returns NULL and sets errno on failure
+*/
+FILE *file_cache_open(const char *file_name, struct file_cache_entry **entry)
+{
+    struct file_cache_entry *found;
+    struct stat info;
+    FILE *fd;
+
+    *entry = NULL;
+
+    if (cache.enabled == false)
+        return fopen(file_name, "r");
+
+    if (stat(file_name, &info) == -1)
+        return NULL;
+
+    if (S_ISREG(info.st_mode) == false
+        || (size_t) info.st_size
+            > cache.max_bytes / FILE_CACHE_LARGEST_FRACTION)
+    {
+        return fopen(file_name, "r");
+    }
+
+    pthread_mutex_lock(&cache.lock);
+
+    found = lookup(&info);
+
+    /* Stale contents someone still reads can't be replaced yet */
+    if (found->data != NULL && fresh(found, &info) == false
+        && found->users != 0)
+    {
+        pthread_mutex_unlock(&cache.lock);
+        return fopen(file_name, "r");
+    }
+
+    if (found->data == NULL || fresh(found, &info) == false)
+    {
+        if (load(found, file_name, &info) == false)
+        {
+            pthread_mutex_unlock(&cache.lock);
+            return NULL;
+        }
+    }
+
+    fd = fmemopen(found->data, found->size, "r");
+
+    if (fd != NULL)
+    {
+        found->users += 1;
+        found->last_use = ++cache.clock;
+        *entry = found;
+    }
+
+    pthread_mutex_unlock(&cache.lock);
+
+    return fd;
+}
+
+void file_cache_close(FILE *fd, struct file_cache_entry *entry)
+{
+    fclose(fd);
+
+    if (entry == NULL)
+        return;
+
+    pthread_mutex_lock(&cache.lock);
+    entry->users -= 1;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/* Existing entry or a new empty one, cache.lock must be held */
+static struct file_cache_entry *lookup(struct stat *info)
+{
+    uint64_t key[2];
+    size_t id;
+
+    key[0] = info->st_dev;
+    key[1] = info->st_ino;
+
+    id = intern_add(cache.keys, (const char *) key, sizeof(key));
+
+    if (id == cache.entries.count)
+    {
+        struct file_cache_entry *entry;
+
+        entry = mem_alloc(MEM_SOURCE, sizeof(struct file_cache_entry));
+        entry->data = NULL;
+        entry->size = 0;
+        entry->users = 0;
+        entry->last_use = 0;
+
+        vector_file_cache_entry_push(&cache.entries, entry);
+    }
+
+    return cache.entries.data[id];
+}
+
+static bool fresh(struct file_cache_entry *entry, struct stat *info)
+{
+    return entry->size == (size_t) info->st_size
+        && entry->mtime.tv_sec == info->st_mtim.tv_sec
+        && entry->mtime.tv_nsec == info->st_mtim.tv_nsec
+        && entry->ctime.tv_sec == info->st_ctim.tv_sec
+        && entry->ctime.tv_nsec == info->st_ctim.tv_nsec;
+}
+
+/*
+  Read the whole file into entry, nobody may be reading entry
+  Times come from the opened file, if it changes while we read it
+  the next open sees different times and reads it again
+*/
+static bool load(struct file_cache_entry *entry, const char *file_name,
+    struct stat *info)
+{
+    size_t done;
+    int fd;
+
+    if (entry->data != NULL)
+    {
+        mem_free(MEM_SOURCE, entry->data);
+        cache.bytes -= entry->size;
+        entry->data = NULL;
+    }
+
+    fd = open(file_name, O_RDONLY);
+
+    if (fd == -1)
+        return false;
+
+    if (fstat(fd, info) == -1)
+    {
+        close(fd);
+        return false;
+    }
+
+    evict(info->st_size);
+
+    /* One more byte, fmemopen of an empty buffer still needs a pointer */
+    entry->data = mem_alloc(MEM_SOURCE, info->st_size + 1);
+    done = 0;
+
+    while (done != (size_t) info->st_size)
+    {
+        ssize_t result;
+
+        result = read(fd, &entry->data[done], info->st_size - done);
+
+        if (result == -1 && errno == EINTR)
+            continue;
+
+        /* Truncated meanwhile, cache what is there */
+        if (result <= 0)
+            break;
+
+        done += result;
+    }
+
+    close(fd);
+
+    entry->size = done;
+    entry->mtime = info->st_mtim;
+    entry->ctime = info->st_ctim;
+    cache.bytes += done;
+
+    return true;
+}
+
+/* Drop least recently used contents until needed more bytes fit */
+static void evict(size_t needed)
+{
+    while (cache.bytes + needed > cache.max_bytes)
+    {
+        struct file_cache_entry *oldest;
+
+        oldest = NULL;
+
+        for (size_t i = 0; i != cache.entries.count; ++i)
+        {
+            struct file_cache_entry *entry;
+
+            entry = cache.entries.data[i];
+
+            if (entry->data == NULL || entry->users != 0)
+                continue;
+
+            if (oldest == NULL || entry->last_use < oldest->last_use)
+                oldest = entry;
+        }
+
+        /* Everything left is being read, go over budget for a while */
+        if (oldest == NULL)
+            return;
+
+        mem_free(MEM_SOURCE, oldest->data);
+        cache.bytes -= oldest->size;
+        oldest->data = NULL;
+    }
+}
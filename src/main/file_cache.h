@@ -0,0 +1,16 @@
+#ifndef _MAIN_FILE_CACHE_H_
+#define _MAIN_FILE_CACHE_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* Default budget of mkc serve workers */
+#define FILE_CACHE_DEFAULT_BYTES (64 * 1024 * 1024)
+
+struct file_cache_entry;
+
+void file_cache_enable(size_t max_bytes);
+FILE *file_cache_open(const char *file_name, struct file_cache_entry **entry);
+void file_cache_close(FILE *fd, struct file_cache_entry *entry);
+
+#endif
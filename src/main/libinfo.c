@@ -0,0 +1,223 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <common/exitcodes.h>
+#include <common/fatal.h>
+#include <common/memory.h>
+#include <common/sha256.h>
+#include <lexer/lunit.h>
+#include <libmkc/mkc.h>
+
+#include "libinfo.h"
+
+/* Every field is on a line of its own, flags make the longest one */
+#define LIBINFO_LINE_SIZE (LIBINFO_FLAGS_SIZE + 16)
+
+/* Fields of struct libinfo, set while reading */
+#define FIELD_VERSION 1
+#define FIELD_FLAGS 2
+#define FIELD_SOURCE 4
+#define FIELD_INTERFACE 8
+#define FIELD_OUTPUT 16
+#define FIELD_ALL 31
+
+static bool parse_line(char *line, struct libinfo *info, unsigned int *fields);
+static bool parse_digest(const char *hex, unsigned char *digest);
+static void print_digest(FILE *fd, const unsigned char *digest);
+
+
+/* Allocated, free with mem_free(MEM_OUTPUT, ...) */
+char *libinfo_name(const char *output_name)
+{
+    char *name;
+    size_t length;
+
+    length = strlen(output_name);
+
+    name = mem_alloc(MEM_OUTPUT, length + sizeof(LIBINFO_SUFFIX));
+    memcpy(name, output_name, length);
+    memcpy(&name[length], LIBINFO_SUFFIX, sizeof(LIBINFO_SUFFIX));
+
+    return name;
+}
+
+/*
+  Returns false if the file is missing, written by another version
+  of mkc or not understood, the unit has to be built again then
+*/
+bool libinfo_read(const char *file_name, struct libinfo *info)
+{
+    char line[LIBINFO_LINE_SIZE];
+    unsigned int fields;
+    bool valid;
+    FILE *fd;
+
+    fd = fopen(file_name, "r");
+
+    if (fd == NULL)
+        return false;
+
+    fields = 0;
+    valid = true;
+
+    while (valid && fgets(line, sizeof(line), fd) != NULL)
+        valid = parse_line(line, info, &fields);
+
+    fclose(fd);
+
+    return valid && fields == FIELD_ALL;
+}
+
+/* Output is complete already, failing to record it is still fatal */
+void libinfo_write(const char *file_name, const struct libinfo *info)
+{
+    FILE *fd;
+
+    fd = fopen(file_name, "w");
+
+    if (fd == NULL)
+    {
+        fatal(EXITCODE_INTERNAL_ERROR,
+            "Failed to open file '%s' for writing: %s",
+            file_name, strerror(errno));
+    }
+
+    fprintf(fd, "V mkc %s %d\n", mkc_version(), LIBINFO_VERSION);
+    fprintf(fd, "F %s\n", info->flags);
+    fputs("S ", fd);
+    print_digest(fd, info->source);
+    fputs("I ", fd);
+    print_digest(fd, info->interface);
+    fprintf(fd, "O %" PRIu64 " %lld %ld\n", info->output_size,
+        (long long) info->output_mtime.tv_sec,
+        (long) info->output_mtime.tv_nsec);
+
+    if (ferror(fd) | fclose(fd))
+    {
+        fatal(EXITCODE_INTERNAL_ERROR, "Failed to write file '%s'",
+            file_name);
+    }
+}
+
+void libinfo_interface_init(struct libinfo_interface *interface)
+{
+    sha256_init(&interface->sha);
+    interface->after_procedure = false;
+    interface->known = false;
+}
+
+/* Name of every procedure declaration, with a terminator */
+void libinfo_interface_add(struct libinfo_interface *interface,
+    struct lunit *lunit)
+{
+    if (interface->after_procedure && lunit->token == TOK_IDENTIFIER)
+    {
+        sha256_update(&interface->sha, lunit->lexme.text,
+            lunit->lexme.length);
+        sha256_update(&interface->sha, "", 1);
+    }
+
+    interface->after_procedure = lunit->token == TOK_PROCEDURE;
+}
+
+/* Nothing to do if digest was set directly */
+void libinfo_interface_finish(struct libinfo_interface *interface)
+{
+    if (interface->known)
+        return;
+
+    sha256_final(&interface->sha, interface->digest);
+    interface->known = true;
+}
+
+static bool parse_line(char *line, struct libinfo *info, unsigned int *fields)
+{
+    char version[LIBINFO_LINE_SIZE];
+    char *end;
+    unsigned long long size;
+    long long seconds;
+    long nanoseconds;
+    int layout;
+
+    end = strchr(line, '\n');
+
+    /* Lines are never this long, the file isn't ours */
+    if (end == NULL)
+        return false;
+
+    *end = '\0';
+
+    switch (line[0])
+    {
+    case 'V':
+        if (sscanf(line, "V mkc %s %d", version, &layout) != 2
+            || strcmp(version, mkc_version()) != 0
+            || layout != LIBINFO_VERSION)
+            return false;
+
+        *fields |= FIELD_VERSION;
+        return true;
+
+    case 'F':
+        if (line[1] != ' ' || strlen(&line[2]) >= LIBINFO_FLAGS_SIZE)
+            return false;
+
+        strcpy(info->flags, &line[2]);
+        *fields |= FIELD_FLAGS;
+        return true;
+
+    case 'S':
+        *fields |= FIELD_SOURCE;
+        return line[1] == ' ' && parse_digest(&line[2], info->source);
+
+    case 'I':
+        *fields |= FIELD_INTERFACE;
+        return line[1] == ' ' && parse_digest(&line[2], info->interface);
+
+    case 'O':
+        if (sscanf(line, "O %llu %lld %ld", &size, &seconds,
+            &nanoseconds) != 3)
+            return false;
+
+        info->output_size = size;
+        info->output_mtime.tv_sec = seconds;
+        info->output_mtime.tv_nsec = nanoseconds;
+        *fields |= FIELD_OUTPUT;
+        return true;
+
+    default:
+        /* Written by a newer mkc, can't tell whether it's up to date */
+        return false;
+    }
+}
+
+static bool parse_digest(const char *hex, unsigned char *digest)
+{
+    if (strlen(hex) != 2 * SHA256_DIGEST_SIZE)
+        return false;
+
+    for (size_t i = 0; i != SHA256_DIGEST_SIZE; ++i)
+    {
+        unsigned int byte;
+
+        if (sscanf(&hex[2 * i], "%2x", &byte) != 1)
+            return false;
+
+        digest[i] = byte;
+    }
+
+    return true;
+}
+
+static void print_digest(FILE *fd, const unsigned char *digest)
+{
+    for (size_t i = 0; i != SHA256_DIGEST_SIZE; ++i)
+        fprintf(fd, "%02x", digest[i]);
+
+    fputc('\n', fd);
+}
@@ -0,0 +1,66 @@
+#ifndef _MAIN_LIBINFO_H_
+#define _MAIN_LIBINFO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <common/sha256.h>
+#include <lexer/lunit.h>
+
+/* Information file of output foo.txt is foo.txt.li */
+#define LIBINFO_SUFFIX ".li"
+
+/* Bump when the layout of information files changes */
+#define LIBINFO_VERSION 1
+
+/* Longest line of flags, see struct libinfo */
+#define LIBINFO_FLAGS_SIZE 128
+
+/*
+  Library information file of one unit, after Ada's ALI files
+  It records what the output of the unit was made from: the source,
+  the flags that change the output and the version of mkc, together
+  with the size and modification time of the output itself
+  If all of them are still the same the output is up to date
+  interface identifies what other units can see, for now the names
+  of procedures the unit declares in order; once Kres has imports their
+  information files and interfaces will be recorded too, so that
+  importers are rebuilt only when an interface they use changes
+  Text, one line per field:
+    V mkc <version> <LIBINFO_VERSION>
+    F <flags>
+    S <hex digest of the source>
+    I <hex digest of the interface>
+    O <size> <seconds> <nanoseconds>
+*/
+struct libinfo
+{
+    char flags[LIBINFO_FLAGS_SIZE];
+    unsigned char source[SHA256_DIGEST_SIZE];
+    unsigned char interface[SHA256_DIGEST_SIZE];
+    uint64_t output_size;
+    struct timespec output_mtime;
+};
+
+/*
+  Interface of a unit collected from its lunits, see libinfo_interface_add
+  digest is valid once known is set
+*/
+struct libinfo_interface
+{
+    struct sha256 sha;
+    bool after_procedure;
+    bool known;
+    unsigned char digest[SHA256_DIGEST_SIZE];
+};
+
+char *libinfo_name(const char *output_name);
+bool libinfo_read(const char *file_name, struct libinfo *info);
+void libinfo_write(const char *file_name, const struct libinfo *info);
+void libinfo_interface_init(struct libinfo_interface *interface);
+void libinfo_interface_add(struct libinfo_interface *interface,
+    struct lunit *lunit);
+void libinfo_interface_finish(struct libinfo_interface *interface);
+
+#endif
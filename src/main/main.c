@@ -1,9 +1,19 @@
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <common/exitcodes.h>
+#include <common/jobserver.h>
+#include <common/memory.h>
+#include <common/perfcount.h>
+#include <common/timer.h>
+#include <common/trace.h>
 
+#include "client.h"
 #include "dump.h"
+#include "serve.h"
+#include "watch.h"
 
 // dump 
 //   lunits
@@ -16,15 +26,45 @@
 // assemble
 // link
 // help
+// serve  run dump and compile requests of clients, see main/serve.c
+// watch  run dump again whenever its inputs change, see main/watch.c
+//
+// dump and compile are forwarded to a running server unless
+// MKC_SERVER is set to an empty string or global options are given
+//
+// Global options go before subcommand
+// --stats  print memory statistics at exit
+// --time-report[=json]  print time spent in every phase at exit
+// --perf-counters  add hardware or software counters to the time report
+// --trace=FILE  write Chrome trace of phases, files and threads to FILE
 
 #define NOT_IMPLEMENTED                 \
     puts("Subcommand not implemented"); \
     return EXITCODE_INVOCATION_ERROR;
 
 
+static int parse_global_options(int argc, char **argv);
+static void print_stats(void);
+static void print_time_report(void);
+static void print_time_report_json(void);
+
 int main(int argc, char **argv)
 {
     char *subcommand;
+    int consumed;
+    int exitcode;
+
+    /*
+      Subcommands expect their name at argv[1]
+      Skip global options, argv[0] is never used by subcommands
+      so it doesn't matter it becomes the last global option
+    */
+    consumed = parse_global_options(argc, argv);
+    argc -= consumed;
+    argv += consumed;
+
+    /* Under make -j extra threads take tokens from make's jobserver */
+    jobserver_init();
 
     if (argc < 2)
     {
@@ -32,6 +72,10 @@ int main(int argc, char **argv)
         return EXITCODE_INVOCATION_ERROR;
     }
 
+    /* Global options describe this process, they need a local run */
+    if (consumed == 0 && client_forward(argc, argv, &exitcode))
+        return exitcode;
+
     /* 0 - program name, 1 - subcommand */
     subcommand = argv[1];
 
@@ -66,6 +110,95 @@ int main(int argc, char **argv)
         NOT_IMPLEMENTED
     }
 
+    if (strcmp(subcommand, "serve") == 0)
+    {
+        serve(argc, argv);
+        return 0;
+    }
+
+    if (strcmp(subcommand, "watch") == 0)
+    {
+        watch(argc, argv);
+        return 0;
+    }
+
     printf("No such subcommand: %s\n"
         "Pass help as first argument for help\n", subcommand);
 }
+
+/* Returns number of global options */
+static int parse_global_options(int argc, char **argv)
+{
+    int iter;
+    bool perf_counters;
+
+    perf_counters = false;
+
+    iter = 1;
+
+    while (iter < argc && strncmp(argv[iter], "--", 2) == 0)
+    {
+        if (strcmp(argv[iter], "--stats") == 0)
+        {
+            /* Printed at exit, subcommands may call exit() */
+            atexit(print_stats);
+        }
+        else if (strcmp(argv[iter], "--time-report") == 0)
+        {
+            timer_enable();
+            atexit(print_time_report);
+        }
+        else if (strcmp(argv[iter], "--time-report=json") == 0)
+        {
+            timer_enable();
+            atexit(print_time_report_json);
+        }
+        else if (strcmp(argv[iter], "--perf-counters") == 0)
+        {
+            perf_counters = true;
+        }
+        else if (strncmp(argv[iter], "--trace=", 8) == 0
+            && argv[iter][8] != '\0')
+        {
+            trace_enable(&argv[iter][8]);
+            atexit(trace_write);
+        }
+        else
+        {
+            fprintf(stderr, "Unknown global option %s\n", argv[iter]);
+            exit(EXITCODE_INVOCATION_ERROR);
+        }
+
+        iter += 1;
+    }
+
+    /* Counters are reported with times, print times if nobody asked */
+    if (perf_counters)
+    {
+        if (timer_enabled() == false)
+        {
+            timer_enable();
+            atexit(print_time_report);
+        }
+
+        if (perf_enable() == PERF_NONE)
+            fputs("Performance counters aren't available\n", stderr);
+    }
+
+    return iter - 1;
+}
+
+static void print_stats(void)
+{
+    mem_stats_print(stderr);
+}
+
+static void print_time_report(void)
+{
+    timer_report_print(stderr);
+}
+
+static void print_time_report_json(void)
+{
+    timer_report_print_json(stderr);
+}
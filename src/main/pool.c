@@ -0,0 +1,521 @@
+/* memfd_create */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <common/exitcodes.h>
+#include <common/fatal.h>
+#include <common/jobserver.h>
+#include <common/memory.h>
+#include <common/ring.h>
+#include <common/writer.h>
+
+#include "pool.h"
+
+/* Sent instead of a unit number when a full ring was drained */
+#define POOL_DRAINED UINT32_MAX
+
+/* Ring starts on its own cache line after the control block */
+#define POOL_CONTROL_SIZE RING_CACHE_LINE
+
+/*
+  Start of the shared memory of a worker, the ring follows
+  waiting is set by a worker that found the ring full, the parent
+  answers with POOL_DRAINED once it made room
+*/
+struct pool_control
+{
+    atomic_bool waiting;
+};
+
+/* Precedes every result in the ring, size bytes of data follow */
+struct pool_record
+{
+    uint64_t unit;
+    uint64_t value;
+    uint64_t size;
+};
+
+/*
+  A worker process as the parent sees it
+  Units go to request_fd as 32-bit numbers, closing it tells the worker
+  to exit; the worker writes a byte to result_fd whenever it put
+  something into the ring, end of file means it exited
+  Results are assembled in data, record is the one being received
+  token tells whether it runs on a jobserver token
+*/
+struct pool_worker
+{
+    pid_t pid;
+    int request_fd;
+    int result_fd;
+    struct pool_control *control;
+    struct ring *ring;
+    bool token;
+    bool busy;
+    size_t unit;
+    bool have_record;
+    struct pool_record record;
+    char *data;
+    size_t received;
+    size_t capacity;
+};
+
+/*
+  workers is a fixed array, running of them have been spawned
+  next is the first unit nobody got yet
+*/
+struct pool
+{
+    struct pool_work *work;
+    size_t units;
+    struct pool_worker *workers;
+    size_t count;
+    size_t running;
+    size_t next;
+    size_t finished;
+    void (*sigpipe)(int);
+};
+
+static void spawn(struct pool *pool, struct pool_worker *worker);
+static void assign(struct pool *pool, struct pool_worker *worker);
+static void handle(struct pool *pool, struct pool_worker *worker);
+static void receive(struct pool *pool, struct pool_worker *worker);
+static void reap(struct pool *pool, struct pool_worker *worker);
+static _Noreturn void worker_main(struct pool *pool,
+    struct pool_worker *worker);
+static void send(struct pool_worker *worker, const void *data, size_t size);
+static void worker_exit(int exitcode);
+static void write_full(int fd, const void *data, size_t size);
+
+
+/*
+  Run units on up to workers processes forked from this one, they
+  inherit everything run needs; results come back through a ring in
+  memory shared with each of them (memfd), only wakeups go through
+  pipes, so bulk data is copied once
+  A worker that crashes takes down only the unit it was running,
+  failed is called and a new worker takes its place
+  The first worker runs on the token we were started with, the others
+  need one from make's jobserver if there is one
+  Call it with no other threads running, fork copies only this one
+*/
+void pool_run(struct pool_work *work, size_t units, size_t workers)
+{
+    struct pool pool;
+    struct pollfd *fds;
+
+    if (workers > units)
+        workers = units;
+
+    pool.work = work;
+    pool.units = units;
+    pool.workers = mem_alloc(MEM_OTHER, workers * sizeof(struct pool_worker));
+    pool.count = workers;
+    pool.running = 0;
+    pool.next = 0;
+    pool.finished = 0;
+
+    fds = mem_alloc(MEM_OTHER, workers * sizeof(struct pollfd));
+
+    /* Pipes of a worker the parent lost may not kill the parent */
+    pool.sigpipe = signal(SIGPIPE, SIG_IGN);
+
+    while (pool.running != workers
+        && (pool.running == 0 || jobserver_try_acquire()))
+    {
+        struct pool_worker *worker;
+
+        worker = &pool.workers[pool.running];
+        worker->token = pool.running != 0;
+        spawn(&pool, worker);
+        pool.running += 1;
+
+        assign(&pool, worker);
+    }
+
+    while (pool.finished != units)
+    {
+        int ready;
+
+        for (size_t i = 0; i != pool.running; ++i)
+        {
+            fds[i].fd = pool.workers[i].result_fd;
+            fds[i].events = POLLIN;
+        }
+
+        ready = poll(fds, pool.running, -1);
+
+        if (ready == -1 && errno == EINTR)
+            continue;
+
+        if (ready == -1)
+        {
+            fatal(EXITCODE_INTERNAL_ERROR, "poll failed: %s",
+                strerror(errno));
+        }
+
+        for (size_t i = 0; i != pool.running; ++i)
+        {
+            if (fds[i].revents != 0)
+                handle(&pool, &pool.workers[i]);
+        }
+
+        /* A token became free meanwhile, put it to work */
+        if (pool.running != workers && pool.next != units
+            && jobserver_try_acquire())
+        {
+            struct pool_worker *worker;
+
+            worker = &pool.workers[pool.running];
+            worker->token = true;
+            spawn(&pool, worker);
+            pool.running += 1;
+
+            assign(&pool, worker);
+        }
+    }
+
+    /* Closed request pipes tell workers to exit */
+    for (size_t i = 0; i != pool.running; ++i)
+    {
+        struct pool_worker *worker;
+
+        worker = &pool.workers[i];
+
+        close(worker->request_fd);
+        close(worker->result_fd);
+        waitpid(worker->pid, NULL, 0);
+        munmap(worker->control,
+            POOL_CONTROL_SIZE + ring_size(POOL_RING_CAPACITY));
+        mem_free(MEM_OTHER, worker->data);
+
+        if (worker->token)
+            jobserver_release();
+    }
+
+    signal(SIGPIPE, pool.sigpipe);
+
+    mem_free(MEM_OTHER, fds);
+    mem_free(MEM_OTHER, pool.workers);
+}
+
+/* Shared memory first, so that the forked worker maps it too */
+static void spawn(struct pool *pool, struct pool_worker *worker)
+{
+    int requests[2];
+    int results[2];
+    void *shared;
+    int memfd;
+
+    memfd = memfd_create("mkc-pool", MFD_CLOEXEC);
+
+    if (memfd == -1
+        || ftruncate(memfd,
+            POOL_CONTROL_SIZE + ring_size(POOL_RING_CAPACITY)) == -1)
+    {
+        fatal(EXITCODE_INTERNAL_ERROR,
+            "Failed to create shared memory: %s", strerror(errno));
+    }
+
+    shared = mmap(NULL, POOL_CONTROL_SIZE + ring_size(POOL_RING_CAPACITY),
+        PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    close(memfd);
+
+    if (shared == MAP_FAILED)
+    {
+        fatal(EXITCODE_INTERNAL_ERROR,
+            "Failed to map shared memory: %s", strerror(errno));
+    }
+
+    if (pipe2(requests, O_CLOEXEC) == -1 || pipe2(results, O_CLOEXEC) == -1)
+    {
+        fatal(EXITCODE_INTERNAL_ERROR, "Failed to create pipe: %s",
+            strerror(errno));
+    }
+
+    worker->control = shared;
+    worker->ring = (struct ring *) ((char *) shared + POOL_CONTROL_SIZE);
+    atomic_init(&worker->control->waiting, false);
+    ring_init(worker->ring, POOL_RING_CAPACITY);
+
+    worker->request_fd = requests[1];
+    worker->result_fd = results[0];
+    worker->busy = false;
+    worker->have_record = false;
+    worker->data = NULL;
+    worker->received = 0;
+    worker->capacity = 0;
+
+    /* Don't let the worker write out our buffered output again */
+    fflush(NULL);
+
+    worker->pid = fork();
+
+    if (worker->pid == -1)
+    {
+        fatal(EXITCODE_INTERNAL_ERROR, "fork failed: %s", strerror(errno));
+    }
+
+    if (worker->pid == 0)
+    {
+        close(requests[1]);
+        close(results[0]);
+        worker->request_fd = requests[0];
+        worker->result_fd = results[1];
+
+        worker_main(pool, worker);
+    }
+
+    close(requests[0]);
+    close(results[1]);
+}
+
+/* Next unit if there is one, otherwise the worker stays idle */
+static void assign(struct pool *pool, struct pool_worker *worker)
+{
+    uint32_t unit;
+
+    if (pool->next == pool->units)
+        return;
+
+    unit = pool->next;
+    pool->next += 1;
+
+    worker->busy = true;
+    worker->unit = unit;
+
+    /* Worker that died before reading it is noticed by handle */
+    write(worker->request_fd, &unit, sizeof(unit));
+}
+
+/* result_fd is readable: wakeups or end of file */
+static void handle(struct pool *pool, struct pool_worker *worker)
+{
+    char wakeups[64];
+    ssize_t count;
+
+    count = read(worker->result_fd, wakeups, sizeof(wakeups));
+
+    if (count == -1 && errno == EINTR)
+        return;
+
+    receive(pool, worker);
+
+    if (count <= 0)
+    {
+        reap(pool, worker);
+        return;
+    }
+
+    if (atomic_exchange(&worker->control->waiting, false))
+    {
+        uint32_t drained;
+
+        drained = POOL_DRAINED;
+        write(worker->request_fd, &drained, sizeof(drained));
+    }
+}
+
+/* Take whatever the ring holds, complete results go to done */
+static void receive(struct pool *pool, struct pool_worker *worker)
+{
+    while (true)
+    {
+        size_t wanted;
+
+        if (worker->have_record == false)
+        {
+            if (ring_readable(worker->ring) < sizeof(struct pool_record))
+                return;
+
+            ring_read(worker->ring, &worker->record,
+                sizeof(struct pool_record));
+            worker->have_record = true;
+            worker->received = 0;
+
+            if (worker->record.size > worker->capacity)
+            {
+                worker->data = mem_realloc(MEM_OTHER, worker->data,
+                    worker->record.size);
+                worker->capacity = worker->record.size;
+            }
+        }
+
+        wanted = worker->record.size - worker->received;
+        worker->received += ring_read(worker->ring,
+            &worker->data[worker->received], wanted);
+
+        if (worker->received != worker->record.size)
+            return;
+
+        worker->have_record = false;
+        worker->busy = false;
+        pool->finished += 1;
+
+        pool->work->done(pool->work->context, worker->record.unit,
+            worker->record.value, worker->data, worker->record.size);
+
+        assign(pool, worker);
+    }
+}
+
+/*
+  Worker exited on its own, it only does that when it fails, or was
+  killed; its unit is lost, a new worker takes its place
+*/
+static void reap(struct pool *pool, struct pool_worker *worker)
+{
+    int status;
+
+    close(worker->request_fd);
+    close(worker->result_fd);
+    waitpid(worker->pid, &status, 0);
+    munmap(worker->control,
+        POOL_CONTROL_SIZE + ring_size(POOL_RING_CAPACITY));
+    mem_free(MEM_OTHER, worker->data);
+
+    if (worker->busy)
+    {
+        pool->finished += 1;
+        pool->work->failed(pool->work->context, worker->unit, status);
+    }
+
+    /* Same slot, same token */
+    spawn(pool, worker);
+    assign(pool, worker);
+}
+
+/*
+  Runs units until the request pipe is closed
+  Descriptors of other workers are closed so that their end of file
+  isn't held up by us
+*/
+static _Noreturn void worker_main(struct pool *pool,
+    struct pool_worker *worker)
+{
+    struct writer *out;
+
+    for (size_t i = 0; i != pool->running; ++i)
+    {
+        if (&pool->workers[i] == worker)
+            continue;
+
+        close(pool->workers[i].request_fd);
+        close(pool->workers[i].result_fd);
+    }
+
+    /* Exit handlers belong to the parent, e.g. jobserver tokens */
+    fatal_set_exit_hook(worker_exit);
+    signal(SIGPIPE, pool->sigpipe);
+
+    out = writer_create_memory();
+
+    while (true)
+    {
+        struct pool_record record;
+        uint32_t unit;
+        ssize_t count;
+
+        count = read(worker->request_fd, &unit, sizeof(unit));
+
+        if (count == -1 && errno == EINTR)
+            continue;
+
+        if (count != sizeof(unit))
+            _exit(0);
+
+        if (unit == POOL_DRAINED)
+            continue;
+
+        writer_clear(out);
+
+        record.unit = unit;
+        record.value = pool->work->run(pool->work->context, unit, out);
+        record.size = out->used;
+
+        send(worker, &record, sizeof(record));
+        send(worker, out->buffer, out->used);
+    }
+}
+
+/* Waits for the parent whenever the ring is full */
+static void send(struct pool_worker *worker, const void *data, size_t size)
+{
+    while (true)
+    {
+        size_t written;
+        char wakeup;
+
+        written = ring_write(worker->ring, data, size);
+        data = (const char *) data + written;
+        size -= written;
+
+        wakeup = 0;
+
+        if (size == 0)
+        {
+            write_full(worker->result_fd, &wakeup, 1);
+            return;
+        }
+
+        /* Full, the wakeup makes the parent drain it and answer */
+        atomic_store(&worker->control->waiting, true);
+        write_full(worker->result_fd, &wakeup, 1);
+
+        while (true)
+        {
+            uint32_t drained;
+            ssize_t count;
+
+            count = read(worker->request_fd, &drained, sizeof(drained));
+
+            if (count == -1 && errno == EINTR)
+                continue;
+
+            if (count != sizeof(drained))
+                _exit(EXITCODE_EXTERNAL_ERROR);
+
+            if (drained == POOL_DRAINED)
+                break;
+        }
+    }
+}
+
+static void worker_exit(int exitcode)
+{
+    _exit(exitcode);
+}
+
+/* Parent gone means there is nobody to work for */
+static void write_full(int fd, const void *data, size_t size)
+{
+    while (size != 0)
+    {
+        ssize_t written;
+
+        written = write(fd, data, size);
+
+        if (written == -1 && errno == EINTR)
+            continue;
+
+        if (written <= 0)
+            _exit(EXITCODE_EXTERNAL_ERROR);
+
+        data = (const char *) data + written;
+        size -= written;
+    }
+}
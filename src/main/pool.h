@@ -0,0 +1,32 @@
+#ifndef _MAIN_POOL_H_
+#define _MAIN_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <common/writer.h>
+
+/* Bytes of the shared ring of every worker, a power of two */
+#define POOL_RING_CAPACITY (1024 * 1024)
+
+/*
+  Work for a pool, every callback gets context
+  run is called in a worker process, it formats the result of unit
+  into out and returns a number that comes along, e.g. lunits
+  done is called in the parent with that result, data is valid only
+  during the call
+  failed is called in the parent if the worker exited or was killed
+  before finishing unit, status is the one from waitpid
+*/
+struct pool_work
+{
+    void *context;
+    uint64_t (*run)(void *context, size_t unit, struct writer *out);
+    void (*done)(void *context, size_t unit, uint64_t value,
+        const char *data, size_t size);
+    void (*failed)(void *context, size_t unit, int status);
+};
+
+void pool_run(struct pool_work *work, size_t units, size_t workers);
+
+#endif
@@ -0,0 +1,660 @@
+/* accept4, SO_PEERCRED */
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <common/exitcodes.h>
+#include <common/fatal.h>
+#include <common/intern.h>
+#include <common/jobserver.h>
+#include <common/memory.h>
+#include <libmkc/mkc.h>
+
+#include "arguments.h"
+#include "dump.h"
+#include "dump_lunits.h"
+#include "file_cache.h"
+
+#include "serve.h"
+
+/* Connections waiting for a worker */
+#define SERVE_BACKLOG 64
+
+static struct arguments *register_options(void);
+static size_t get_workers(struct arguments *args);
+static int open_socket(char *path);
+static pid_t spawn_worker(int listen_fd);
+static _Noreturn void worker_run(int listen_fd);
+static void handle_connection(int connection);
+static size_t receive_request(int connection,
+    struct serve_request *request, int *fds);
+static char **unpack_arguments(char *buffer, struct serve_request *request);
+static int run_command(int argc, char **argv);
+static void release_client(void);
+static void send_exitcode(int connection, int exitcode);
+static void report_exit(int exitcode);
+static void stop(int signal_number);
+static bool read_all(int fd, void *buffer, size_t size);
+static bool same_user(int connection);
+
+/* Set by SIGTERM and SIGINT in the server process */
+static volatile sig_atomic_t stopping;
+
+/* Connection being served by this worker, -1 between requests */
+static int current_connection = -1;
+
+/* Standard streams of a worker between requests */
+static int null_fd = -1;
+static int log_fd = -1;
+
+
+/*
+  mkc serve [--socket PATH] [-j N]
+  Listens on a Unix socket, N worker processes (number of processors by
+  default) accept connections and run dump and compile requests
+  Workers live across requests so that their allocators, arenas, intern
+  tables and input files stay warm, see dump_lunits_keep_warm
+  and file_cache
+  Processes and not threads because every request needs its own
+  stdout, stderr and working directory, and a crash or fatal error
+  takes down only one worker, which is then started again
+*/
+void serve(int argc, char **argv)
+{
+    struct arguments *args;
+    struct switch_info *info;
+    struct sigaction action;
+    char path[sizeof(((struct sockaddr_un *) NULL)->sun_path)];
+    pid_t *workers;
+    size_t count;
+    int listen_fd;
+
+    args = register_options();
+
+    /* 0 - program name, 1 - subcommand (serve) */
+    arg_parse(args, argc - 2, &argv[2]);
+
+    if (args->parameters.count != 0)
+        fatal(EXITCODE_INVOCATION_ERROR, "serve doesn't take parameters");
+
+    info = arg_find_long(args, "socket");
+    assert(info != NULL);
+
+    if (info->occurrences != 0)
+    {
+        if (strlen(info->parameters.data[info->occurrences - 1])
+            >= sizeof(path))
+            fatal(EXITCODE_INVOCATION_ERROR, "Socket path is too long");
+
+        strcpy(path, info->parameters.data[info->occurrences - 1]);
+    }
+    else if (serve_socket_path(path, sizeof(path)) == false)
+    {
+        fatal(EXITCODE_INVOCATION_ERROR, "No socket path, set "
+            SERVE_SOCKET_ENV " or pass --socket");
+    }
+
+    count = get_workers(args);
+    arg_destroy_struct(args);
+
+    listen_fd = open_socket(path);
+
+    /* No SA_RESTART, waitpid has to return when we are told to stop */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+
+    workers = mem_alloc(MEM_OTHER, count * sizeof(pid_t));
+
+    for (size_t i = 0; i != count; ++i)
+        workers[i] = spawn_worker(listen_fd);
+
+    fprintf(stderr, "Serving on %s with %zu workers\n", path, count);
+
+    while (stopping == 0)
+    {
+        int status;
+        pid_t pid;
+
+        pid = waitpid(-1, &status, 0);
+
+        if (pid == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            break;
+        }
+
+        /* Worker exited on a fatal error or crashed, replace it */
+        for (size_t i = 0; i != count; ++i)
+        {
+            if (workers[i] == pid && stopping == 0)
+                workers[i] = spawn_worker(listen_fd);
+        }
+    }
+
+    for (size_t i = 0; i != count; ++i)
+        kill(workers[i], SIGTERM);
+
+    while (waitpid(-1, NULL, 0) != -1 || errno == EINTR)
+        ;
+
+    close(listen_fd);
+    unlink(path);
+    mem_free(MEM_OTHER, workers);
+}
+
+/*
+  Socket used by clients and by serve without --socket
+  $MKC_SERVER, $XDG_RUNTIME_DIR/mkc.sock or /tmp/mkc-<uid>.sock
+  Returns false if MKC_SERVER is empty or the path doesn't fit
+*/
+bool serve_socket_path(char *path, size_t size)
+{
+    char *value;
+    int length;
+
+    value = getenv(SERVE_SOCKET_ENV);
+
+    if (value != NULL)
+    {
+        if (value[0] == '\0')
+            return false;
+
+        length = snprintf(path, size, "%s", value);
+    }
+    else if ((value = getenv("XDG_RUNTIME_DIR")) != NULL && value[0] != '\0')
+    {
+        length = snprintf(path, size, "%s/mkc.sock", value);
+    }
+    else
+    {
+        length = snprintf(path, size, "/tmp/mkc-%u.sock",
+            (unsigned int) getuid());
+    }
+
+    return length >= 0 && (size_t) length < size;
+}
+
+/*
+  Hash of the version of mkc and of the binary that runs, client and
+  server must agree on it
+  The version alone stays the same across rebuilds, the binary's inode,
+  size and time change whenever it is relinked, and a server whose
+  binary was replaced still sees its old one
+*/
+uint64_t serve_version(void)
+{
+    char build[256];
+    struct stat info;
+    int length;
+
+    if (stat("/proc/self/exe", &info) == -1)
+        memset(&info, 0, sizeof(info));
+
+    length = snprintf(build, sizeof(build), "%s %ju %ju %jd %jd %ld",
+        mkc_version(), (uintmax_t) info.st_dev, (uintmax_t) info.st_ino,
+        (intmax_t) info.st_size, (intmax_t) info.st_mtim.tv_sec,
+        info.st_mtim.tv_nsec);
+
+    return intern_hash(build, (size_t) length);
+}
+
+static struct arguments *register_options(void)
+{
+    struct arguments *args;
+    struct switch_info *info;
+
+    args = arg_create_struct();
+
+    info = arg_create_switch_info(args, true);
+    arg_add_long(info, "socket");
+    arg_register(args, info);
+
+    info = arg_create_switch_info(args, true);
+    arg_add_long(info, "jobs");
+    arg_add_short(info, 'j');
+    arg_register(args, info);
+
+    return args;
+}
+
+/* Defaults to number of online processors, last occurrence wins */
+static size_t get_workers(struct arguments *args)
+{
+    struct switch_info *info;
+    unsigned long workers;
+    char *end;
+    long online;
+
+    info = arg_find_long(args, "jobs");
+    assert(info != NULL);
+
+    if (info->occurrences == 0)
+    {
+        online = sysconf(_SC_NPROCESSORS_ONLN);
+        return online > 0 ? online : 1;
+    }
+
+    errno = 0;
+    workers = strtoul(info->parameters.data[info->occurrences - 1], &end, 10);
+
+    if (errno != 0 || *end != '\0' || workers == 0)
+    {
+        fatal(EXITCODE_INVOCATION_ERROR,
+            "Option jobs expects a positive number");
+    }
+
+    return workers;
+}
+
+/*
+  A socket file left behind by a server that died is removed,
+  one that somebody still listens on is an error
+*/
+static int open_socket(char *path)
+{
+    struct sockaddr_un address;
+    mode_t mask;
+    int probe;
+    int fd;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (probe == -1 || fd == -1)
+    {
+        fatal(EXITCODE_EXTERNAL_ERROR, "Failed to create socket: %s",
+            strerror(errno));
+    }
+
+    if (connect(probe, (struct sockaddr *) &address, sizeof(address)) == 0)
+        fatal(EXITCODE_INVOCATION_ERROR, "Server already runs on %s", path);
+
+    if (errno == ECONNREFUSED)
+        unlink(path);
+
+    close(probe);
+
+    /* Only our user may connect, see same_user too */
+    mask = umask(0077);
+
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) == -1
+        || listen(fd, SERVE_BACKLOG) == -1)
+    {
+        fatal(EXITCODE_EXTERNAL_ERROR, "Failed to listen on %s: %s",
+            path, strerror(errno));
+    }
+
+    umask(mask);
+
+    return fd;
+}
+
+static pid_t spawn_worker(int listen_fd)
+{
+    pid_t pid;
+
+    pid = fork();
+
+    if (pid == -1)
+    {
+        fatal(EXITCODE_EXTERNAL_ERROR, "Failed to start worker: %s",
+            strerror(errno));
+    }
+
+    if (pid == 0)
+        worker_run(listen_fd);
+
+    return pid;
+}
+
+/* Accept and serve connections one at a time, forever */
+static _Noreturn void worker_run(int listen_fd)
+{
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    /* A client that went away mustn't kill us, writes just fail */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Standard streams point here between requests */
+    null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    log_fd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+
+    if (null_fd == -1 || log_fd == -1)
+    {
+        fatal(EXITCODE_EXTERNAL_ERROR, "Failed to open /dev/null: %s",
+            strerror(errno));
+    }
+
+    release_client();
+
+    fatal_set_exit_hook(report_exit);
+    dump_lunits_keep_warm();
+    file_cache_enable(FILE_CACHE_DEFAULT_BYTES);
+
+    while (true)
+    {
+        int connection;
+
+        connection = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+        if (connection == -1)
+            continue;
+
+        if (same_user(connection))
+            handle_connection(connection);
+
+        close(connection);
+    }
+}
+
+/* Malformed requests are dropped, client reports lost connection */
+static void handle_connection(int connection)
+{
+    struct serve_request request;
+    int fds[SERVE_MAX_FD_COUNT];
+    size_t fd_count;
+    char *buffer;
+    char **argv;
+    int exitcode;
+
+    fd_count = receive_request(connection, &request, fds);
+
+    if (fd_count == 0)
+        return;
+
+    /* Client of another build, arguments are left unread */
+    if (request.protocol != SERVE_PROTOCOL
+        || request.version != serve_version())
+    {
+        for (size_t i = 0; i != fd_count; ++i)
+            close(fds[i]);
+
+        send_exitcode(connection, SERVE_REFUSED);
+        return;
+    }
+
+    buffer = mem_alloc(MEM_ARGUMENTS, request.size);
+    argv = NULL;
+
+    if (read_all(connection, buffer, request.size))
+        argv = unpack_arguments(buffer, &request);
+
+    if (argv != NULL && fchdir(fds[3]) == 0)
+    {
+        dup2(fds[0], STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[2], STDERR_FILENO);
+    }
+    else
+    {
+        mem_free(MEM_ARGUMENTS, argv);
+        argv = NULL;
+    }
+
+    for (size_t i = 0; i != SERVE_FD_COUNT; ++i)
+        close(fds[i]);
+
+    /* Client runs under make -j, take part in its jobserver */
+    if (fd_count == SERVE_MAX_FD_COUNT)
+    {
+        if (argv != NULL)
+        {
+            jobserver_attach(fds[4], fds[5]);
+        }
+        else
+        {
+            close(fds[4]);
+            close(fds[5]);
+        }
+    }
+
+    if (argv != NULL)
+    {
+        current_connection = connection;
+        exitcode = run_command(request.argc, argv);
+        current_connection = -1;
+
+        if (fd_count == SERVE_MAX_FD_COUNT)
+            jobserver_detach();
+
+        fflush(stdout);
+
+        /* Streams are given back first so that client sees their end */
+        release_client();
+        send_exitcode(connection, exitcode);
+    }
+
+    mem_free(MEM_ARGUMENTS, argv);
+    mem_free(MEM_ARGUMENTS, buffer);
+}
+
+/*
+  Header and descriptors, returns number of descriptors
+  or 0 if either is missing or malformed
+*/
+static size_t receive_request(int connection,
+    struct serve_request *request, int *fds)
+{
+    union
+    {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(SERVE_MAX_FD_COUNT * sizeof(int))];
+    } control;
+    size_t fd_count;
+    struct cmsghdr *message_header;
+    struct msghdr message;
+    struct iovec part;
+    ssize_t received;
+
+    part.iov_base = request;
+    part.iov_len = sizeof(*request);
+
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = sizeof(control.space);
+
+    do
+        received = recvmsg(connection, &message, 0);
+    while (received == -1 && errno == EINTR);
+
+    if (received <= 0)
+        return 0;
+
+    message_header = CMSG_FIRSTHDR(&message);
+
+    if (message_header == NULL || message_header->cmsg_level != SOL_SOCKET
+        || message_header->cmsg_type != SCM_RIGHTS)
+        return 0;
+
+    if (message_header->cmsg_len == CMSG_LEN(SERVE_FD_COUNT * sizeof(int)))
+        fd_count = SERVE_FD_COUNT;
+    else if (message_header->cmsg_len
+        == CMSG_LEN(SERVE_MAX_FD_COUNT * sizeof(int)))
+        fd_count = SERVE_MAX_FD_COUNT;
+    else
+        return 0;
+
+    memcpy(fds, CMSG_DATA(message_header), fd_count * sizeof(int));
+
+    /* Descriptors came with the first bytes, the rest is plain data */
+    if (read_all(connection, (char *) request + received,
+            sizeof(*request) - received) == false
+        || request->magic != SERVE_MAGIC || request->argc < 2
+        || request->size > SERVE_MAX_ARGUMENTS_SIZE)
+    {
+        for (size_t i = 0; i != fd_count; ++i)
+            close(fds[i]);
+
+        return 0;
+    }
+
+    return fd_count;
+}
+
+/* argv pointing into buffer, NULL unless there are exactly argc strings */
+static char **unpack_arguments(char *buffer, struct serve_request *request)
+{
+    char **argv;
+    size_t count;
+    size_t start;
+
+    if (request->size == 0 || buffer[request->size - 1] != '\0')
+        return NULL;
+
+    argv = mem_alloc(MEM_ARGUMENTS, (request->argc + 1) * sizeof(char *));
+    count = 0;
+    start = 0;
+
+    for (size_t i = 0; i != request->size; ++i)
+    {
+        if (buffer[i] != '\0')
+            continue;
+
+        if (count == request->argc)
+        {
+            mem_free(MEM_ARGUMENTS, argv);
+            return NULL;
+        }
+
+        argv[count] = &buffer[start];
+        count += 1;
+        start = i + 1;
+    }
+
+    if (count != request->argc)
+    {
+        mem_free(MEM_ARGUMENTS, argv);
+        return NULL;
+    }
+
+    argv[count] = NULL;
+
+    return argv;
+}
+
+/* Subcommands report errors through fatal, see report_exit */
+static int run_command(int argc, char **argv)
+{
+    if (strcmp(argv[1], "dump") == 0)
+    {
+        dump(argc, argv);
+        return 0;
+    }
+
+    if (strcmp(argv[1], "compile") == 0)
+    {
+        puts("Subcommand not implemented");
+        return EXITCODE_INVOCATION_ERROR;
+    }
+
+    fprintf(stderr, "Server doesn't run subcommand %s\n", argv[1]);
+
+    return EXITCODE_INVOCATION_ERROR;
+}
+
+/* Let go of the client's streams and directory */
+static void release_client(void)
+{
+    dup2(null_fd, STDIN_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(log_fd, STDERR_FILENO);
+
+    if (chdir("/") == -1)
+        fatal(EXITCODE_EXTERNAL_ERROR, "Failed to leave working directory");
+}
+
+static void send_exitcode(int connection, int exitcode)
+{
+    int32_t value;
+
+    value = exitcode;
+
+    /* Nothing to do if the client is gone */
+    if (write(connection, &value, sizeof(value)) != sizeof(value))
+        return;
+}
+
+/*
+  fatal is about to exit this worker, the message is on the client's
+  stderr already, tell the client the exit code before we go
+*/
+static void report_exit(int exitcode)
+{
+    if (current_connection == -1)
+        return;
+
+    fflush(stdout);
+    send_exitcode(current_connection, exitcode);
+}
+
+static void stop(int signal_number)
+{
+    (void) signal_number;
+    stopping = 1;
+}
+
+static bool read_all(int fd, void *buffer, size_t size)
+{
+    char *cursor;
+
+    cursor = buffer;
+
+    while (size != 0)
+    {
+        ssize_t result;
+
+        result = read(fd, cursor, size);
+
+        if (result == -1 && errno == EINTR)
+            continue;
+
+        if (result <= 0)
+            return false;
+
+        cursor += result;
+        size -= result;
+    }
+
+    return true;
+}
+
+/* Requests run with our permissions, serve only our own user */
+static bool same_user(int connection)
+{
+    struct ucred credentials;
+    socklen_t length;
+
+    length = sizeof(credentials);
+
+    if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials,
+            &length) == -1)
+        return false;
+
+    return credentials.uid == getuid();
+}
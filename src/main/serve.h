@@ -0,0 +1,53 @@
+#ifndef _MAIN_SERVE_H_
+#define _MAIN_SERVE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Socket of the server, empty value disables the client */
+#define SERVE_SOCKET_ENV "MKC_SERVER"
+
+/* "MKC1" read as a little endian number */
+#define SERVE_MAGIC 0x31434b4d
+
+/* Bump whenever requests or answers change */
+#define SERVE_PROTOCOL 2
+
+/* Answer instead of an exit code to a client of another version */
+#define SERVE_REFUSED INT32_MIN
+
+/* Requests with more bytes of arguments are rejected */
+#define SERVE_MAX_ARGUMENTS_SIZE (1024 * 1024)
+
+/* Client's stdin, stdout, stderr and working directory, in this order */
+#define SERVE_FD_COUNT 4
+
+/* Followed by read and write end of make's jobserver if client has one */
+#define SERVE_MAX_FD_COUNT 6
+
+/*
+  Client sends the header with SERVE_FD_COUNT or SERVE_MAX_FD_COUNT
+  descriptors attached (SCM_RIGHTS), then size bytes of argv, every
+  argument null terminated
+  Server answers with the exit code as int32_t once the command is done
+  protocol and version (see serve_version) must be the server's own,
+  otherwise it answers SERVE_REFUSED right away and the client runs
+  the command itself, a server left running after mkc was rebuilt
+  mustn't answer with old code
+  Both ends are on the same machine, numbers are in native byte order
+*/
+struct serve_request
+{
+    uint32_t magic;
+    uint32_t argc;
+    uint32_t size;
+    uint32_t protocol;
+    uint64_t version;
+};
+
+void serve(int argc, char **argv);
+bool serve_socket_path(char *path, size_t size);
+uint64_t serve_version(void);
+
+#endif
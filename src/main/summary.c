@@ -0,0 +1,263 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <common/intern.h>
+#include <common/lstring.h>
+#include <common/memory.h>
+#include <common/writer.h>
+#include <lexer/lunit.h>
+
+#include "summary.h"
+
+static double now(void);
+static void put_double(struct writer *out, double value);
+static void write_top(struct summary *summary, struct writer *out);
+static int compare_counts(const void *a, const void *b);
+
+/* Sorted by write_top, count is copied so that qsort needs no context */
+struct identifier_count
+{
+    size_t count;
+    size_t id;
+};
+
+
+struct summary *summary_create(size_t top)
+{
+    struct summary *summary;
+
+    summary = mem_alloc(MEM_OUTPUT, sizeof(struct summary));
+
+    lstring_init(&summary->longest);
+    summary->identifiers = intern_create(MEM_OUTPUT);
+    vector_size_init(&summary->counts, MEM_OUTPUT);
+    summary->top = top;
+
+    summary_begin(summary, 0);
+
+    return summary;
+}
+
+void summary_destroy(struct summary *summary)
+{
+    lstring_fini(&summary->longest);
+    intern_destroy(summary->identifiers);
+    vector_size_fini(&summary->counts);
+    mem_free(MEM_OUTPUT, summary);
+}
+
+/* Forget previous unit, memory is kept for the next one */
+void summary_begin(struct summary *summary, size_t bytes)
+{
+    memset(summary->kinds, 0, sizeof(summary->kinds));
+    summary->tokens = 0;
+    summary->bytes = bytes;
+    summary->lines = 0;
+    summary->indentation = 0;
+    summary->max_indentation = 0;
+    summary->line_start = true;
+    lstring_clear(&summary->longest);
+    summary->longest_line = 0;
+    summary->longest_column = 0;
+    summary->longest_token = TOK_EOF;
+    intern_clear(summary->identifiers);
+    summary->counts.count = 0;
+    summary->seconds = 0;
+    summary->start = now();
+}
+
+/* Called for every lunit, lunit isn't needed afterwards */
+void summary_add(struct summary *summary, struct lunit *lunit)
+{
+    enum token token;
+
+    token = lunit->token;
+
+    summary->kinds[token] += 1;
+    summary->tokens += 1;
+
+    if (lunit->line > summary->lines)
+        summary->lines = lunit->line;
+
+    /* Indentation is the number of tabs a line starts with */
+    if (token == TOK_TAB && summary->line_start)
+    {
+        summary->indentation += 1;
+
+        if (summary->indentation > summary->max_indentation)
+            summary->max_indentation = summary->indentation;
+    }
+    else
+    {
+        summary->line_start = token == TOK_EOL;
+        summary->indentation = 0;
+    }
+
+    /* First of equally long lexmes wins */
+    if (lunit->lexme.length > summary->longest.length)
+    {
+        lstring_clear(&summary->longest);
+        lstring_append_lstring(&summary->longest, &lunit->lexme);
+        summary->longest_line = lunit->line;
+        summary->longest_column = lunit->column;
+        summary->longest_token = token;
+    }
+
+    if (token == TOK_IDENTIFIER)
+    {
+        size_t id;
+
+        id = intern_add(summary->identifiers, lunit->lexme.text,
+            lunit->lexme.length);
+
+        /* Ids are dense, a new one is always equal to count */
+        if (id == summary->counts.count)
+            vector_size_push(&summary->counts, 0);
+
+        summary->counts.data[id] += 1;
+    }
+}
+
+void summary_end(struct summary *summary)
+{
+    summary->seconds = now() - summary->start;
+}
+
+void summary_write(struct summary *summary, struct writer *out)
+{
+    double seconds;
+
+    WRITER_PUT_LITERAL(out, "Bytes: ");
+    writer_put_size(out, summary->bytes);
+    WRITER_PUT_LITERAL(out, "\nLines: ");
+    writer_put_size(out, summary->lines);
+    WRITER_PUT_LITERAL(out, "\nTokens: ");
+    writer_put_size(out, summary->tokens);
+    WRITER_PUT_LITERAL(out, "\n");
+
+    for (size_t i = 0; i != TOK_UNKNOWN + 1; ++i)
+    {
+        const char *name;
+        size_t length;
+
+        name = token_name(i, &length);
+        WRITER_PUT_LITERAL(out, "  ");
+        writer_put_buffer(out, name, length);
+        WRITER_PUT_LITERAL(out, ": ");
+        writer_put_size(out, summary->kinds[i]);
+        WRITER_PUT_LITERAL(out, "\n");
+    }
+
+    WRITER_PUT_LITERAL(out, "Maximum indentation: ");
+    writer_put_size(out, summary->max_indentation);
+    WRITER_PUT_LITERAL(out, "\nLongest lexme: ");
+    writer_put_size(out, summary->longest.length);
+
+    if (summary->longest.length != 0)
+    {
+        const char *name;
+        size_t length;
+
+        name = token_name(summary->longest_token, &length);
+        WRITER_PUT_LITERAL(out, " (");
+        writer_put_buffer(out, name, length);
+        WRITER_PUT_LITERAL(out, ") at line ");
+        writer_put_size(out, summary->longest_line);
+        WRITER_PUT_LITERAL(out, " column ");
+        writer_put_size(out, summary->longest_column);
+    }
+
+    WRITER_PUT_LITERAL(out, "\nDistinct identifiers: ");
+    writer_put_size(out, summary->counts.count);
+    WRITER_PUT_LITERAL(out, "\n");
+
+    write_top(summary, out);
+
+    /* Don't divide by zero on tiny inputs */
+    seconds = summary->seconds > 1e-9 ? summary->seconds : 1e-9;
+
+    WRITER_PUT_LITERAL(out, "Seconds: ");
+    put_double(out, summary->seconds);
+    WRITER_PUT_LITERAL(out, "\nMB/s: ");
+    put_double(out, summary->bytes / seconds / 1e6);
+    WRITER_PUT_LITERAL(out, "\nTokens/s: ");
+    put_double(out, summary->tokens / seconds);
+    /* Blank line separates units just like it separates lunits */
+    WRITER_PUT_LITERAL(out, "\n\n");
+}
+
+/* Most frequent identifiers first, ties in order of first appearance */
+static void write_top(struct summary *summary, struct writer *out)
+{
+    struct identifier_count *sorted;
+    size_t count;
+
+    count = summary->counts.count;
+
+    if (count == 0 || summary->top == 0)
+        return;
+
+    sorted = mem_alloc(MEM_OUTPUT, count * sizeof(struct identifier_count));
+
+    for (size_t i = 0; i != count; ++i)
+    {
+        sorted[i].count = summary->counts.data[i];
+        sorted[i].id = i;
+    }
+
+    qsort(sorted, count, sizeof(struct identifier_count), compare_counts);
+
+    WRITER_PUT_LITERAL(out, "Top identifiers:\n");
+
+    for (size_t i = 0; i != count && i != summary->top; ++i)
+    {
+        const char *text;
+        size_t length;
+
+        text = intern_text(summary->identifiers, sorted[i].id, &length);
+
+        WRITER_PUT_LITERAL(out, "  ");
+        writer_put_size(out, sorted[i].count);
+        WRITER_PUT_LITERAL(out, " ");
+        writer_put_buffer(out, text, length);
+        WRITER_PUT_LITERAL(out, "\n");
+    }
+
+    mem_free(MEM_OUTPUT, sorted);
+}
+
+static int compare_counts(const void *a, const void *b)
+{
+    const struct identifier_count *x;
+    const struct identifier_count *y;
+
+    x = a;
+    y = b;
+
+    if (x->count != y->count)
+        return x->count > y->count ? -1 : 1;
+
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void put_double(struct writer *out, double value)
+{
+    char buffer[64];
+    int length;
+
+    length = snprintf(buffer, sizeof(buffer), "%.3f", value);
+    writer_put_buffer(out, buffer, length);
+}
@@ -0,0 +1,51 @@
+#ifndef _MAIN_SUMMARY_H_
+#define _MAIN_SUMMARY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <common/intern.h>
+#include <common/lstring.h>
+#include <common/vector.h>
+#include <common/writer.h>
+#include <lexer/lunit.h>
+
+/* Identifiers listed by 'dump lunits --summary' unless --top says otherwise */
+#define SUMMARY_DEFAULT_TOP 10
+
+VECTOR(vector_size, size_t)
+
+/*
+  Statistics of one unit, collected by 'dump lunits --summary'
+  instead of formatting every lunit
+  Counts of identifiers are indexed by their id in identifiers
+  One summary can be reused for many units, see summary_begin
+*/
+struct summary
+{
+    size_t kinds[TOK_UNKNOWN + 1];
+    size_t tokens;
+    size_t bytes;
+    size_t lines;
+    size_t indentation;
+    size_t max_indentation;
+    bool line_start;
+    struct lstring longest;
+    size_t longest_line;
+    size_t longest_column;
+    enum token longest_token;
+    struct intern *identifiers;
+    struct vector_size counts;
+    size_t top;
+    double start;
+    double seconds;
+};
+
+struct summary *summary_create(size_t top);
+void summary_destroy(struct summary *summary);
+void summary_begin(struct summary *summary, size_t bytes);
+void summary_add(struct summary *summary, struct lunit *lunit);
+void summary_end(struct summary *summary);
+void summary_write(struct summary *summary, struct writer *out);
+
+#endif
@@ -0,0 +1,351 @@
+#include <errno.h>
+#include <poll.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <common/exitcodes.h>
+#include <common/fatal.h>
+#include <common/intern.h>
+#include <common/memory.h>
+#include <common/vector.h>
+
+#include "dump.h"
+#include "dump_lunits.h"
+
+#include "watch.h"
+
+/*
+  Files are watched through their directories, editors that save by
+  renaming a new file over the old one replace the inode a watch on
+  the file itself would be stuck to
+*/
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE \
+    | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+/* Room for a few events with long names */
+#define WATCH_BUFFER_SIZE (16 * 1024)
+
+/*
+  An input of the command, name is the one the command used
+  base points to its last component in name, directory is the watch
+  descriptor of the directory it is in, -1 if it can't be watched
+*/
+struct watch_file
+{
+    char *name;
+    const char *base;
+    int directory;
+    bool changed;
+};
+
+VECTOR(vector_watch_file, struct watch_file)
+
+/*
+  names interns names of files, their ids index files
+  State is global, dump_lunits tells about inputs through a callback
+*/
+struct watch_state
+{
+    int fd;
+    struct intern *names;
+    struct vector_watch_file files;
+    size_t changed;
+};
+
+static int parse_options(int argc, char **argv, int *debounce);
+static void add_input(const char *file_name);
+static void run(int argc, char **argv);
+static void wait_changes(int debounce);
+static bool read_events(int timeout);
+static void mark_changed(int directory, const char *base);
+static long elapsed_ms(struct timespec *start);
+
+static struct watch_state state;
+
+
+/*
+  mkc watch [--debounce=MS] dump ... runs the command, then runs it again
+  every time one of its inputs changes
+  Dumps are kept in memory, a run dumps only the inputs that changed,
+  see dump_lunits_remember
+  Bursts of changes are gathered into one run, it starts once nothing
+  changed for debounce milliseconds
+  A run that fails reports its error and waiting goes on, memory it
+  had allocated isn't freed (see fatal_push)
+  Runs until it is killed
+*/
+void watch(int argc, char **argv)
+{
+    int debounce;
+    int consumed;
+
+    consumed = parse_options(argc, argv, &debounce);
+
+    /* Command gets the last option as its program name, see main */
+    argc -= consumed;
+    argv += consumed;
+
+    if (argc < 2)
+        fatal(EXITCODE_INVOCATION_ERROR, "No command to watch specified");
+
+    /* Only dump lunits tells which inputs it reads */
+    if (strcmp(argv[1], "dump") != 0 || argc < 3
+        || strcmp(argv[2], "lunits") != 0)
+    {
+        fatal(EXITCODE_INVOCATION_ERROR, "Only dump lunits can be watched");
+    }
+
+    state.fd = inotify_init1(IN_CLOEXEC);
+
+    if (state.fd == -1)
+    {
+        fatal(EXITCODE_EXTERNAL_ERROR, "Failed to start watching: %s",
+            strerror(errno));
+    }
+
+    state.names = intern_create(MEM_OTHER);
+    vector_watch_file_init(&state.files, MEM_OTHER);
+
+    dump_lunits_keep_warm();
+    dump_lunits_remember(add_input);
+
+    run(argc, argv);
+
+    while (true)
+    {
+        wait_changes(debounce);
+
+        for (size_t i = 0; i != state.files.count; ++i)
+        {
+            if (state.files.data[i].changed == false)
+                continue;
+
+            dump_lunits_forget(state.files.data[i].name);
+            state.files.data[i].changed = false;
+        }
+
+        fprintf(stderr, "%zu file%s changed\n", state.changed,
+            state.changed == 1 ? "" : "s");
+        state.changed = 0;
+
+        run(argc, argv);
+    }
+}
+
+/* Returns number of options, they go before the command */
+static int parse_options(int argc, char **argv, int *debounce)
+{
+    int iter;
+
+    *debounce = WATCH_DEFAULT_DEBOUNCE_MS;
+
+    /* 0 - program name, 1 - watch */
+    iter = 2;
+
+    while (iter < argc && strncmp(argv[iter], "--", 2) == 0)
+    {
+        if (strncmp(argv[iter], "--debounce=", 11) == 0)
+        {
+            char *end;
+            long value;
+
+            errno = 0;
+            value = strtol(&argv[iter][11], &end, 10);
+
+            if (errno != 0 || end == &argv[iter][11] || *end != '\0'
+                || value < 0 || value > 60 * 1000)
+            {
+                fatal(EXITCODE_INVOCATION_ERROR,
+                    "Debounce must be milliseconds, 0 to 60000");
+            }
+
+            *debounce = value;
+        }
+        else
+        {
+            fatal(EXITCODE_INVOCATION_ERROR, "Unknown watch option %s",
+                argv[iter]);
+        }
+
+        iter += 1;
+    }
+
+    return iter - 1;
+}
+
+/* Called by dump_lunits with every input of every run */
+static void add_input(const char *file_name)
+{
+    struct watch_file file;
+    const char *slash;
+    char *directory;
+    size_t length;
+
+    length = strlen(file_name);
+
+    /* Ids are dense, a new one is the next index */
+    if (intern_add(state.names, file_name, length) != state.files.count)
+        return;
+
+    file.name = mem_alloc(MEM_OTHER, length + 1);
+    memcpy(file.name, file_name, length + 1);
+    file.changed = false;
+
+    slash = strrchr(file.name, '/');
+
+    if (slash == NULL)
+    {
+        directory = mem_alloc(MEM_OTHER, 2);
+        strcpy(directory, ".");
+        file.base = file.name;
+    }
+    else
+    {
+        /* "/name" is in the root directory */
+        length = slash == file.name ? 1 : (size_t) (slash - file.name);
+        directory = mem_alloc(MEM_OTHER, length + 1);
+        memcpy(directory, file.name, length);
+        directory[length] = '\0';
+        file.base = slash + 1;
+    }
+
+    /* Watching a directory twice returns the descriptor it already has */
+    file.directory = inotify_add_watch(state.fd, directory, WATCH_EVENTS);
+
+    if (file.directory == -1)
+    {
+        fprintf(stderr, "Failed to watch directory '%s': %s\n",
+            directory, strerror(errno));
+    }
+
+    mem_free(MEM_OTHER, directory);
+    vector_watch_file_push(&state.files, file);
+}
+
+/* Errors of the command end the run, not the watch */
+static void run(int argc, char **argv)
+{
+    struct fatal_frame frame;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    fatal_push(&frame);
+
+    if (setjmp(frame.env) != 0)
+    {
+        fflush(stdout);
+        fprintf(stderr, "%s\nWaiting for changes\n", frame.message);
+        return;
+    }
+
+    dump(argc, argv);
+
+    fatal_pop(&frame);
+
+    fflush(stdout);
+    fprintf(stderr, "Done in %ld ms, waiting for changes\n",
+        elapsed_ms(&start));
+}
+
+/* Block until inputs changed and then nothing changed for debounce ms */
+static void wait_changes(int debounce)
+{
+    while (state.changed == 0)
+        read_events(-1);
+
+    while (read_events(debounce))
+        continue;
+}
+
+/* Returns false if nothing came within timeout ms, -1 waits forever */
+static bool read_events(int timeout)
+{
+    _Alignas(struct inotify_event) char buffer[WATCH_BUFFER_SIZE];
+    struct pollfd poller;
+    ssize_t size;
+    int ready;
+
+    poller.fd = state.fd;
+    poller.events = POLLIN;
+
+    ready = poll(&poller, 1, timeout);
+
+    if (ready == -1 && errno == EINTR)
+        return true;
+
+    if (ready == -1)
+    {
+        fatal(EXITCODE_EXTERNAL_ERROR, "Failed to wait for changes: %s",
+            strerror(errno));
+    }
+
+    if (ready == 0)
+        return false;
+
+    size = read(state.fd, buffer, sizeof(buffer));
+
+    if (size == -1 && errno == EINTR)
+        return true;
+
+    if (size == -1)
+    {
+        fatal(EXITCODE_EXTERNAL_ERROR, "Failed to read changes: %s",
+            strerror(errno));
+    }
+
+    for (ssize_t offset = 0; offset < size;)
+    {
+        struct inotify_event *event;
+
+        event = (struct inotify_event *) &buffer[offset];
+
+        /* Events were lost, anything may have changed */
+        if (event->mask & IN_Q_OVERFLOW)
+            mark_changed(-1, NULL);
+        else if (event->len != 0)
+            mark_changed(event->wd, event->name);
+
+        offset += sizeof(struct inotify_event) + event->len;
+    }
+
+    return true;
+}
+
+/* directory -1 marks every file */
+static void mark_changed(int directory, const char *base)
+{
+    for (size_t i = 0; i != state.files.count; ++i)
+    {
+        struct watch_file *file;
+
+        file = &state.files.data[i];
+
+        if (file->changed)
+            continue;
+
+        if (directory != -1 && (file->directory != directory
+            || strcmp(file->base, base) != 0))
+            continue;
+
+        file->changed = true;
+        state.changed += 1;
+    }
+}
+
+static long elapsed_ms(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) * 1000
+        + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
@@ -0,0 +1,9 @@
+#ifndef _MAIN_WATCH_H_
+#define _MAIN_WATCH_H_
+
+/* Quiet time after the last change before a run starts */
+#define WATCH_DEFAULT_DEBOUNCE_MS 50
+
+void watch(int argc, char **argv);
+
+#endif
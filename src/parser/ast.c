@@ -0,0 +1,48 @@
+#include <stddef.h>
+
+#include <common/arena.h>
+#include <common/intern.h>
+
+#include "ast.h"
+
+struct ast_kind_info
+{
+    const char *text;
+    size_t length;
+};
+
+#define NAME(kind) [kind] = { #kind, sizeof(#kind) - 1 },
+
+/* Lengths are known at compile time, printers don't have to strlen */
+static const struct ast_kind_info ast_kind_names[] =
+{
+    NAME(AST_UNIT)
+    NAME(AST_PROCEDURE)
+    NAME(AST_RETURN)
+    NAME(AST_IDENTIFIER)
+    NAME(AST_INTEGER)
+};
+
+
+/* Frees the tree and everything in it */
+void ast_destroy(struct ast *ast)
+{
+    intern_destroy(ast->names);
+    /* ast itself is in the arena */
+    arena_destroy(ast->arena);
+}
+
+/* Name of the enum constant, e.g. "AST_UNIT", length is optional */
+const char *ast_kind_name(enum ast_kind kind, size_t *length)
+{
+    if (length != NULL)
+        *length = ast_kind_names[kind].length;
+
+    return ast_kind_names[kind].text;
+}
+
+/* Name of a procedure or identifier, not null terminated */
+const char *ast_name(struct ast *ast, struct ast_node *node, size_t *length)
+{
+    return intern_text(ast->names, node->value, length);
+}
@@ -0,0 +1,66 @@
+#ifndef _PARSER_AST_H_
+#define _PARSER_AST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <common/arena.h>
+#include <common/intern.h>
+
+enum ast_kind
+{
+    /* Whole file, children are its procedures */
+    AST_UNIT,
+    /* value is the name, children are the statements of its block */
+    AST_PROCEDURE,
+    /* Expression it returns is the only child, if there is one */
+    AST_RETURN,
+    /* value is the name */
+    AST_IDENTIFIER,
+    /* value indexes ast.integers */
+    AST_INTEGER
+};
+
+/*
+  Nodes refer to each other by 32 bit index into ast.nodes, never by
+  pointer, that halves the size of links and lets the whole tree be
+  copied or written out as is
+  Children of a node are listed contiguously, they are
+  ast.children[first] to ast.children[first + count - 1]
+  Names are ids of ast.names
+*/
+struct ast_node
+{
+    uint32_t kind;
+    uint32_t value;
+    uint32_t first;
+    uint32_t count;
+    uint32_t line;
+    uint32_t column;
+};
+
+/*
+  Tree of one unit, built by parser_parse
+  Nodes, child lists and integers are exactly sized arrays in arena,
+  so is the structure itself, names are interned
+  Nodes come in post order, children before their parent, the root
+  is the last one and it is always an AST_UNIT
+*/
+struct ast
+{
+    struct arena *arena;
+    struct intern *names;
+    struct ast_node *nodes;
+    uint32_t *children;
+    uint64_t *integers;
+    uint32_t node_count;
+    uint32_t child_count;
+    uint32_t integer_count;
+    uint32_t root;
+};
+
+void ast_destroy(struct ast *ast);
+const char *ast_kind_name(enum ast_kind kind, size_t *length);
+const char *ast_name(struct ast *ast, struct ast_node *node, size_t *length);
+
+#endif
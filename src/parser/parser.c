@@ -0,0 +1,395 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <common/arena.h>
+#include <common/exitcodes.h>
+#include <common/fatal.h>
+#include <common/intern.h>
+#include <common/memory.h>
+#include <common/vector.h>
+#include <lexer/lunit.h>
+
+#include "ast.h"
+
+#include "parser.h"
+
+/*
+  Grammar, a line is indented by the tabs it starts with, lines that
+  have nothing else are ignored:
+
+    unit       = { procedure } EOF
+    procedure  = "procedure" IDENTIFIER end block
+    block      = { statement }, lines indented one tab more than
+                 the line that opened the block
+    statement  = procedure | "return" [ expression ] end
+    expression = IDENTIFIER | INTEGER
+    end        = EOL | EOF
+*/
+
+VECTOR(vector_ast_node, struct ast_node)
+VECTOR(vector_ast_index, uint32_t)
+VECTOR(vector_ast_integer, uint64_t)
+
+/*
+  Nodes are built in scratch vectors and copied into the arena of
+  the unit once it is parsed, so the tree has no slack
+  stack holds finished nodes that wait for their parent, children of
+  a node are on top of it when the node is finished
+  lunit is the lookahead, indent counts tabs of the line it is on
+*/
+struct parser
+{
+    struct vector_ast_node nodes;
+    struct vector_ast_index children;
+    struct vector_ast_index stack;
+    struct vector_ast_integer integers;
+    struct intern *names;
+    const char *file_name;
+    struct lunit *(*next)(void *context);
+    void *context;
+    struct lunit *lunit;
+    size_t indent;
+};
+
+static void parse_unit(struct parser *parser);
+static void parse_procedure(struct parser *parser, size_t depth);
+static void parse_block(struct parser *parser, size_t depth);
+static void parse_statement(struct parser *parser, size_t depth);
+static void parse_return(struct parser *parser);
+static void parse_expression(struct parser *parser);
+static void parse_end(struct parser *parser);
+static void advance(struct parser *parser);
+static void next_line(struct parser *parser);
+static uint32_t add_name(struct parser *parser);
+static uint32_t add_integer(struct parser *parser);
+static void add_node(struct parser *parser, enum ast_kind kind,
+    uint32_t value, size_t base, size_t line, size_t column);
+static struct ast *finish(struct parser *parser);
+static void *copy_array(struct arena *arena, const void *data, size_t count,
+    size_t size);
+static _Noreturn void syntax_error(struct parser *parser, const char *message);
+
+
+struct parser *parser_create(void)
+{
+    struct parser *parser;
+
+    parser = mem_alloc(MEM_AST, sizeof(struct parser));
+
+    vector_ast_node_init(&parser->nodes, MEM_AST);
+    vector_ast_index_init(&parser->children, MEM_AST);
+    vector_ast_index_init(&parser->stack, MEM_AST);
+    vector_ast_integer_init(&parser->integers, MEM_AST);
+
+    return parser;
+}
+
+void parser_destroy(struct parser *parser)
+{
+    vector_ast_node_fini(&parser->nodes);
+    vector_ast_index_fini(&parser->children);
+    vector_ast_index_fini(&parser->stack);
+    vector_ast_integer_fini(&parser->integers);
+    mem_free(MEM_AST, parser);
+}
+
+/* Parse one unit, file_name is used in error messages */
+struct ast *parser_parse(struct parser *parser, const char *file_name,
+    struct lunit *(*next)(void *context), void *context)
+{
+    parser->nodes.count = 0;
+    parser->children.count = 0;
+    parser->stack.count = 0;
+    parser->integers.count = 0;
+    parser->names = intern_create(MEM_AST);
+    parser->file_name = file_name;
+    parser->next = next;
+    parser->context = context;
+    parser->lunit = next(context);
+
+    parse_unit(parser);
+
+    return finish(parser);
+}
+
+static void parse_unit(struct parser *parser)
+{
+    size_t base;
+
+    base = parser->stack.count;
+
+    next_line(parser);
+
+    while (parser->lunit->token != TOK_EOF)
+    {
+        if (parser->indent != 0)
+            syntax_error(parser, "Unexpected indentation");
+
+        if (parser->lunit->token != TOK_PROCEDURE)
+            syntax_error(parser, "Expected a procedure");
+
+        parse_procedure(parser, 0);
+    }
+
+    add_node(parser, AST_UNIT, 0, base, 1, 1);
+}
+
+/* depth is the indentation of the line it is declared on */
+static void parse_procedure(struct parser *parser, size_t depth)
+{
+    size_t line;
+    size_t column;
+    uint32_t name;
+    size_t base;
+
+    line = parser->lunit->line;
+    column = parser->lunit->column;
+    advance(parser);
+
+    if (parser->lunit->token != TOK_IDENTIFIER)
+        syntax_error(parser, "Expected a name of the procedure");
+
+    name = add_name(parser);
+    advance(parser);
+    parse_end(parser);
+
+    base = parser->stack.count;
+    parse_block(parser, depth + 1);
+
+    add_node(parser, AST_PROCEDURE, name, base, line, column);
+}
+
+/* Statements until a line indented less than depth */
+static void parse_block(struct parser *parser, size_t depth)
+{
+    while (parser->lunit->token != TOK_EOF && parser->indent >= depth)
+    {
+        if (parser->indent != depth)
+            syntax_error(parser, "Unexpected indentation");
+
+        parse_statement(parser, depth);
+    }
+}
+
+static void parse_statement(struct parser *parser, size_t depth)
+{
+    switch (parser->lunit->token)
+    {
+    case TOK_PROCEDURE:
+        parse_procedure(parser, depth);
+        break;
+    case TOK_RETURN:
+        parse_return(parser);
+        break;
+    default:
+        syntax_error(parser, "Expected a procedure or return");
+    }
+}
+
+static void parse_return(struct parser *parser)
+{
+    size_t line;
+    size_t column;
+    size_t base;
+
+    line = parser->lunit->line;
+    column = parser->lunit->column;
+    advance(parser);
+
+    base = parser->stack.count;
+
+    if (parser->lunit->token != TOK_EOL && parser->lunit->token != TOK_EOF)
+        parse_expression(parser);
+
+    add_node(parser, AST_RETURN, 0, base, line, column);
+    parse_end(parser);
+}
+
+static void parse_expression(struct parser *parser)
+{
+    size_t line;
+    size_t column;
+
+    line = parser->lunit->line;
+    column = parser->lunit->column;
+
+    switch (parser->lunit->token)
+    {
+    case TOK_IDENTIFIER:
+        add_node(parser, AST_IDENTIFIER, add_name(parser),
+            parser->stack.count, line, column);
+        break;
+    case TOK_INTEGER:
+        add_node(parser, AST_INTEGER, add_integer(parser),
+            parser->stack.count, line, column);
+        break;
+    default:
+        syntax_error(parser, "Expected an identifier or integer");
+    }
+
+    advance(parser);
+}
+
+/* Line must end here, move to the next one that isn't empty */
+static void parse_end(struct parser *parser)
+{
+    if (parser->lunit->token == TOK_EOF)
+        return;
+
+    if (parser->lunit->token != TOK_EOL)
+        syntax_error(parser, "Expected end of line");
+
+    advance(parser);
+    next_line(parser);
+}
+
+/* Lexer keeps returning TOK_EOF, but next mustn't be asked for more */
+static void advance(struct parser *parser)
+{
+    if (parser->lunit->token != TOK_EOF)
+        parser->lunit = parser->next(parser->context);
+}
+
+/* Count tabs at the start of the line, skip lines that have nothing else */
+static void next_line(struct parser *parser)
+{
+    while (true)
+    {
+        parser->indent = 0;
+
+        while (parser->lunit->token == TOK_TAB)
+        {
+            parser->indent += 1;
+            advance(parser);
+        }
+
+        if (parser->lunit->token != TOK_EOL)
+            return;
+
+        advance(parser);
+    }
+}
+
+/* Name in the current lunit */
+static uint32_t add_name(struct parser *parser)
+{
+    struct lstring *lexme;
+
+    lexme = &parser->lunit->lexme;
+
+    return intern_add(parser->names, lexme->text, lexme->length);
+}
+
+/* Value of the current lunit, it is made of digits only */
+static uint32_t add_integer(struct parser *parser)
+{
+    struct lstring *lexme;
+    uint64_t value;
+
+    lexme = &parser->lunit->lexme;
+    value = 0;
+
+    for (size_t i = 0; i != lexme->length; ++i)
+    {
+        uint64_t digit;
+
+        digit = lexme->text[i] - '0';
+
+        if (value > (UINT64_MAX - digit) / 10)
+            syntax_error(parser, "Integer is too large");
+
+        value = value * 10 + digit;
+    }
+
+    if (parser->integers.count == UINT32_MAX)
+        syntax_error(parser, "Too many integers in one unit");
+
+    vector_ast_integer_push(&parser->integers, value);
+
+    return parser->integers.count - 1;
+}
+
+/*
+  Finish a node, its children are on the stack from base up
+  They move to the child list and the node takes their place
+  Lines and columns that don't fit are clamped, they are only shown
+*/
+static void add_node(struct parser *parser, enum ast_kind kind,
+    uint32_t value, size_t base, size_t line, size_t column)
+{
+    struct ast_node node;
+    size_t count;
+
+    count = parser->stack.count - base;
+
+    if (parser->nodes.count == UINT32_MAX
+        || parser->children.count > UINT32_MAX - count)
+        syntax_error(parser, "Too many nodes in one unit");
+
+    node.kind = kind;
+    node.value = value;
+    node.first = parser->children.count;
+    node.count = count;
+    node.line = line < UINT32_MAX ? line : UINT32_MAX;
+    node.column = column < UINT32_MAX ? column : UINT32_MAX;
+
+    /* Leaves have none, stack may not even be allocated yet */
+    if (count != 0)
+    {
+        vector_ast_index_push_many(&parser->children,
+            &parser->stack.data[base], count);
+        vector_ast_index_pop_many(&parser->stack, count);
+    }
+
+    vector_ast_node_push(&parser->nodes, node);
+    vector_ast_index_push(&parser->stack, parser->nodes.count - 1);
+}
+
+/* Copy scratch vectors into an arena of their own, sized exactly */
+static struct ast *finish(struct parser *parser)
+{
+    struct arena *arena;
+    struct ast *ast;
+
+    arena = arena_create(MEM_AST, 0, 0);
+    ast = arena_alloc(arena, sizeof(struct ast));
+
+    ast->arena = arena;
+    ast->names = parser->names;
+    ast->nodes = copy_array(arena, parser->nodes.data, parser->nodes.count,
+        sizeof(struct ast_node));
+    ast->children = copy_array(arena, parser->children.data,
+        parser->children.count, sizeof(uint32_t));
+    ast->integers = copy_array(arena, parser->integers.data,
+        parser->integers.count, sizeof(uint64_t));
+    ast->node_count = parser->nodes.count;
+    ast->child_count = parser->children.count;
+    ast->integer_count = parser->integers.count;
+    ast->root = parser->stack.data[0];
+
+    parser->names = NULL;
+
+    return ast;
+}
+
+static void *copy_array(struct arena *arena, const void *data, size_t count,
+    size_t size)
+{
+    void *copy;
+
+    if (count == 0)
+        return NULL;
+
+    copy = arena_alloc(arena, count * size);
+    memcpy(copy, data, count * size);
+
+    return copy;
+}
+
+static _Noreturn void syntax_error(struct parser *parser, const char *message)
+{
+    fatal(EXITCODE_INPUT_ERROR, "%s:%zu:%zu: %s", parser->file_name,
+        parser->lunit->line, parser->lunit->column, message);
+}
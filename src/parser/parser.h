@@ -0,0 +1,24 @@
+#ifndef _PARSER_PARSER_H_
+#define _PARSER_PARSER_H_
+
+#include <lexer/lunit.h>
+
+#include "ast.h"
+
+/*
+  Recursive descent parser of Kres
+  Lunits come from next, it is called once per lunit and never after
+  TOK_EOF, the parser is done with a lunit when it asks for the next
+  one, so the same memory can be used for all of them
+  A parser keeps its scratch memory for the next unit, use one per thread
+  Syntax errors are fatal (EXITCODE_INPUT_ERROR), see parser.c for
+  the grammar
+*/
+struct parser;
+
+struct parser *parser_create(void);
+void parser_destroy(struct parser *parser);
+struct ast *parser_parse(struct parser *parser, const char *file_name,
+    struct lunit *(*next)(void *context), void *context);
+
+#endif
@@ -0,0 +1,395 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <common/arena.h>
+#include <common/exitcodes.h>
+#include <common/fatal.h>
+#include <common/lstring.h>
+#include <common/memory.h>
+#include <common/ring.h>
+#include <common/timer.h>
+#include <common/trace.h>
+#include <lexer/lexer.h>
+#include <lexer/source.h>
+
+#include "pipeline.h"
+
+/* A lunit in the ring, followed by length bytes of its lexme */
+struct pipeline_record
+{
+    uint64_t line;
+    uint64_t column;
+    uint64_t length;
+    uint64_t token;
+};
+
+/*
+  Lexer thread is the producer of ring, parser thread its consumer
+  Both sides batch: the lexer fills output and writes it at once, the
+  parser reads as much as there is into input, so the indexes of ring
+  move once per batch instead of once per lunit
+  A side that finds the ring full (lexer) or empty (parser) spins for
+  a while and then sleeps on wake with its waiting flag set, the other
+  side wakes it up after it moved the ring
+  arena holds ring, the lexer marks it after that for its lunits
+  lunit is the one the parser looks at, its lexme is reused
+  Errors never exit on the lexer thread: the parser sets stop when it
+  fails and the lexer quits, the lexer sets failed with exitcode and
+  message when it fails and the parser raises them once ring is empty
+*/
+struct pipeline
+{
+    struct ring *ring;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    atomic_bool lexer_waiting;
+    atomic_bool parser_waiting;
+    atomic_bool stop;
+    atomic_bool failed;
+    int exitcode;
+    char message[FATAL_MESSAGE_SIZE];
+    struct sources *sources;
+    struct arena *arena;
+    char *output;
+    size_t output_used;
+    size_t tokens;
+    char *input;
+    size_t input_used;
+    size_t input_read;
+    struct lunit lunit;
+};
+
+static void *lexer_main(void *data);
+static void put(struct pipeline *pipeline, const void *data, size_t size);
+static void flush(struct pipeline *pipeline);
+static void get(struct pipeline *pipeline, void *buffer, size_t size);
+static bool can_write(struct pipeline *pipeline);
+static bool can_read(struct pipeline *pipeline);
+static void wait_until(struct pipeline *pipeline, atomic_bool *waiting,
+    bool (*ready)(struct pipeline *pipeline));
+static void notify(struct pipeline *pipeline, atomic_bool *waiting);
+
+
+/* Lexing of in starts right away, it must stay open until the finish */
+struct pipeline *pipeline_start(FILE *in)
+{
+    struct pipeline *pipeline;
+    int error;
+
+    pipeline = mem_alloc(MEM_LEXER, sizeof(struct pipeline));
+
+    pipeline->arena = arena_create(MEM_LEXER, 0, 0);
+    /* Indexes are on cache lines of their own */
+    pipeline->ring = arena_alloc_aligned(pipeline->arena,
+        ring_size(PIPELINE_RING_CAPACITY), _Alignof(struct ring));
+    ring_init(pipeline->ring, PIPELINE_RING_CAPACITY);
+
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->wake, NULL);
+    atomic_init(&pipeline->lexer_waiting, false);
+    atomic_init(&pipeline->parser_waiting, false);
+    atomic_init(&pipeline->stop, false);
+    atomic_init(&pipeline->failed, false);
+
+    pipeline->sources = source_create_struct();
+    source_push(pipeline->sources, in);
+    pipeline->output = mem_alloc(MEM_LEXER, PIPELINE_BATCH_SIZE);
+    pipeline->output_used = 0;
+    pipeline->tokens = 0;
+
+    pipeline->input = mem_alloc(MEM_AST, PIPELINE_BATCH_SIZE);
+    pipeline->input_used = 0;
+    pipeline->input_read = 0;
+    pipeline->lunit.next = NULL;
+    lstring_init(&pipeline->lunit.lexme);
+
+    error = pthread_create(&pipeline->thread, NULL, lexer_main, pipeline);
+
+    if (error != 0)
+    {
+        fatal(EXITCODE_INTERNAL_ERROR, "Failed to start lexer thread: %s",
+            strerror(error));
+    }
+
+    return pipeline;
+}
+
+/* Next lunit for parser_parse, valid until the following call */
+struct lunit *pipeline_next(void *context)
+{
+    struct pipeline *pipeline;
+    struct pipeline_record record;
+    struct lunit *lunit;
+
+    pipeline = context;
+    lunit = &pipeline->lunit;
+
+    get(pipeline, &record, sizeof(record));
+
+    lstring_clear(&lunit->lexme);
+    lstring_reserve(&lunit->lexme, record.length);
+    get(pipeline, lunit->lexme.text, record.length);
+    lunit->lexme.length = record.length;
+
+    lunit->line = record.line;
+    lunit->column = record.column;
+    lunit->token = record.token;
+
+    return lunit;
+}
+
+/*
+  Wait for the lexer and free everything, returns number of lunits
+  The parser must have got TOK_EOF, the lexer stops only after that
+*/
+size_t pipeline_finish(struct pipeline *pipeline)
+{
+    size_t tokens;
+
+    pthread_join(pipeline->thread, NULL);
+    tokens = pipeline->tokens;
+
+    lstring_fini(&pipeline->lunit.lexme);
+    mem_free(MEM_AST, pipeline->input);
+    mem_free(MEM_LEXER, pipeline->output);
+    source_pop(pipeline->sources);
+    source_destroy_struct(pipeline->sources);
+    pthread_cond_destroy(&pipeline->wake);
+    pthread_mutex_destroy(&pipeline->lock);
+    arena_destroy(pipeline->arena);
+    mem_free(MEM_LEXER, pipeline);
+
+    return tokens;
+}
+
+/*
+  Parser failed before TOK_EOF: tell the lexer to quit and free
+  everything once it did, nothing runs on its thread after this
+*/
+void pipeline_stop(struct pipeline *pipeline)
+{
+    atomic_store(&pipeline->stop, true);
+    notify(pipeline, &pipeline->lexer_waiting);
+
+    pipeline_finish(pipeline);
+}
+
+/* Only one lunit is alive at a time, the arena goes back to mark */
+static void *lexer_main(void *data)
+{
+    struct pipeline *pipeline;
+    struct fatal_frame frame;
+    struct arena_mark mark;
+    struct timer_span span;
+    bool finish;
+
+    pipeline = data;
+
+    trace_thread_name("lexer");
+    span = timer_start(TIMER_LEX);
+
+    fatal_push(&frame);
+
+    if (setjmp(frame.env) != 0)
+    {
+        pipeline->exitcode = frame.exitcode;
+        snprintf(pipeline->message, sizeof(pipeline->message), "%s",
+            frame.message);
+        atomic_store(&pipeline->failed, true);
+        notify(pipeline, &pipeline->parser_waiting);
+
+        timer_stop(&span);
+        return NULL;
+    }
+
+    mark = arena_mark(pipeline->arena);
+    finish = false;
+
+    while (finish == false && atomic_load(&pipeline->stop) == false)
+    {
+        struct pipeline_record record;
+        struct lunit *lunit;
+
+        lunit = lunit_get_arena(pipeline->sources, pipeline->arena);
+
+        record.line = lunit->line;
+        record.column = lunit->column;
+        record.length = lunit->lexme.length;
+        record.token = lunit->token;
+
+        put(pipeline, &record, sizeof(record));
+        put(pipeline, lunit->lexme.text, lunit->lexme.length);
+
+        finish = lunit->token == TOK_EOF;
+        pipeline->tokens += 1;
+
+        arena_release(pipeline->arena, mark);
+    }
+
+    flush(pipeline);
+    fatal_pop(&frame);
+
+    timer_stop(&span);
+    timer_add_tokens(TIMER_LEX, pipeline->tokens);
+
+    return NULL;
+}
+
+/* Lexer side, data of any size goes through output in pieces */
+static void put(struct pipeline *pipeline, const void *data, size_t size)
+{
+    const char *bytes;
+
+    bytes = data;
+
+    while (size != 0)
+    {
+        size_t piece;
+
+        piece = PIPELINE_BATCH_SIZE - pipeline->output_used;
+
+        if (piece > size)
+            piece = size;
+
+        memcpy(&pipeline->output[pipeline->output_used], bytes, piece);
+        pipeline->output_used += piece;
+        bytes += piece;
+        size -= piece;
+
+        if (pipeline->output_used == PIPELINE_BATCH_SIZE)
+            flush(pipeline);
+    }
+}
+
+/*
+  Write the whole batch, waiting for the parser whenever ring is full
+  Once the parser stopped the batch is dropped
+*/
+static void flush(struct pipeline *pipeline)
+{
+    size_t written;
+
+    written = 0;
+
+    while (written != pipeline->output_used)
+    {
+        size_t count;
+
+        if (atomic_load(&pipeline->stop))
+            break;
+
+        count = ring_write(pipeline->ring, &pipeline->output[written],
+            pipeline->output_used - written);
+
+        if (count == 0)
+        {
+            wait_until(pipeline, &pipeline->lexer_waiting, can_write);
+            continue;
+        }
+
+        written += count;
+        notify(pipeline, &pipeline->parser_waiting);
+    }
+
+    pipeline->output_used = 0;
+}
+
+/* Parser side, refills input from ring, waiting while it is empty */
+static void get(struct pipeline *pipeline, void *buffer, size_t size)
+{
+    char *bytes;
+
+    bytes = buffer;
+
+    while (size != 0)
+    {
+        size_t piece;
+
+        if (pipeline->input_read == pipeline->input_used)
+        {
+            pipeline->input_used = ring_read(pipeline->ring, pipeline->input,
+                PIPELINE_BATCH_SIZE);
+            pipeline->input_read = 0;
+
+            if (pipeline->input_used == 0)
+            {
+                /* Everything the lexer wrote before it failed is read */
+                if (atomic_load(&pipeline->failed)
+                    && ring_readable(pipeline->ring) == 0)
+                {
+                    fatal(pipeline->exitcode, "%s", pipeline->message);
+                }
+
+                wait_until(pipeline, &pipeline->parser_waiting, can_read);
+                continue;
+            }
+
+            notify(pipeline, &pipeline->lexer_waiting);
+        }
+
+        piece = pipeline->input_used - pipeline->input_read;
+
+        if (piece > size)
+            piece = size;
+
+        memcpy(bytes, &pipeline->input[pipeline->input_read], piece);
+        pipeline->input_read += piece;
+        bytes += piece;
+        size -= piece;
+    }
+}
+
+static bool can_write(struct pipeline *pipeline)
+{
+    return ring_writable(pipeline->ring) != 0
+        || atomic_load(&pipeline->stop);
+}
+
+static bool can_read(struct pipeline *pipeline)
+{
+    return ring_readable(pipeline->ring) != 0
+        || atomic_load(&pipeline->failed);
+}
+
+/*
+  Flag is set before ready is checked again and notify checks the flag
+  after it moved the ring, with full fences in between on both sides
+  one of them sees the other, so a wakeup isn't lost
+*/
+static void wait_until(struct pipeline *pipeline, atomic_bool *waiting,
+    bool (*ready)(struct pipeline *pipeline))
+{
+    for (size_t i = 0; i != PIPELINE_SPINS; ++i)
+    {
+        if (ready(pipeline))
+            return;
+    }
+
+    pthread_mutex_lock(&pipeline->lock);
+    atomic_store(waiting, true);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    while (ready(pipeline) == false)
+        pthread_cond_wait(&pipeline->wake, &pipeline->lock);
+
+    atomic_store(waiting, false);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+static void notify(struct pipeline *pipeline, atomic_bool *waiting)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(waiting, memory_order_relaxed) == false)
+        return;
+
+    pthread_mutex_lock(&pipeline->lock);
+    pthread_cond_broadcast(&pipeline->wake);
+    pthread_mutex_unlock(&pipeline->lock);
+}
@@ -0,0 +1,38 @@
+#ifndef _PARSER_PIPELINE_H_
+#define _PARSER_PIPELINE_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <lexer/lunit.h>
+
+/* Bytes of the ring between lexer and parser, a power of two */
+#define PIPELINE_RING_CAPACITY (256 * 1024)
+
+/* Lunits cross the ring in batches of this many bytes */
+#define PIPELINE_BATCH_SIZE (16 * 1024)
+
+/* Checks of the ring before a side goes to sleep */
+#define PIPELINE_SPINS 256
+
+/*
+  Lexer running on a thread of its own, ahead of the parser:
+
+    pipeline = pipeline_start(in);
+    ast = parser_parse(parser, file_name, pipeline_next, pipeline);
+    tokens = pipeline_finish(pipeline);
+
+  Lunits go through a bounded lock-free ring, the lexer waits while it
+  is full, so memory doesn't grow with the unit however large it is
+  If parser_parse fails, pipeline_stop takes the place of
+  pipeline_finish, the lexer thread must be gone before fatal exits
+  Errors of the lexer are raised by pipeline_next on the parser thread
+*/
+struct pipeline;
+
+struct pipeline *pipeline_start(FILE *in);
+struct lunit *pipeline_next(void *context);
+size_t pipeline_finish(struct pipeline *pipeline);
+void pipeline_stop(struct pipeline *pipeline);
+
+#endif